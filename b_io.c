@@ -20,12 +20,15 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <time.h>
+#include <pthread.h>
 #include "b_io.h"
 #include "fsStruct.h"
 #include "fsLow.h"
 
 #define MAXFCBS 20
 #define B_CHUNK_SIZE 512
+#define DELALLOC_BLOCKS 64	// pending blocks a descriptor holds before a flush
+#define B_NO_CUT UINT64_MAX
 
 typedef struct b_fcb
 {
@@ -33,46 +36,139 @@ typedef struct b_fcb
 	char *buf;
 	int index;
 	int buflen;
+	pthread_mutex_t lock;	// held by every call using this descriptor
+	// delayed allocation: data written past the file's blocks waits here,
+	// file blocks [pendStart, pendStart + pendCount), until a flush gives
+	// the whole run its disk blocks at once
+	char *pend;
+	uint32_t pendStart;
+	uint32_t pendCount;
+	// the bytes of each pending block written, [dirtyFrom, dirtyTo); only
+	// these go into a block another descriptor gave the file meanwhile
+	uint16_t dirtyFrom[DELALLOC_BLOCKS];
+	uint16_t dirtyTo[DELALLOC_BLOCKS];
+	// a truncate by someone else cut the file to this (B_NO_CUT if none);
+	// set and taken under the file's node lock
+	uint64_t cutTo;
+	int modified;	// written to: closing it updates the directory entry
+	// the entry was deleted or replaced while open (b_unlinked): the file
+	// lives on without it and the last descriptor closing frees it; set
+	// under fcbTableLock
+	int unlinked;
 } b_fcb;
 
-b_fcb fcbArray[MAXFCBS];
+static b_fcb fcbArray[MAXFCBS];
 
-int startup = 0;
+// guards which FCBs are free (buf == NULL), the file each one has open
+// (dirBlock, filename, startBlock) and unlinked; taken last, under node
+// locks too
+static pthread_mutex_t fcbTableLock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t startup = PTHREAD_ONCE_INIT;
 
 // Method to initialize our file system
-void b_init()
+static void b_init()
 {
 	// initialize fcbArray to all free
 	for (int i = 0; i < MAXFCBS; i++)
 	{
 		fcbArray[i].buf = NULL;
+		pthread_mutex_init(&fcbArray[i].lock, NULL);
 	}
-
-	startup = 1;
 }
 
-// Method to get a free FCB element
-b_io_fd b_getFCB()
+// Method to get a free FCB element; its buffer is allocated right away
+// so no other open can take it
+static b_io_fd b_getFCB()
 {
+	b_io_fd fd = -1;
+	pthread_mutex_lock(&fcbTableLock);
 	for (int i = 0; i < MAXFCBS; i++)
 	{
 		if (fcbArray[i].buf == NULL)
 		{
-			return i;
+			fcbArray[i].buf = malloc(B_CHUNK_SIZE);
+			if (fcbArray[i].buf != NULL)
+			{
+				fd = i;
+				g_fcbArray[i].dirBlock = 0;
+				g_fcbArray[i].startBlock = 0;
+				fcbArray[i].cutTo = B_NO_CUT;
+				fcbArray[i].modified = 0;
+				fcbArray[i].unlinked = 0;
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fcbTableLock);
+	return (fd);
+}
+
+// hands an FCB back to b_getFCB; the last descriptor of an unlinked
+// file frees its blocks
+static void b_releaseFCB(b_io_fd fd)
+{
+	uint32_t orphan = 0;
+	g_fcbArray[fd].inUse = 0;
+	pthread_mutex_lock(&fcbTableLock);
+	if (fcbArray[fd].unlinked)
+	{
+		orphan = (uint32_t)g_fcbArray[fd].startBlock;
+		for (int i = 0; i < MAXFCBS; i++)
+		{
+			if (i != fd && fcbArray[i].buf != NULL && g_fcbArray[i].startBlock == orphan)
+				orphan = 0;
 		}
 	}
-	return (-1);
+	free(fcbArray[fd].buf);
+	fcbArray[fd].buf = NULL;
+	free(fcbArray[fd].pend);
+	fcbArray[fd].pend = NULL;
+	fcbArray[fd].pendCount = 0;
+	pthread_mutex_unlock(&fcbTableLock);
+	if (orphan != 0)
+		fs_freeFileBlocks(orphan);
+}
+
+static int b_isUnlinked(b_io_fd fd)
+{
+	pthread_mutex_lock(&fcbTableLock);
+	int unlinked = fcbArray[fd].unlinked;
+	pthread_mutex_unlock(&fcbTableLock);
+	return unlinked;
 }
 
+static int b_openFCB(b_io_fd returnFd, uint32_t atBlock, char *filename, int flags);
+static int b_seekLocked(b_io_fd fd, off_t offset, int whence);
+static off_t b_seekSparseLocked(b_io_fd fd, off_t offset, int whence);
+static int b_writeLocked(b_io_fd fd, char *buffer, int count);
+static int b_readLocked(b_io_fd fd, char *buffer, int count);
+static int b_closeLocked(b_io_fd fd);
+static int b_pendBlock(b_io_fd fd, FileHeader *header, uint32_t headerBlock, uint32_t index, int *dirty);
+static int b_flushLocked(b_io_fd fd, FileHeader *header, uint32_t headerBlock);
+static int b_syncDataLocked(b_io_fd fd);
+static int b_storeEntryLocked(b_io_fd fd);
+static int b_ensureHeaderLocked(b_io_fd fd);
+static int b_findEntryLocked(b_io_fd fd, DirBlock *cur, uint32_t *curBlock, DirEntry *entry, uint32_t *slot);
+static void b_refreshLocked(b_io_fd fd, const FileHeader *header);
+static int b_fallocateLocked(b_io_fd fd, off_t offset, off_t len, int mode);
+static uint32_t b_goalBlock(const FileHeader *header, uint32_t headerBlock, uint32_t index);
+static int b_punchLocked(FileHeader *header, uint32_t headerBlock, uint64_t offset, uint64_t end);
+
 // Interface to open a buffered file
 // Modification of interface for this assignment, flags match the Linux flags for open
 // O_RDONLY, O_WRONLY, or O_RDWR
 b_io_fd b_open(char *filename, int flags)
+{
+	return b_openAt(0, filename, flags);
+}
+
+// open relative to the directory block atBlock (0 resolves like b_open)
+b_io_fd b_openAt(uint32_t atBlock, char *filename, int flags)
 {
 	b_io_fd returnFd;
 
-	if (startup == 0)
-		b_init();
+	pthread_once(&startup, b_init);
 
 	returnFd = b_getFCB();
 	if (returnFd == -1)
@@ -81,62 +177,60 @@ b_io_fd b_open(char *filename, int flags)
 		return -1;
 	}
 
-	// check if file exists
-	DirEntry entry;
-	int fileExists = (fs_findFile(filename, &entry) == 0);
-
-	// handle different open modes
-	if (!fileExists)
+	fs_treeLockShared();
+	int rc = b_openFCB(returnFd, atBlock, filename, flags);
+	fs_treeUnlock();
+	if (rc != 0)
 	{
-		if (flags & O_CREAT)
-		{
-			// create new file
-			if (fs_createFile(filename, FT_FILE) != 0)
-			{
-				printf("Failed to create file: %s\n", filename);
-				return -1;
-			}
-		}
-		else
-		{
-			printf("File does not exist: %s\n", filename);
-			return -1;
-		}
+		b_releaseFCB(returnFd);
+		return -1;
 	}
+	return returnFd;
+}
 
-	// re-get file info (whether newly created or existing)
-	if (fs_findFile(filename, &entry) != 0)
+// fills the reserved FCB returnFd, 0 or -1
+static int b_openFCB(b_io_fd returnFd, uint32_t atBlock, char *filename, int flags)
+{
+	// resolve the parent once, the FCB keeps it for b_close
+	uint32_t dirBlock = 0;
+	char name[MAX_FILENAME_LEN + 1];
+	if (filename == NULL || fs_resolvePathAt(atBlock, filename, &dirBlock, name, sizeof(name)) != 0 || name[0] == '\0')
 	{
-		printf("Failed to get file info\n");
+		printf("File does not exist: %s\n", filename ? filename : "");
 		return -1;
 	}
 
-	// if in read mode, ensure file size is up-to-date
-	if (flags == O_RDONLY || (flags & O_RDONLY))
+	// create the file if asked, unless it exists or another thread
+	// just made it
+	DirEntry entry;
+	if ((flags & O_CREAT) && fs_findInDir(dirBlock, name, &entry, NULL) != 0)
+		fs_createFileAt(dirBlock, name, FT_FILE);
+
+	// the descriptor is registered under the directory's lock, so a
+	// delete of the file either came first or finds it (b_unlinked)
+	int rc = -1;
+	fs_nodeReadLock(dirBlock);
+	if (fs_findInDir(dirBlock, name, &entry, NULL) != 0)
+		printf("%s: %s\n", (flags & O_CREAT) ? "Failed to create file" : "File does not exist", filename);
+	else if (entry.fileType != FT_FILE)
+		printf("Not a file: %s\n", filename);
+	else
 	{
-		// re-read directory entry to get latest file size
-		DirBlock rootDir;
-		uint64_t result = LBAread(&rootDir, 1, g_superBlock.rootDirBlock);
-		if (result == 1)
-		{
-			for (uint32_t i = 0; i < rootDir.entryCount; i++)
-			{
-				if (strcmp(rootDir.entries[i].filename, filename) == 0)
-				{
-					entry = rootDir.entries[i];
-					break;
-				}
-			}
-		}
+		pthread_mutex_lock(&fcbTableLock);
+		snprintf(g_fcbArray[returnFd].filename, sizeof(g_fcbArray[returnFd].filename), "%s", name);
+		g_fcbArray[returnFd].dirBlock = dirBlock;
+		g_fcbArray[returnFd].startBlock = entry.startBlock;
+		pthread_mutex_unlock(&fcbTableLock);
+		rc = 0;
 	}
+	fs_nodeUnlock(dirBlock);
+	if (rc != 0)
+		return -1;
 
 	// set file control block
 	g_fcbArray[returnFd].inUse = 1;
-	strncpy(g_fcbArray[returnFd].filename, filename, MAX_FILENAME_LEN);
-	g_fcbArray[returnFd].filename[MAX_FILENAME_LEN] = '\0';
 	g_fcbArray[returnFd].currentPos = 0;
 	g_fcbArray[returnFd].fileSize = entry.fileSize;
-	g_fcbArray[returnFd].startBlock = entry.startBlock;
 	g_fcbArray[returnFd].flags = flags;
 	g_fcbArray[returnFd].lastAccess = time(NULL);
 
@@ -146,37 +240,27 @@ b_io_fd b_open(char *filename, int flags)
 		g_fcbArray[returnFd].currentPos = entry.fileSize;
 	}
 
-	// handle O_TRUNC flag
+	// handle O_TRUNC flag: the file keeps its header, only its blocks go
 	if (flags & O_TRUNC)
 	{
-		g_fcbArray[returnFd].fileSize = 0;
-		// free all blocks
-		if (entry.startBlock != 0)
+		if (fs_truncateInDir(dirBlock, name, 0) != 0)
 		{
-			fs_freeBlock(entry.startBlock);
+			printf("Failed to truncate file: %s\n", filename);
+			return -1;
 		}
-		g_fcbArray[returnFd].startBlock = 0;
+		g_fcbArray[returnFd].fileSize = 0;
 	}
 
-	// allocate buffer
-	fcbArray[returnFd].buf = malloc(B_CHUNK_SIZE);
-	if (fcbArray[returnFd].buf == NULL)
-	{
-		printf("Failed to allocate buffer\n");
-		g_fcbArray[returnFd].inUse = 0;
-		return -1;
-	}
 	fcbArray[returnFd].index = 0;
 	fcbArray[returnFd].buflen = 0;
 
-	return returnFd;
+	return 0;
 }
 
 // Interface to seek function
 int b_seek(b_io_fd fd, off_t offset, int whence)
 {
-	if (startup == 0)
-		b_init();
+	pthread_once(&startup, b_init);
 
 	// check that fd is between 0 and (MAXFCBS-1)
 	if ((fd < 0) || (fd >= MAXFCBS))
@@ -184,6 +268,14 @@ int b_seek(b_io_fd fd, off_t offset, int whence)
 		return (-1); // invalid file descriptor
 	}
 
+	pthread_mutex_lock(&fcbArray[fd].lock);
+	int rc = b_seekLocked(fd, offset, whence);
+	pthread_mutex_unlock(&fcbArray[fd].lock);
+	return rc;
+}
+
+static int b_seekLocked(b_io_fd fd, off_t offset, int whence)
+{
 	if (!g_fcbArray[fd].inUse)
 	{
 		printf("File descriptor not in use: %d\n", fd);
@@ -203,6 +295,12 @@ int b_seek(b_io_fd fd, off_t offset, int whence)
 	case SEEK_END:
 		newPos = g_fcbArray[fd].fileSize + offset;
 		break;
+	case SEEK_DATA:
+	case SEEK_HOLE:
+		newPos = b_seekSparseLocked(fd, offset, whence);
+		if (newPos < 0)
+			return -1;
+		break;
 	default:
 		printf("Invalid whence value: %d\n", whence);
 		return -1;
@@ -218,14 +316,55 @@ int b_seek(b_io_fd fd, off_t offset, int whence)
 	// update position
 	g_fcbArray[fd].currentPos = newPos;
 
-	return 0;
+	return (int)newPos;
+}
+
+// SEEK_DATA and SEEK_HOLE: the first offset from offset on that is data,
+// or in a hole.  Holes and unwritten blocks count as holes, and so does
+// the end of the file; -1 when offset is past it
+static off_t b_seekSparseLocked(b_io_fd fd, off_t offset, int whence)
+{
+	// pending blocks are data
+	if (b_syncDataLocked(fd) != 0)
+		return -1;
+	FileHeader header;
+	header.dataBlockCount = 0;
+	uint32_t headerBlock = (uint32_t)g_fcbArray[fd].startBlock;
+	if (headerBlock != 0)
+	{
+		fs_nodeReadLock(headerBlock);
+		int ok = LBAread(&header, 1, headerBlock) == 1 && header.magic == FILEHEADER_MAGIC;
+		if (ok)
+			b_refreshLocked(fd, &header);
+		fs_nodeUnlock(headerBlock);
+		if (!ok)
+		{
+			printf("Invalid file header\n");
+			return -1;
+		}
+	}
+	off_t size = (off_t)g_fcbArray[fd].fileSize;
+	if (offset < 0 || offset >= size)
+	{
+		printf("Seek offset past end of file: %lld\n", (long long)offset);
+		return -1;
+	}
+	int wantData = (whence == SEEK_DATA);
+	for (uint32_t i = (uint32_t)(offset / BLOCK_SIZE); (off_t)i * BLOCK_SIZE < size; i++)
+	{
+		int data = i < header.dataBlockCount && BLOCK_HAS_DATA(header.dataBlocks[i]);
+		if (data == wantData)
+			return (off_t)i * BLOCK_SIZE > offset ? (off_t)i * BLOCK_SIZE : offset;
+	}
+	if (wantData)
+		return -1; // only holes up to the end
+	return size;
 }
 
 // Interface to write function
 int b_write(b_io_fd fd, char *buffer, int count)
 {
-	if (startup == 0)
-		b_init();
+	pthread_once(&startup, b_init);
 
 	// check that fd is between 0 and (MAXFCBS-1)
 	if ((fd < 0) || (fd >= MAXFCBS))
@@ -233,6 +372,14 @@ int b_write(b_io_fd fd, char *buffer, int count)
 		return (-1); // invalid file descriptor
 	}
 
+	pthread_mutex_lock(&fcbArray[fd].lock);
+	int rc = b_writeLocked(fd, buffer, count);
+	pthread_mutex_unlock(&fcbArray[fd].lock);
+	return rc;
+}
+
+static int b_writeLocked(b_io_fd fd, char *buffer, int count)
+{
 	if (!g_fcbArray[fd].inUse)
 	{
 		printf("File descriptor not in use: %d\n", fd);
@@ -247,29 +394,22 @@ int b_write(b_io_fd fd, char *buffer, int count)
 	}
 
 	// multi-block implementation via FileHeader
-	// ensure header exists
-	if (g_fcbArray[fd].startBlock == 0)
-	{
-		g_fcbArray[fd].startBlock = fs_allocateBlock();
-		if (g_fcbArray[fd].startBlock == 0)
-		{
-			printf("Failed to allocate header block\n");
-			return -1;
-		}
-		FileHeader newHeader;
-		memset(&newHeader, 0, sizeof(newHeader));
-		newHeader.magic = FILEHEADER_MAGIC;
-		newHeader.fileSize = 0;
-		newHeader.dataBlockCount = 0;
-		if (LBAwrite(&newHeader, 1, g_fcbArray[fd].startBlock) != 1)
-			return -1;
-	}
+	if (b_ensureHeaderLocked(fd) != 0)
+		return -1;
+	b_fcb *f = &fcbArray[fd];
 	FileHeader header;
-	if (LBAread(&header, 1, g_fcbArray[fd].startBlock) != 1 || header.magic != FILEHEADER_MAGIC)
+	uint32_t headerBlock = (uint32_t)g_fcbArray[fd].startBlock;
+	// other descriptors of the file read and write under the same lock
+	fs_nodeWriteLock(headerBlock);
+	if (LBAread(&header, 1, headerBlock) != 1 || header.magic != FILEHEADER_MAGIC)
 	{
+		fs_nodeUnlock(headerBlock);
 		printf("Invalid file header\n");
 		return -1;
 	}
+	b_refreshLocked(fd, &header);
+	uint64_t sizeBefore = header.fileSize;
+	int dirty = 0; // header changed
 	uint64_t remaining = (uint64_t)count;
 	char *src = buffer;
 	while (remaining > 0)
@@ -277,48 +417,324 @@ int b_write(b_io_fd fd, char *buffer, int count)
 		uint64_t filePos = g_fcbArray[fd].currentPos;
 		uint64_t blockIndex = filePos / BLOCK_SIZE;
 		uint64_t within = filePos % BLOCK_SIZE;
-		// ensure data block exists
-		if (blockIndex >= header.dataBlockCount)
+		uint64_t can = BLOCK_SIZE - within;
+		if (can > remaining)
+			can = remaining;
+		if (blockIndex < header.dataBlockCount &&
+			(f->pendCount == 0 || blockIndex < f->pendStart))
 		{
-			if (header.dataBlockCount >= MAX_FILE_BLOCKS)
+			// the block exists, write it through; a hole gets its disk
+			// block now, and it or an unwritten one has nothing worth
+			// reading and is written from then on
+			uint32_t dataLBA = BLOCK_NUMBER(header.dataBlocks[blockIndex]);
+			int unwritten = !BLOCK_HAS_DATA(header.dataBlocks[blockIndex]);
+			if (dataLBA == BLOCK_HOLE)
 			{
-				printf("File too large\n");
-				break;
+				dataLBA = (uint32_t)fs_allocateBlockNear(b_goalBlock(&header, headerBlock, (uint32_t)blockIndex));
+				if (dataLBA == 0)
+				{
+					printf("b_write: Failed to allocate block\n");
+					break;
+				}
 			}
-			uint64_t nb = fs_allocateBlock();
-			if (nb == 0)
+			char blk[BLOCK_SIZE];
+			if (unwritten || LBAread(blk, 1, dataLBA) != 1)
+				memset(blk, 0, sizeof(blk));
+			memcpy(blk + within, src, (size_t)can);
+			if (LBAwrite(blk, 1, dataLBA) != 1)
 			{
-				printf("b_write: Failed to allocate block\n");
+				printf("Failed to write data block\n");
+				if (header.dataBlocks[blockIndex] == BLOCK_HOLE)
+					fs_freeBlock(dataLBA);
 				break;
 			}
-			header.dataBlocks[header.dataBlockCount++] = (uint32_t)nb;
+			if (unwritten)
+			{
+				header.dataBlocks[blockIndex] = dataLBA;
+				dirty = 1;
+			}
 		}
-		uint32_t dataLBA = header.dataBlocks[blockIndex];
-		char blk[BLOCK_SIZE];
-		if (LBAread(blk, 1, dataLBA) != 1)
-			memset(blk, 0, sizeof(blk));
-		uint64_t can = BLOCK_SIZE - within;
-		if (can > remaining)
-			can = remaining;
-		memcpy(blk + within, src, (size_t)can);
-		if (LBAwrite(blk, 1, dataLBA) != 1)
+		else
 		{
-			printf("Failed to write data block\n");
-			break;
+			// past the allocated blocks: held back until the flush
+			if (b_pendBlock(fd, &header, headerBlock, (uint32_t)blockIndex, &dirty) != 0)
+				break;
+			uint32_t k = (uint32_t)(blockIndex - f->pendStart);
+			memcpy(f->pend + k * BLOCK_SIZE + within, src, (size_t)can);
+			if (within < f->dirtyFrom[k])
+				f->dirtyFrom[k] = (uint16_t)within;
+			if (within + can > f->dirtyTo[k])
+				f->dirtyTo[k] = (uint16_t)(within + can);
 		}
 		g_fcbArray[fd].currentPos += (off_t)can;
-		if (g_fcbArray[fd].currentPos > (off_t)header.fileSize)
-			header.fileSize = g_fcbArray[fd].currentPos;
+		if (g_fcbArray[fd].currentPos > (off_t)g_fcbArray[fd].fileSize)
+			g_fcbArray[fd].fileSize = g_fcbArray[fd].currentPos;
+		// the header only counts bytes that have blocks
+		uint64_t onDisk = (uint64_t)header.dataBlockCount * BLOCK_SIZE;
+		uint64_t size = g_fcbArray[fd].fileSize < onDisk ? g_fcbArray[fd].fileSize : onDisk;
+		if (size > header.fileSize)
+		{
+			header.fileSize = size;
+			dirty = 1;
+		}
 		src += can;
 		remaining -= can;
 	}
-	// persist header and update fcb
-	if (LBAwrite(&header, 1, g_fcbArray[fd].startBlock) != 1)
+	// persist header
+	int written = !dirty || (LBAwrite(&header, 1, headerBlock) == 1);
+	fs_nodeUnlock(headerBlock);
+	if (!written)
 		return -1;
-	g_fcbArray[fd].fileSize = header.fileSize;
+	if (header.fileSize > g_fcbArray[fd].fileSize)
+		g_fcbArray[fd].fileSize = header.fileSize;
+	if (remaining < (uint64_t)count)
+		f->modified = 1;
+	// the entry shows the size the header has
+	if (header.fileSize != sizeBefore)
+		b_storeEntryLocked(fd);
 	return (int)(count - remaining);
 }
 
+// makes file block index part of fd's pending run, flushing the run first
+// when it is full or index lies past its end.  The run starts at the first
+// block the file does not have yet; blocks skipped to reach index become
+// holes
+static int b_pendBlock(b_io_fd fd, FileHeader *header, uint32_t headerBlock, uint32_t index, int *dirty)
+{
+	b_fcb *f = &fcbArray[fd];
+	if (f->pend == NULL)
+	{
+		f->pend = malloc(DELALLOC_BLOCKS * BLOCK_SIZE);
+		if (f->pend == NULL)
+		{
+			printf("b_write: Failed to allocate block\n");
+			return -1;
+		}
+	}
+	if (index >= MAX_FILE_BLOCKS)
+	{
+		printf("File too large\n");
+		return -1;
+	}
+	if (f->pendCount > 0 && index > f->pendStart + f->pendCount)
+	{
+		*dirty = 1;
+		if (b_flushLocked(fd, header, headerBlock) != 0)
+			return -1;
+	}
+	if (f->pendCount == 0)
+	{
+		while (header->dataBlockCount < index)
+		{
+			header->dataBlocks[header->dataBlockCount++] = BLOCK_HOLE;
+			*dirty = 1;
+		}
+		f->pendStart = header->dataBlockCount;
+	}
+	while (index >= f->pendStart + f->pendCount)
+	{
+		if (f->pendCount == DELALLOC_BLOCKS)
+		{
+			*dirty = 1;
+			if (b_flushLocked(fd, header, headerBlock) != 0)
+				return -1;
+			f->pendStart = header->dataBlockCount;
+			continue;
+		}
+		memset(f->pend + f->pendCount * BLOCK_SIZE, 0, BLOCK_SIZE);
+		f->dirtyFrom[f->pendCount] = BLOCK_SIZE;
+		f->dirtyTo[f->pendCount] = 0;
+		f->pendCount++;
+	}
+	return 0;
+}
+
+// gives fd's pending blocks their disk blocks, one extent for the run,
+// and writes them, a contiguous stretch per LBAwrite.  header is the
+// file's header read under its node lock, held; the caller writes it
+static int b_flushLocked(b_io_fd fd, FileHeader *header, uint32_t headerBlock)
+{
+	b_fcb *f = &fcbArray[fd];
+	uint32_t end = f->pendStart + f->pendCount;
+	uint32_t blocks[MAX_FILE_BLOCKS];
+	int rc = 0;
+	if (f->pendCount == 0)
+		return 0;
+	// blocks another descriptor gave the file meanwhile may hold its
+	// data: only the bytes this one wrote are merged into them
+	for (uint32_t i = f->pendStart; i < end && i < header->dataBlockCount; i++)
+	{
+		uint32_t k = i - f->pendStart;
+		uint32_t entry = header->dataBlocks[i];
+		uint32_t lba = BLOCK_NUMBER(entry);
+		char *data = f->pend + k * BLOCK_SIZE;
+		char blk[BLOCK_SIZE];
+		if (f->dirtyFrom[k] >= f->dirtyTo[k])
+			continue; // nothing written there
+		if (lba == BLOCK_HOLE)
+		{
+			// reads as zeros, like the unwritten bytes of the pending block
+			lba = (uint32_t)fs_allocateBlockNear(b_goalBlock(header, headerBlock, i));
+			if (lba == 0)
+			{
+				rc = -1;
+				continue;
+			}
+		}
+		else
+		{
+			if (!BLOCK_HAS_DATA(entry))
+				memset(blk, 0, sizeof(blk));
+			else if (LBAread(blk, 1, lba) != 1)
+			{
+				rc = -1;
+				continue;
+			}
+			memcpy(blk + f->dirtyFrom[k], data + f->dirtyFrom[k], f->dirtyTo[k] - f->dirtyFrom[k]);
+			data = blk;
+		}
+		if (LBAwrite(data, 1, lba) != 1)
+		{
+			if (entry == BLOCK_HOLE)
+				fs_freeBlock(lba);
+			rc = -1;
+			continue;
+		}
+		header->dataBlocks[i] = lba;
+	}
+	// the run starts at the file's end or inside it (b_refreshLocked cuts
+	// it back with the file); holes up to it should the file lack blocks
+	while (header->dataBlockCount < f->pendStart)
+		header->dataBlocks[header->dataBlockCount++] = BLOCK_HOLE;
+	uint32_t from = header->dataBlockCount;
+	if (end > from)
+	{
+		uint32_t goal = b_goalBlock(header, headerBlock, from);
+		uint32_t got = fs_allocateExtent(goal, end - from, blocks);
+		for (uint32_t k = 0; k < got; )
+		{
+			uint32_t run = 1;
+			while (k + run < got && blocks[k + run] == blocks[k] + run)
+				run++;
+			if (LBAwrite(f->pend + (from + k - f->pendStart) * BLOCK_SIZE, run, blocks[k]) != run)
+				rc = -1;
+			k += run;
+		}
+		for (uint32_t k = 0; k < got; k++)
+			header->dataBlocks[from + k] = blocks[k];
+		header->dataBlockCount = from + got;
+		if (got < end - from)
+		{
+			printf("b_write: Failed to allocate block\n");
+			rc = -1;
+		}
+	}
+	uint64_t onDisk = (uint64_t)header->dataBlockCount * BLOCK_SIZE;
+	uint64_t size = g_fcbArray[fd].fileSize < onDisk ? g_fcbArray[fd].fileSize : onDisk;
+	if (size > header->fileSize)
+		header->fileSize = size;
+	f->pendCount = 0;
+	return rc;
+}
+
+// flushes fd's pending blocks and writes the header
+static int b_syncDataLocked(b_io_fd fd)
+{
+	if (fcbArray[fd].pendCount == 0)
+		return 0;
+	FileHeader header;
+	uint32_t headerBlock = (uint32_t)g_fcbArray[fd].startBlock;
+	fs_nodeWriteLock(headerBlock);
+	int rc = -1;
+	uint64_t sizeBefore = 0;
+	if (LBAread(&header, 1, headerBlock) == 1 && header.magic == FILEHEADER_MAGIC)
+	{
+		b_refreshLocked(fd, &header);
+		sizeBefore = header.fileSize;
+		rc = b_flushLocked(fd, &header, headerBlock);
+		if (LBAwrite(&header, 1, headerBlock) != 1)
+			rc = -1;
+	}
+	fs_nodeUnlock(headerBlock);
+	if (rc == 0 && header.fileSize != sizeBefore)
+		rc = b_storeEntryLocked(fd);
+	return rc;
+}
+
+// brings fd up to date with header, the file's header read under its
+// node lock, held: pending data a truncate by another descriptor cut off
+// is dropped, and the size is the header's, or the end of the pending
+// data past it
+static void b_refreshLocked(b_io_fd fd, const FileHeader *header)
+{
+	b_fcb *f = &fcbArray[fd];
+	uint64_t cut = f->cutTo;
+	f->cutTo = B_NO_CUT;
+	if (cut != B_NO_CUT && f->pendCount > 0)
+	{
+		uint64_t runStart = (uint64_t)f->pendStart * BLOCK_SIZE;
+		uint64_t keep = (cut > runStart) ? (cut - runStart + BLOCK_SIZE - 1) / BLOCK_SIZE : 0;
+		if (keep < f->pendCount)
+			f->pendCount = (uint32_t)keep;
+		uint32_t k = (uint32_t)(cut / BLOCK_SIZE) - f->pendStart;
+		uint32_t within = (uint32_t)(cut % BLOCK_SIZE);
+		if (cut > runStart && within != 0 && k < f->pendCount)
+		{
+			memset(f->pend + k * BLOCK_SIZE + within, 0, BLOCK_SIZE - within);
+			if (f->dirtyTo[k] > within)
+				f->dirtyTo[k] = (uint16_t)within;
+		}
+	}
+	uint64_t size = header->fileSize;
+	for (uint32_t k = f->pendCount; k-- > 0; )
+	{
+		if (f->dirtyFrom[k] < f->dirtyTo[k])
+		{
+			uint64_t end = (uint64_t)(f->pendStart + k) * BLOCK_SIZE + f->dirtyTo[k];
+			if (end > size)
+				size = end;
+			break;
+		}
+	}
+	g_fcbArray[fd].fileSize = size;
+}
+
+// the file of headerBlock was cut to size, under its node lock: the
+// descriptors that have it open drop what they hold back past that
+void b_truncated(uint32_t headerBlock, uint64_t size)
+{
+	pthread_mutex_lock(&fcbTableLock);
+	for (int i = 0; i < MAXFCBS; i++)
+	{
+		if (fcbArray[i].buf != NULL && g_fcbArray[i].startBlock == headerBlock &&
+			size < fcbArray[i].cutTo)
+			fcbArray[i].cutTo = size;
+	}
+	pthread_mutex_unlock(&fcbTableLock);
+}
+
+// the entry name of dirBlock, of the file whose header is headerBlock (0
+// if it has none), is deleted or replaced, under dirBlock's write lock:
+// the descriptors that have the file open keep it, unlinked, and the last
+// one closing frees it.  1 when the caller must leave its blocks to them
+int b_unlinked(uint32_t dirBlock, const char *name, uint32_t headerBlock)
+{
+	int open = 0;
+	pthread_mutex_lock(&fcbTableLock);
+	for (int i = 0; i < MAXFCBS; i++)
+	{
+		if (fcbArray[i].buf == NULL || fcbArray[i].unlinked)
+			continue;
+		if (headerBlock != 0 && g_fcbArray[i].startBlock == headerBlock)
+			open = fcbArray[i].unlinked = 1;
+		else if (g_fcbArray[i].startBlock == 0 && g_fcbArray[i].dirBlock == dirBlock &&
+				 strcmp(g_fcbArray[i].filename, name) == 0)
+			fcbArray[i].unlinked = 1; // not written yet, nothing to keep
+	}
+	pthread_mutex_unlock(&fcbTableLock);
+	return open;
+}
+
 // Interface to read a buffer
 
 // Filling the callers request is broken into three parts
@@ -340,8 +756,7 @@ int b_write(b_io_fd fd, char *buffer, int count)
 //  +-------------+------------------------------------------------+--------+
 int b_read(b_io_fd fd, char *buffer, int count)
 {
-	if (startup == 0)
-		b_init();
+	pthread_once(&startup, b_init);
 
 	// check that fd is between 0 and (MAXFCBS-1)
 	if ((fd < 0) || (fd >= MAXFCBS))
@@ -349,6 +764,14 @@ int b_read(b_io_fd fd, char *buffer, int count)
 		return (-1); // invalid file descriptor
 	}
 
+	pthread_mutex_lock(&fcbArray[fd].lock);
+	int rc = b_readLocked(fd, buffer, count);
+	pthread_mutex_unlock(&fcbArray[fd].lock);
+	return rc;
+}
+
+static int b_readLocked(b_io_fd fd, char *buffer, int count)
+{
 	if (!g_fcbArray[fd].inUse)
 	{
 		printf("File descriptor not in use: %d\n", fd);
@@ -362,9 +785,31 @@ int b_read(b_io_fd fd, char *buffer, int count)
 		return -1;
 	}
 
+	// what this descriptor wrote is read back from disk
+	if (b_syncDataLocked(fd) != 0)
+		return -1;
+
+	// if file has no blocks, return 0
+	if (g_fcbArray[fd].startBlock == 0)
+	{
+		return 0;
+	}
+
+	// multi-block read via FileHeader
+	FileHeader header;
+	uint32_t headerBlock = (uint32_t)g_fcbArray[fd].startBlock;
+	fs_nodeReadLock(headerBlock);
+	if (LBAread(&header, 1, headerBlock) != 1 || header.magic != FILEHEADER_MAGIC)
+	{
+		fs_nodeUnlock(headerBlock);
+		return -1;
+	}
+	b_refreshLocked(fd, &header);
+
 	// check if reached end of file
 	if (g_fcbArray[fd].currentPos >= g_fcbArray[fd].fileSize)
 	{
+		fs_nodeUnlock(headerBlock);
 		return 0; // EOF
 	}
 
@@ -374,22 +819,6 @@ int b_read(b_io_fd fd, char *buffer, int count)
 	{
 		bytesToRead = g_fcbArray[fd].fileSize - g_fcbArray[fd].currentPos;
 	}
-
-	// if file has no blocks, return 0
-	if (g_fcbArray[fd].startBlock == 0)
-	{
-		return 0;
-	}
-
-	// calculate blocks needed for reading
-	uint64_t startBlock = g_fcbArray[fd].startBlock;
-	uint64_t blockOffset = g_fcbArray[fd].currentPos / BLOCK_SIZE;
-	uint64_t byteOffset = g_fcbArray[fd].currentPos % BLOCK_SIZE;
-
-	// multi-block read via FileHeader
-	FileHeader header;
-	if (LBAread(&header, 1, g_fcbArray[fd].startBlock) != 1 || header.magic != FILEHEADER_MAGIC)
-		return -1;
 	int totalRead = 0;
 	int remaining = bytesToRead;
 	char *dst = buffer;
@@ -401,8 +830,13 @@ int b_read(b_io_fd fd, char *buffer, int count)
 			break;
 		uint32_t dataLBA = header.dataBlocks[blockIndex];
 		char blk[BLOCK_SIZE];
-		if (LBAread(blk, 1, dataLBA) != 1)
-			return -1;
+		if (!BLOCK_HAS_DATA(dataLBA))
+			memset(blk, 0, sizeof(blk)); // a hole or never written
+		else if (LBAread(blk, 1, dataLBA) != 1)
+		{
+			totalRead = -1;
+			break;
+		}
 		uint64_t can = BLOCK_SIZE - within;
 		uint64_t leftInFile = header.fileSize - (uint64_t)g_fcbArray[fd].currentPos;
 		if (can > (uint64_t)remaining)
@@ -415,14 +849,14 @@ int b_read(b_io_fd fd, char *buffer, int count)
 		remaining -= (int)can;
 		totalRead += (int)can;
 	}
+	fs_nodeUnlock(headerBlock);
 	return totalRead;
 }
 
 // Interface to Close the file
 int b_close(b_io_fd fd)
 {
-	if (startup == 0)
-		b_init();
+	pthread_once(&startup, b_init);
 
 	// check that fd is between 0 and (MAXFCBS-1)
 	if ((fd < 0) || (fd >= MAXFCBS))
@@ -430,50 +864,351 @@ int b_close(b_io_fd fd)
 		return (-1); // invalid file descriptor
 	}
 
+	pthread_mutex_lock(&fcbArray[fd].lock);
+	int rc = b_closeLocked(fd);
+	pthread_mutex_unlock(&fcbArray[fd].lock);
+	return rc;
+}
+
+static int b_closeLocked(b_io_fd fd)
+{
 	if (!g_fcbArray[fd].inUse)
 	{
 		printf("File descriptor not in use: %d\n", fd);
 		return -1;
 	}
 
-	// update file size and startBlock in directory entry (persist header already done in write)
+	// data held back for delayed allocation goes to disk first; a
+	// descriptor that only read leaves the entry alone.  An unlinked
+	// file's data goes nowhere, the file is about to be freed
+	int rc = 0;
+	if (b_isUnlinked(fd))
+		fcbArray[fd].pendCount = 0;
+	else
+	{
+		rc = b_syncDataLocked(fd);
+		if (fcbArray[fd].modified)
+			b_storeEntryLocked(fd);
+	}
+
+	// free buffer, mark as unused
+	b_releaseFCB(fd);
+
+	return rc;
+}
+
+// finds fd's directory entry; the FCB holds the parent block and entry
+// name, no path lookup needed.  The directory's lock is held
+static int b_findEntryLocked(b_io_fd fd, DirBlock *cur, uint32_t *curBlock, DirEntry *entry, uint32_t *slot)
+{
+	for (*curBlock = g_fcbArray[fd].dirBlock; *curBlock != 0; *curBlock = cur->nextDirBlock)
+	{
+		if (LBAread(cur, 1, *curBlock) != 1)
+			return -1;
+		if (fs_dirBlockFind(cur, g_fcbArray[fd].filename, entry, slot) == 0)
+			return 0;
+	}
+	return -1;
+}
+
+// update file size and modify time in directory entry (persist header
+// already done in write).  The size is the header's, read under the
+// file's lock with the directory's held, so whoever stores last stores
+// the latest size, never the one a descriptor saw earlier
+static int b_storeEntryLocked(b_io_fd fd)
+{
+	DirBlock cur;
 	DirEntry entry;
-	uint32_t dirBlock = 0;
-	char name[MAX_FILENAME_LEN + 1];
-	if (fs_resolvePath(g_fcbArray[fd].filename, &dirBlock, name, sizeof(name)) == 0)
+	FileHeader header;
+	uint32_t curBlock, slot;
+	uint32_t dirBlock = g_fcbArray[fd].dirBlock;
+	uint32_t headerBlock = (uint32_t)g_fcbArray[fd].startBlock;
+	int rc = -1;
+	if (headerBlock == 0)
+		return 0; // nothing written, the entry has it right
+	fs_treeLockShared();
+	fs_nodeWriteLock2(dirBlock, headerBlock);
+	if (b_isUnlinked(fd))
+		rc = 0; // no entry left to update
+	else if (LBAread(&header, 1, headerBlock) == 1 && header.magic == FILEHEADER_MAGIC &&
+		b_findEntryLocked(fd, &cur, &curBlock, &entry, &slot) == 0 &&
+		entry.startBlock == headerBlock)
 	{
-		DirBlock cur;
-		uint32_t curBlock = dirBlock;
-		while (curBlock)
+		entry.fileSize = (uint32_t)header.fileSize;
+		entry.modifyTime = (uint32_t)time(NULL);
+		fs_dirBlockUpdate(&cur, slot, &entry);
+		if (LBAwrite(&cur, 1, curBlock) == 1)
 		{
-			if (LBAread(&cur, 1, curBlock) != 1)
-				break;
-			for (uint32_t i = 0; i < cur.entryCount; i++)
+			fs_dcacheAdd(dirBlock, &entry);
+			rc = 0;
+		}
+		else
+			fs_dcacheForget(dirBlock);
+	}
+	fs_nodeUnlock2(dirBlock, headerBlock);
+	fs_treeUnlock();
+	return rc;
+}
+
+// Interface to flush a file: pending data gets its blocks and is written,
+// then the header and the directory entry
+int b_fsync(b_io_fd fd)
+{
+	pthread_once(&startup, b_init);
+
+	// check that fd is between 0 and (MAXFCBS-1)
+	if ((fd < 0) || (fd >= MAXFCBS))
+	{
+		return (-1); // invalid file descriptor
+	}
+
+	pthread_mutex_lock(&fcbArray[fd].lock);
+	int rc = -1;
+	if (!g_fcbArray[fd].inUse)
+		printf("File descriptor not in use: %d\n", fd);
+	else if (b_syncDataLocked(fd) == 0)
+	{
+		rc = fcbArray[fd].modified ? b_storeEntryLocked(fd) : 0;
+		fcbArray[fd].modified = 0;
+	}
+	pthread_mutex_unlock(&fcbArray[fd].lock);
+	return rc;
+}
+
+// gives the file of fd a header block if it has none yet.  The entry
+// records it at once, so every descriptor of the file, and a truncate,
+// find the same header; another descriptor may have made it already
+static int b_ensureHeaderLocked(b_io_fd fd)
+{
+	if (g_fcbArray[fd].startBlock != 0)
+		return 0;
+	DirBlock cur;
+	DirEntry entry;
+	uint32_t curBlock, slot;
+	uint32_t dirBlock = g_fcbArray[fd].dirBlock;
+	int rc = -1;
+	fs_treeLockShared();
+	fs_nodeWriteLock(dirBlock);
+	if (b_isUnlinked(fd))
+	{
+		// the entry is gone, maybe reused by another file of that name:
+		// this descriptor's file gets a header of its own
+		FileHeader newHeader;
+		memset(&newHeader, 0, sizeof(newHeader));
+		newHeader.magic = FILEHEADER_MAGIC;
+		if ((entry.startBlock = (uint32_t)fs_allocateBlockNear(dirBlock)) != 0)
+		{
+			if (LBAwrite(&newHeader, 1, entry.startBlock) == 1)
+				rc = 0;
+			else
+				fs_freeBlock(entry.startBlock);
+		}
+	}
+	else if (b_findEntryLocked(fd, &cur, &curBlock, &entry, &slot) == 0)
+	{
+		if (entry.startBlock != 0)
+			rc = 0;
+		else if ((entry.startBlock = (uint32_t)fs_allocateBlockNear(dirBlock)) != 0)
+		{
+			FileHeader newHeader;
+			memset(&newHeader, 0, sizeof(newHeader));
+			newHeader.magic = FILEHEADER_MAGIC;
+			newHeader.fileSize = 0;
+			newHeader.dataBlockCount = 0;
+			fs_dirBlockUpdate(&cur, slot, &entry);
+			if (LBAwrite(&newHeader, 1, entry.startBlock) == 1 && LBAwrite(&cur, 1, curBlock) == 1)
 			{
-				if (strcmp(cur.entries[i].filename, name) == 0)
-				{
-					cur.entries[i].fileSize = (uint32_t)g_fcbArray[fd].fileSize;
-					cur.entries[i].startBlock = (uint32_t)g_fcbArray[fd].startBlock;
-					cur.entries[i].modifyTime = (uint32_t)time(NULL);
-					LBAwrite(&cur, 1, curBlock);
-					curBlock = 0; // done
-					break;
-				}
+				fs_dcacheAdd(dirBlock, &entry);
+				rc = 0;
+			}
+			else
+			{
+				fs_dcacheForget(dirBlock);
+				fs_freeBlock(entry.startBlock);
 			}
-			if (curBlock)
-				curBlock = cur.nextDirBlock;
 		}
 	}
+	fs_nodeUnlock(dirBlock);
+	fs_treeUnlock();
+	if (rc != 0)
+	{
+		printf("Failed to allocate header block\n");
+		return -1;
+	}
+	pthread_mutex_lock(&fcbTableLock);
+	g_fcbArray[fd].startBlock = entry.startBlock;
+	pthread_mutex_unlock(&fcbTableLock);
+	return 0;
+}
+
+// Interface to preallocate: reserves the blocks of [offset, offset + len)
+// the file does not have yet, holes included, as one extent marked
+// unwritten, so later writes there allocate nothing and reads see zeros.
+// All or nothing.  Unless mode has B_FALLOC_KEEP_SIZE the file grows to
+// cover the range.  With B_FALLOC_PUNCH_HOLE (and B_FALLOC_KEEP_SIZE) the
+// range is turned into a hole instead: its whole blocks are freed, the
+// bytes of the partial ones at its ends zeroed
+int b_fallocate(b_io_fd fd, off_t offset, off_t len, int mode)
+{
+	pthread_once(&startup, b_init);
 
-	// free buffer
-	if (fcbArray[fd].buf != NULL)
+	// check that fd is between 0 and (MAXFCBS-1)
+	if ((fd < 0) || (fd >= MAXFCBS))
 	{
-		free(fcbArray[fd].buf);
-		fcbArray[fd].buf = NULL;
+		return (-1); // invalid file descriptor
 	}
 
-	// mark as unused
-	g_fcbArray[fd].inUse = 0;
+	pthread_mutex_lock(&fcbArray[fd].lock);
+	int rc = b_fallocateLocked(fd, offset, len, mode);
+	pthread_mutex_unlock(&fcbArray[fd].lock);
+	return rc;
+}
 
-	return 0;
+static int b_fallocateLocked(b_io_fd fd, off_t offset, off_t len, int mode)
+{
+	if (!g_fcbArray[fd].inUse)
+	{
+		printf("File descriptor not in use: %d\n", fd);
+		return -1;
+	}
+	if (!(g_fcbArray[fd].flags & O_RDWR) && !(g_fcbArray[fd].flags & O_WRONLY))
+	{
+		printf("File not opened for writing: %d\n", fd);
+		return -1;
+	}
+	if (offset < 0 || len <= 0 || (mode & ~(B_FALLOC_KEEP_SIZE | B_FALLOC_PUNCH_HOLE)) != 0 ||
+		mode == B_FALLOC_PUNCH_HOLE)
+	{
+		printf("Invalid fallocate range or mode\n");
+		return -1;
+	}
+	int punch = (mode & B_FALLOC_PUNCH_HOLE) != 0;
+	uint64_t end = (uint64_t)offset + (uint64_t)len;
+	uint64_t endBlock = (end + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if (endBlock > MAX_FILE_BLOCKS && !punch)
+	{
+		printf("File too large\n");
+		return -1;
+	}
+	// blocks held back by delayed allocation get theirs first
+	if (b_syncDataLocked(fd) != 0 || b_ensureHeaderLocked(fd) != 0)
+		return -1;
+
+	FileHeader header;
+	uint32_t headerBlock = (uint32_t)g_fcbArray[fd].startBlock;
+	fs_nodeWriteLock(headerBlock);
+	if (LBAread(&header, 1, headerBlock) != 1 || header.magic != FILEHEADER_MAGIC)
+	{
+		fs_nodeUnlock(headerBlock);
+		printf("Invalid file header\n");
+		return -1;
+	}
+	b_refreshLocked(fd, &header);
+	int rc;
+	if (punch)
+	{
+		rc = b_punchLocked(&header, headerBlock, (uint64_t)offset, end);
+		fs_nodeUnlock(headerBlock);
+		if (rc == 0)
+			fcbArray[fd].modified = 1;
+		return rc;
+	}
+	rc = 0;
+	uint32_t first = (uint32_t)(offset / BLOCK_SIZE);
+	uint32_t want = 0;
+	for (uint32_t i = first; i < endBlock; i++)
+		if (i >= header.dataBlockCount || header.dataBlocks[i] == BLOCK_HOLE)
+			want++;
+	if (want > 0)
+	{
+		uint32_t blocks[MAX_FILE_BLOCKS];
+		uint32_t i = first;
+		while (i < header.dataBlockCount && header.dataBlocks[i] != BLOCK_HOLE)
+			i++;
+		uint32_t got = fs_allocateExtent(b_goalBlock(&header, headerBlock, i), want, blocks);
+		if (got < want)
+		{
+			fs_freeBlocks(blocks, got);
+			rc = -1;
+		}
+		else
+		{
+			// blocks skipped to reach offset stay holes
+			while (header.dataBlockCount < endBlock)
+				header.dataBlocks[header.dataBlockCount++] = BLOCK_HOLE;
+			uint32_t k = 0;
+			for (; i < endBlock; i++)
+				if (header.dataBlocks[i] == BLOCK_HOLE)
+					header.dataBlocks[i] = blocks[k++] | BLOCK_UNWRITTEN;
+		}
+	}
+	int grown = 0;
+	if (rc == 0 && !(mode & B_FALLOC_KEEP_SIZE) && end > header.fileSize)
+	{
+		header.fileSize = end;
+		grown = 1;
+	}
+	if (rc == 0 && LBAwrite(&header, 1, headerBlock) != 1)
+		rc = -1;
+	fs_nodeUnlock(headerBlock);
+	if (rc != 0)
+		return rc;
+	fcbArray[fd].modified = 1;
+	if (header.fileSize > g_fcbArray[fd].fileSize)
+		g_fcbArray[fd].fileSize = header.fileSize;
+	return grown ? b_storeEntryLocked(fd) : 0;
+}
+
+// turns [offset, end) of the file into a hole.  header is the file's
+// header read under its node lock, held.  Like fs_resizeLocked it writes
+// the header before freeing the blocks, in one batch
+static int b_punchLocked(FileHeader *header, uint32_t headerBlock, uint64_t offset, uint64_t end)
+{
+	uint32_t freed[MAX_FILE_BLOCKS];
+	uint32_t freedCount = 0;
+	uint64_t last = (uint64_t)header->dataBlockCount * BLOCK_SIZE;
+	if (end > last)
+		end = last;
+	for (uint64_t pos = offset; pos < end; )
+	{
+		uint32_t i = (uint32_t)(pos / BLOCK_SIZE);
+		uint64_t within = pos % BLOCK_SIZE;
+		uint64_t can = BLOCK_SIZE - within;
+		if (can > end - pos)
+			can = end - pos;
+		uint32_t entry = header->dataBlocks[i];
+		if (can == BLOCK_SIZE && entry != BLOCK_HOLE)
+		{
+			freed[freedCount++] = BLOCK_NUMBER(entry);
+			header->dataBlocks[i] = BLOCK_HOLE;
+		}
+		else if (can < BLOCK_SIZE && BLOCK_HAS_DATA(entry))
+		{
+			// part of a block: zeroed in place
+			char blk[BLOCK_SIZE];
+			if (LBAread(blk, 1, entry) != 1)
+				return -1;
+			memset(blk + within, 0, (size_t)can);
+			if (LBAwrite(blk, 1, entry) != 1)
+				return -1;
+		}
+		pos += can;
+	}
+	if (freedCount == 0)
+		return 0;
+	if (LBAwrite(header, 1, headerBlock) != 1)
+		return -1;
+	return fs_freeBlocks(freed, freedCount);
+}
+
+// where to look for a block for file block index: right behind the
+// nearest one before it that has a disk block, else behind the header
+static uint32_t b_goalBlock(const FileHeader *header, uint32_t headerBlock, uint32_t index)
+{
+	for (uint32_t i = index; i-- > 0; )
+	{
+		if (i < header->dataBlockCount && header->dataBlocks[i] != BLOCK_HOLE)
+			return BLOCK_NUMBER(header->dataBlocks[i]);
+	}
+	return headerBlock;
 }
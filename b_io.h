@@ -16,13 +16,28 @@
 #define _B_IO_H
 #include <fcntl.h>
 
+// lseek's values, for libcs that do not define them
+#ifndef SEEK_DATA
+#define SEEK_DATA 3
+#define SEEK_HOLE 4
+#endif
+
 typedef int b_io_fd;
 
 b_io_fd b_open (char * filename, int flags);
 int b_read (b_io_fd fd, char * buffer, int count);
 int b_write (b_io_fd fd, char * buffer, int count);
+// returns the new position; besides SEEK_SET, SEEK_CUR and SEEK_END it
+// takes SEEK_DATA and SEEK_HOLE, which find the next data or hole
 int b_seek (b_io_fd fd, off_t offset, int whence);
 int b_close (b_io_fd fd);
+int b_fsync (b_io_fd fd);
+
+// b_fallocate modes: reserve blocks without growing the file; free the
+// range instead, leaving a hole (only together with B_FALLOC_KEEP_SIZE)
+#define B_FALLOC_KEEP_SIZE 0x01
+#define B_FALLOC_PUNCH_HOLE 0x02
+int b_fallocate (b_io_fd fd, off_t offset, off_t len, int mode);
 
 #endif
 
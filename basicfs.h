@@ -0,0 +1,41 @@
+/**************************************************************
+* Class::  CSC-415-01 Fall 2025
+* Name:: Ian Wang
+* Student IDs:: 924005755
+* GitHub-Name:: IannnWENG
+* Group-Name:: BobaTea
+* Project:: Basic File System
+*
+* File:: basicfs.h
+*
+* Description::
+*	Public header of libbasicfs.  Programs linking the file system
+*	library (the shell, the benchmark drivers and any other front
+*	end) include this one header to get the volume, directory and
+*	buffered I/O interfaces.  The library's own declarations (on-disk
+*	structures, globals, locks, caches) are in fsStruct.h, which only
+*	the library sources and the white-box benchmark drivers include.
+*
+*	Typical use:
+*		startPartitionSystem(volume, &volumeSize, &blockSize);
+*		initFileSystem(volumeSize / blockSize, blockSize);
+*		... fs_* and b_* calls ...
+*		exitFileSystem();
+*		closePartitionSystem();
+*
+**************************************************************/
+
+#ifndef _BASICFS_H
+#define _BASICFS_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "fsLow.h"
+#include "b_io.h"
+#include "mfs.h"
+
+#define BASICFS_VERSION_MAJOR 1
+#define BASICFS_VERSION_MINOR 0
+
+#endif
@@ -0,0 +1,466 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: fsBench.c
+ *
+ * Description:: Micro-benchmark driver for the core file system
+ *	operations.  Each benchmark times individual calls and reports
+ *	ops/sec and latency percentiles as JSON or CSV.
+ *
+ *	Usage: fsbench [-v volume] [-s volumeBytes] [-b blockSize]
+ *	               [-n iterations] [-f json|csv] [-o outfile]
+ *	               [-x nameFilter]
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include "basicfs.h"
+#include "fsStruct.h"
+#include "fsBenchUtil.h"
+
+#define BENCH_DEFAULT_VOLUME "BenchVolume"
+#define BENCH_DEFAULT_BYTES 10000000
+#define BENCH_DEFAULT_ITERS 2000
+#define BENCH_IO_FILE_SIZE (96 * BLOCK_SIZE) // stays below MAX_FILE_BLOCKS
+
+typedef struct
+{
+    const char *volume;
+    uint64_t volumeBytes;
+    uint64_t blockSize;
+    int iterations;
+    const char *filter;
+} benchConfig;
+
+static uint64_t rngState = 0x415415415ULL;
+
+// xorshift64, deterministic so runs are comparable
+static uint64_t bench_random(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+static int bench_selected(const benchConfig *cfg, const char *name)
+{
+    return cfg->filter == NULL || strstr(name, cfg->filter) != NULL;
+}
+
+static void bench_record(benchReport *rep, benchLatency *lat, uint64_t startNs,
+                         uint64_t bytes, const char *name, const char *param)
+{
+    benchResult result;
+    double seconds = (double)(bench_nowNs() - startNs) / 1e9;
+    bench_summarize(lat, seconds, bytes, name, param, &result);
+    bench_reportAdd(rep, &result);
+    bench_latencyReset(lat);
+}
+
+// first block after the superblock, root directory and FAT
+static uint64_t bench_dataStart(void)
+{
+    return g_superBlock.fatStart + g_superBlock.fatBlocks;
+}
+
+static void bench_lba(const benchConfig *cfg, benchReport *rep, benchLatency *lat)
+{
+    static const int counts[] = {1, 8, 64};
+    char param[64];
+    uint64_t first = bench_dataStart();
+
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        uint64_t count = (uint64_t)counts[c];
+        uint64_t span = g_superBlock.totalBlocks - first - count;
+        char *buf = calloc(count, BLOCK_SIZE);
+        if (buf == NULL)
+            return;
+        snprintf(param, sizeof(param), "blocks=%llu", (unsigned long long)count);
+
+        if (bench_selected(cfg, "LBAwrite"))
+        {
+            uint64_t start = bench_nowNs();
+            for (int i = 0; i < cfg->iterations; i++)
+            {
+                uint64_t lba = first + bench_random() % span;
+                uint64_t t0 = bench_nowNs();
+                LBAwrite(buf, count, lba);
+                bench_latencyAdd(lat, bench_nowNs() - t0);
+            }
+            bench_record(rep, lat, start, count * BLOCK_SIZE * cfg->iterations, "LBAwrite", param);
+        }
+        if (bench_selected(cfg, "LBAread"))
+        {
+            uint64_t start = bench_nowNs();
+            for (int i = 0; i < cfg->iterations; i++)
+            {
+                uint64_t lba = first + bench_random() % span;
+                uint64_t t0 = bench_nowNs();
+                LBAread(buf, count, lba);
+                bench_latencyAdd(lat, bench_nowNs() - t0);
+            }
+            bench_record(rep, lat, start, count * BLOCK_SIZE * cfg->iterations, "LBAread", param);
+        }
+        free(buf);
+    }
+}
+
+static void bench_allocator(const benchConfig *cfg, benchReport *rep, benchLatency *lat)
+{
+    if (!bench_selected(cfg, "fs_allocateBlock") && !bench_selected(cfg, "fs_freeBlock"))
+        return;
+    uint64_t *blocks = malloc(sizeof(uint64_t) * cfg->iterations);
+    if (blocks == NULL)
+        return;
+    char param[64];
+    snprintf(param, sizeof(param), "blocks=%d", cfg->iterations);
+
+    int allocated = 0;
+    uint64_t start = bench_nowNs();
+    for (int i = 0; i < cfg->iterations; i++)
+    {
+        uint64_t t0 = bench_nowNs();
+        uint64_t b = fs_allocateBlock();
+        bench_latencyAdd(lat, bench_nowNs() - t0);
+        if (b == 0)
+            break;
+        blocks[allocated++] = b;
+    }
+    bench_record(rep, lat, start, 0, "fs_allocateBlock", param);
+
+    start = bench_nowNs();
+    for (int i = 0; i < allocated; i++)
+    {
+        uint64_t t0 = bench_nowNs();
+        fs_freeBlock(blocks[i]);
+        bench_latencyAdd(lat, bench_nowNs() - t0);
+    }
+    bench_record(rep, lat, start, 0, "fs_freeBlock", param);
+    free(blocks);
+}
+
+static void bench_findInDir(const benchConfig *cfg, benchReport *rep, benchLatency *lat)
+{
+    static const int sizes[] = {6, 48, 192, 768};
+    char path[MAX_PATH_LEN];
+    char name[MAX_FILENAME_LEN + 1];
+    char param[64];
+
+    if (!bench_selected(cfg, "fs_findInDir"))
+        return;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        int entries = sizes[s];
+        snprintf(path, sizeof(path), "/find%d", entries);
+        if (fs_createFile(path, FT_DIR) != 0)
+            return;
+        for (int i = 0; i < entries; i++)
+        {
+            snprintf(path, sizeof(path), "/find%d/f%05d", entries, i);
+            if (fs_createFile(path, FT_FILE) != 0)
+                return;
+        }
+        DirEntry dir;
+        snprintf(path, sizeof(path), "/find%d", entries);
+        if (fs_findFile(path, &dir) != 0)
+            return;
+
+        snprintf(param, sizeof(param), "entries=%d,hit", entries);
+        uint64_t start = bench_nowNs();
+        for (int i = 0; i < cfg->iterations; i++)
+        {
+            DirEntry e;
+            snprintf(name, sizeof(name), "f%05d", (int)(bench_random() % entries));
+            uint64_t t0 = bench_nowNs();
+            fs_findInDir(dir.startBlock, name, &e, NULL);
+            bench_latencyAdd(lat, bench_nowNs() - t0);
+        }
+        bench_record(rep, lat, start, 0, "fs_findInDir", param);
+
+        snprintf(param, sizeof(param), "entries=%d,miss", entries);
+        start = bench_nowNs();
+        for (int i = 0; i < cfg->iterations; i++)
+        {
+            DirEntry e;
+            snprintf(name, sizeof(name), "m%05d", (int)(bench_random() % entries));
+            uint64_t t0 = bench_nowNs();
+            fs_findInDir(dir.startBlock, name, &e, NULL);
+            bench_latencyAdd(lat, bench_nowNs() - t0);
+        }
+        bench_record(rep, lat, start, 0, "fs_findInDir", param);
+    }
+}
+
+static void bench_resolvePath(const benchConfig *cfg, benchReport *rep, benchLatency *lat)
+{
+    static const int depths[] = {1, 2, 4, 8, 16};
+    char path[MAX_PATH_LEN];
+    char param[64];
+    int built = 0;
+
+    if (!bench_selected(cfg, "fs_resolvePath"))
+        return;
+    // one chain /deep/d1/d2/... reused by every depth
+    strcpy(path, "/deep");
+    if (fs_createFile(path, FT_DIR) != 0)
+        return;
+    for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+    {
+        while (built < depths[d])
+        {
+            size_t len = strlen(path);
+            snprintf(path + len, sizeof(path) - len, "/d%d", ++built);
+            if (fs_createFile(path, FT_DIR) != 0)
+                return;
+        }
+        char probe[MAX_PATH_LEN];
+        snprintf(probe, sizeof(probe), "%s/target", path);
+        snprintf(param, sizeof(param), "depth=%d", depths[d] + 1);
+        uint64_t start = bench_nowNs();
+        for (int i = 0; i < cfg->iterations; i++)
+        {
+            uint32_t dirBlock;
+            char name[MAX_FILENAME_LEN + 1];
+            uint64_t t0 = bench_nowNs();
+            fs_resolvePath(probe, &dirBlock, name, sizeof(name));
+            bench_latencyAdd(lat, bench_nowNs() - t0);
+        }
+        bench_record(rep, lat, start, 0, "fs_resolvePath", param);
+    }
+}
+
+// one sample is a whole batch: BENCH_STAT_DIRS x BENCH_STAT_FILES paths in
+// shuffled order, stat'ed one by one and then with a single fs_statv call
+#define BENCH_STAT_DIRS 8
+#define BENCH_STAT_FILES 24
+static void bench_statv(const benchConfig *cfg, benchReport *rep, benchLatency *lat)
+{
+    enum { paths = BENCH_STAT_DIRS * BENCH_STAT_FILES };
+    static char names[paths][32];
+    const char *list[paths];
+    struct fs_stat out[paths];
+    char param[64];
+    int batches = cfg->iterations / 20 + 1;
+    int stat = bench_selected(cfg, "fs_stat");
+    int statv = bench_selected(cfg, "fs_statv");
+
+    // the tree is shared, each phase runs on its own name
+    if (!stat && !statv)
+        return;
+    if (fs_createFile("/stat", FT_DIR) != 0)
+        return;
+    for (int d = 0; d < BENCH_STAT_DIRS; d++)
+    {
+        snprintf(names[d], sizeof(names[d]), "/stat/d%d", d);
+        if (fs_createFile(names[d], FT_DIR) != 0)
+            return;
+    }
+    for (int i = 0; i < paths; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "/stat/d%d/f%03d", i % BENCH_STAT_DIRS, i);
+        if (fs_createFile(names[i], FT_FILE) != 0)
+            return;
+        list[i] = names[i];
+    }
+    for (int i = paths - 1; i > 0; i--)
+    {
+        int j = (int)(bench_random() % (uint64_t)(i + 1));
+        const char *t = list[i];
+        list[i] = list[j];
+        list[j] = t;
+    }
+
+    snprintf(param, sizeof(param), "paths=%d", paths);
+    if (stat)
+    {
+        uint64_t start = bench_nowNs();
+        for (int b = 0; b < batches; b++)
+        {
+            uint64_t t0 = bench_nowNs();
+            for (int i = 0; i < paths; i++)
+                fs_stat(list[i], &out[i]);
+            bench_latencyAdd(lat, bench_nowNs() - t0);
+        }
+        bench_record(rep, lat, start, 0, "fs_stat", param);
+    }
+    if (statv)
+    {
+        uint64_t start = bench_nowNs();
+        for (int b = 0; b < batches; b++)
+        {
+            uint64_t t0 = bench_nowNs();
+            fs_statv(list, paths, out, NULL);
+            bench_latencyAdd(lat, bench_nowNs() - t0);
+        }
+        bench_record(rep, lat, start, 0, "fs_statv", param);
+    }
+}
+
+static void bench_bio(const benchConfig *cfg, benchReport *rep, benchLatency *lat)
+{
+    static const int chunks[] = {64, 512, 4096, 16384};
+    char param[64];
+    char path[] = "/bench_io";
+
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++)
+    {
+        int chunk = chunks[c];
+        int perFile = BENCH_IO_FILE_SIZE / chunk;
+        int rounds = cfg->iterations / perFile;
+        if (rounds < 1)
+            rounds = 1;
+        char *buf = malloc((size_t)chunk);
+        if (buf == NULL)
+            return;
+        memset(buf, 'x', (size_t)chunk);
+        snprintf(param, sizeof(param), "chunk=%d", chunk);
+
+        benchLatency readLat;
+        if (bench_latencyInit(&readLat, (size_t)rounds * perFile) != 0)
+        {
+            free(buf);
+            return;
+        }
+        uint64_t writeNs = 0, readNs = 0;
+        uint64_t written = 0, readBytes = 0;
+        for (int r = 0; r < rounds; r++)
+        {
+            b_io_fd fd = b_open(path, O_WRONLY | O_CREAT);
+            if (fd < 0)
+                break;
+            uint64_t start = bench_nowNs();
+            for (int i = 0; i < perFile; i++)
+            {
+                uint64_t t0 = bench_nowNs();
+                int n = b_write(fd, buf, chunk);
+                bench_latencyAdd(lat, bench_nowNs() - t0);
+                if (n > 0)
+                    written += (uint64_t)n;
+            }
+            writeNs += bench_nowNs() - start;
+            b_close(fd);
+
+            fd = b_open(path, O_RDONLY);
+            if (fd < 0)
+                break;
+            start = bench_nowNs();
+            for (int i = 0; i < perFile; i++)
+            {
+                uint64_t t0 = bench_nowNs();
+                int n = b_read(fd, buf, chunk);
+                bench_latencyAdd(&readLat, bench_nowNs() - t0);
+                if (n > 0)
+                    readBytes += (uint64_t)n;
+            }
+            readNs += bench_nowNs() - start;
+            b_close(fd);
+            // delete so every round starts from an empty file
+            fs_deleteFile(path);
+        }
+
+        benchResult result;
+        if (bench_selected(cfg, "b_write"))
+        {
+            bench_summarize(lat, (double)writeNs / 1e9, written, "b_write", param, &result);
+            bench_reportAdd(rep, &result);
+        }
+        if (bench_selected(cfg, "b_read"))
+        {
+            bench_summarize(&readLat, (double)readNs / 1e9, readBytes, "b_read", param, &result);
+            bench_reportAdd(rep, &result);
+        }
+        bench_latencyReset(lat);
+        bench_latencyFree(&readLat);
+        free(buf);
+    }
+}
+
+static void bench_usage(void)
+{
+    printf("Usage: fsbench [-v volume] [-s volumeBytes] [-b blockSize] [-n iterations]\n"
+           "               [-f json|csv] [-o outfile] [-x nameFilter]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    benchConfig cfg;
+    const char *outPath = "bench_output.txt";
+    int format = BENCH_FMT_JSON;
+    int c;
+
+    cfg.volume = BENCH_DEFAULT_VOLUME;
+    cfg.volumeBytes = BENCH_DEFAULT_BYTES;
+    cfg.blockSize = BLOCK_SIZE;
+    cfg.iterations = BENCH_DEFAULT_ITERS;
+    cfg.filter = NULL;
+
+    while ((c = getopt(argc, argv, "v:s:b:n:f:o:x:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'v':
+            cfg.volume = optarg;
+            break;
+        case 's':
+            cfg.volumeBytes = strtoull(optarg, NULL, 10);
+            break;
+        case 'b':
+            cfg.blockSize = strtoull(optarg, NULL, 10);
+            break;
+        case 'n':
+            cfg.iterations = atoi(optarg);
+            break;
+        case 'f':
+            format = bench_parseFormat(optarg);
+            break;
+        case 'o':
+            outPath = optarg;
+            break;
+        case 'x':
+            cfg.filter = optarg;
+            break;
+        default:
+            bench_usage();
+            return -1;
+        }
+    }
+    if (format < 0 || cfg.iterations <= 0 || cfg.blockSize != BLOCK_SIZE)
+    {
+        bench_usage();
+        return -1;
+    }
+
+    benchReport rep;
+    benchLatency lat;
+    if (bench_reportOpen(&rep, outPath, format) != 0)
+        return -1;
+    if (bench_latencyInit(&lat, (size_t)cfg.iterations) != 0)
+        return -1;
+
+    // each group runs on a freshly formatted volume so earlier groups
+    // do not change the free space layout seen by later ones
+    void (*groups[])(const benchConfig *, benchReport *, benchLatency *) = {
+        bench_lba, bench_allocator, bench_findInDir, bench_resolvePath, bench_statv, bench_bio};
+    for (size_t g = 0; g < sizeof(groups) / sizeof(groups[0]); g++)
+    {
+        if (bench_mountVolume(cfg.volume, cfg.volumeBytes, cfg.blockSize) != 0)
+            break;
+        groups[g](&cfg, &rep, &lat);
+        bench_unmountVolume();
+    }
+
+    bench_latencyFree(&lat);
+    bench_reportClose(&rep);
+    return 0;
+}
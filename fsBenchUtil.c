@@ -0,0 +1,230 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: fsBenchUtil.c
+ *
+ * Description:: Shared helpers for the benchmark drivers
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "basicfs.h"
+#include "fsBenchUtil.h"
+
+uint64_t bench_nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int bench_latencyInit(benchLatency *lat, size_t capacity)
+{
+    if (capacity == 0)
+        capacity = 1024;
+    lat->samples = malloc(capacity * sizeof(uint64_t));
+    if (lat->samples == NULL)
+        return -1;
+    lat->count = 0;
+    lat->capacity = capacity;
+    return 0;
+}
+
+int bench_latencyAdd(benchLatency *lat, uint64_t ns)
+{
+    if (lat->count == lat->capacity)
+    {
+        size_t newCap = lat->capacity * 2;
+        uint64_t *grown = realloc(lat->samples, newCap * sizeof(uint64_t));
+        if (grown == NULL)
+            return -1;
+        lat->samples = grown;
+        lat->capacity = newCap;
+    }
+    lat->samples[lat->count++] = ns;
+    return 0;
+}
+
+void bench_latencyReset(benchLatency *lat)
+{
+    lat->count = 0;
+}
+
+void bench_latencyFree(benchLatency *lat)
+{
+    free(lat->samples);
+    lat->samples = NULL;
+    lat->count = 0;
+    lat->capacity = 0;
+}
+
+static int bench_compareU64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// nearest-rank percentile over sorted samples
+static uint64_t bench_percentile(const benchLatency *lat, double pct)
+{
+    if (lat->count == 0)
+        return 0;
+    size_t rank = (size_t)(pct / 100.0 * (double)lat->count + 0.5);
+    if (rank == 0)
+        rank = 1;
+    if (rank > lat->count)
+        rank = lat->count;
+    return lat->samples[rank - 1];
+}
+
+void bench_summarize(benchLatency *lat, double seconds, uint64_t bytes,
+                     const char *name, const char *param, benchResult *result)
+{
+    memset(result, 0, sizeof(*result));
+    strncpy(result->name, name, sizeof(result->name) - 1);
+    strncpy(result->param, param ? param : "", sizeof(result->param) - 1);
+    result->ops = lat->count;
+    result->bytes = bytes;
+    result->seconds = seconds;
+    if (seconds > 0)
+    {
+        result->opsPerSec = (double)lat->count / seconds;
+        result->mbPerSec = (double)bytes / (1024.0 * 1024.0) / seconds;
+    }
+    if (lat->count == 0)
+        return;
+    qsort(lat->samples, lat->count, sizeof(uint64_t), bench_compareU64);
+    result->minNs = lat->samples[0];
+    result->p50Ns = bench_percentile(lat, 50.0);
+    result->p90Ns = bench_percentile(lat, 90.0);
+    result->p99Ns = bench_percentile(lat, 99.0);
+    result->p999Ns = bench_percentile(lat, 99.9);
+    result->maxNs = lat->samples[lat->count - 1];
+}
+
+int bench_parseFormat(const char *text)
+{
+    if (strcmp(text, "json") == 0)
+        return BENCH_FMT_JSON;
+    if (strcmp(text, "csv") == 0)
+        return BENCH_FMT_CSV;
+    return -1;
+}
+
+int bench_reportOpen(benchReport *rep, const char *path, int format)
+{
+    rep->format = format;
+    rep->rows = 0;
+    if (path == NULL || strcmp(path, "-") == 0)
+    {
+        // the file system prints its progress on stdout: the report
+        // keeps stdout to itself and everything else goes to stderr
+        fflush(stdout);
+        int fd = dup(STDOUT_FILENO);
+        rep->out = (fd >= 0) ? fdopen(fd, "w") : NULL;
+        if (rep->out == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+        {
+            if (rep->out != NULL)
+                fclose(rep->out);
+            else if (fd >= 0)
+                close(fd);
+            rep->out = NULL;
+            printf("Failed to set up the report on stdout\n");
+            return -1;
+        }
+    }
+    else
+    {
+        rep->out = fopen(path, "w");
+        if (rep->out == NULL)
+        {
+            printf("Failed to open report file: %s\n", path);
+            return -1;
+        }
+    }
+    if (rep->format == BENCH_FMT_CSV)
+        fprintf(rep->out, "name,param,ops,bytes,seconds,ops_per_sec,mb_per_sec,"
+                          "min_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+    else
+        fprintf(rep->out, "[\n");
+    return 0;
+}
+
+void bench_reportAdd(benchReport *rep, const benchResult *r)
+{
+    if (rep->format == BENCH_FMT_CSV)
+    {
+        fprintf(rep->out, "%s,\"%s\",%llu,%llu,%.6f,%.1f,%.3f,%llu,%llu,%llu,%llu,%llu,%llu\n",
+                r->name, r->param, (unsigned long long)r->ops, (unsigned long long)r->bytes,
+                r->seconds, r->opsPerSec, r->mbPerSec,
+                (unsigned long long)r->minNs, (unsigned long long)r->p50Ns,
+                (unsigned long long)r->p90Ns, (unsigned long long)r->p99Ns,
+                (unsigned long long)r->p999Ns, (unsigned long long)r->maxNs);
+    }
+    else
+    {
+        fprintf(rep->out,
+                "%s  {\"name\": \"%s\", \"param\": \"%s\", \"ops\": %llu, \"bytes\": %llu, "
+                "\"seconds\": %.6f, \"ops_per_sec\": %.1f, \"mb_per_sec\": %.3f, "
+                "\"latency_ns\": {\"min\": %llu, \"p50\": %llu, \"p90\": %llu, "
+                "\"p99\": %llu, \"p999\": %llu, \"max\": %llu}}",
+                rep->rows ? ",\n" : "", r->name, r->param,
+                (unsigned long long)r->ops, (unsigned long long)r->bytes,
+                r->seconds, r->opsPerSec, r->mbPerSec,
+                (unsigned long long)r->minNs, (unsigned long long)r->p50Ns,
+                (unsigned long long)r->p90Ns, (unsigned long long)r->p99Ns,
+                (unsigned long long)r->p999Ns, (unsigned long long)r->maxNs);
+    }
+    rep->rows++;
+    fflush(rep->out);
+}
+
+void bench_reportClose(benchReport *rep)
+{
+    if (rep->out == NULL)
+        return;
+    if (rep->format == BENCH_FMT_JSON)
+        fprintf(rep->out, "\n]\n");
+    fclose(rep->out);
+    rep->out = NULL;
+}
+
+int bench_mountVolume(const char *volumeName, uint64_t volumeBytes, uint64_t blockSize)
+{
+    char name[256];
+    strncpy(name, volumeName, sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    // always start from an empty image so runs are repeatable
+    if (strcmp(name, LBA_RAM_VOLUME) != 0)
+        unlink(name);
+    uint64_t volSize = volumeBytes;
+    uint64_t blkSize = blockSize;
+    if (startPartitionSystem(name, &volSize, &blkSize) != PART_NOERROR)
+    {
+        printf("Start Partition Failed: %s\n", name);
+        return -1;
+    }
+    if (initFileSystem(volSize / blkSize, blkSize) != 0)
+    {
+        printf("Initialize File System Failed\n");
+        closePartitionSystem();
+        return -1;
+    }
+    return 0;
+}
+
+void bench_unmountVolume(void)
+{
+    exitFileSystem();
+    closePartitionSystem();
+}
@@ -0,0 +1,82 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: fsBenchUtil.h
+ *
+ * Description:: Shared helpers for the benchmark drivers: timing,
+ *	latency sample collection, percentile summaries, result
+ *	reporting (JSON/CSV) and fresh volume setup.
+ *
+ **************************************************************/
+
+#ifndef _FSBENCHUTIL_H
+#define _FSBENCHUTIL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define BENCH_FMT_JSON 0
+#define BENCH_FMT_CSV 1
+
+// growable array of per-operation latencies in nanoseconds
+typedef struct
+{
+    uint64_t *samples;
+    size_t count;
+    size_t capacity;
+} benchLatency;
+
+// one summarized measurement (a row in the report)
+typedef struct
+{
+    char name[64];  // benchmark name, e.g. "fs_findInDir"
+    char param[64]; // parameter of this run, e.g. "entries=64"
+    uint64_t ops;   // operations measured
+    uint64_t bytes; // bytes moved (0 when not a data benchmark)
+    double seconds; // wall time for all operations
+    double opsPerSec;
+    double mbPerSec; // bytes / seconds in MiB, 0 when bytes == 0
+    uint64_t minNs;
+    uint64_t p50Ns;
+    uint64_t p90Ns;
+    uint64_t p99Ns;
+    uint64_t p999Ns;
+    uint64_t maxNs;
+} benchResult;
+
+// report sink, results are written as they are added
+typedef struct
+{
+    FILE *out;
+    int format;
+    int rows;
+} benchReport;
+
+uint64_t bench_nowNs(void);
+
+int bench_latencyInit(benchLatency *lat, size_t capacity);
+int bench_latencyAdd(benchLatency *lat, uint64_t ns);
+void bench_latencyReset(benchLatency *lat);
+void bench_latencyFree(benchLatency *lat);
+
+// sorts the samples in place and fills in the statistics of result
+void bench_summarize(benchLatency *lat, double seconds, uint64_t bytes,
+                     const char *name, const char *param, benchResult *result);
+
+int bench_parseFormat(const char *text);
+int bench_reportOpen(benchReport *rep, const char *path, int format);
+void bench_reportAdd(benchReport *rep, const benchResult *result);
+void bench_reportClose(benchReport *rep);
+
+// creates (or recreates) a volume and formats/mounts the file system on it,
+// LBA_RAM_VOLUME as the name selects the in-memory backend
+int bench_mountVolume(const char *volumeName, uint64_t volumeBytes, uint64_t blockSize);
+void bench_unmountVolume(void);
+
+#endif
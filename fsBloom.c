@@ -0,0 +1,337 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: fsBloom.c
+ *
+ * Description:: Per-directory Bloom filters.  Once a directory
+ *	spans more than one block its head block points at a filter
+ *	holding every name of the chain (k = 4 bits per name).
+ *	fs_findInDir asks the filter before walking past the head, so
+ *	looking up a name that is not there - the first step of every
+ *	create - costs the head block instead of the whole chain.
+ *
+ *	One filter block takes BLOOM_CAPACITY names, which keeps its
+ *	false positives near 0.3%.  Past that a new block is linked in
+ *	right behind the head and takes the following names, so a
+ *	lookup tests one filter block per BLOOM_CAPACITY names instead
+ *	of one directory block per dozen or so.
+ *
+ *	Names are added as they are inserted.  A removal only counts,
+ *	the bits stay set (a false "maybe" is harmless); the filter is
+ *	rebuilt from the chain once half of its names are gone.  The
+ *	filter blocks used last are kept in memory and written through.
+ *
+ *	A filter belongs to one directory and is only changed with that
+ *	directory locked; the cache slots, shared by all directories,
+ *	each have a lock of their own.
+ *
+ **************************************************************/
+
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "fsLow.h"
+#include "fsStruct.h"
+
+#define BLOOM_HASHES 4
+#define BLOOM_BITS (sizeof(((DirBloom *)0)->bits) * 8)
+#define BLOOM_CAPACITY 256
+#define BLOOM_CACHE_BITS 6
+#define BLOOM_CACHE_SLOTS (1 << BLOOM_CACHE_BITS)
+
+// direct mapped by (hashed) filter block number
+static struct
+{
+    pthread_mutex_t lock;
+    uint32_t block; // 0 means empty
+    DirBloom bloom;
+} bloomCache[BLOOM_CACHE_SLOTS];
+static pthread_once_t bloomOnce = PTHREAD_ONCE_INIT;
+
+static void fs_bloomInit(void)
+{
+    for (int i = 0; i < BLOOM_CACHE_SLOTS; i++)
+        pthread_mutex_init(&bloomCache[i].lock, NULL);
+}
+
+// second hash for double hashing (murmur3 finalizer), odd so it cycles
+static uint32_t fs_bloomHash2(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h | 1;
+}
+
+static void fs_bloomSet(DirBloom *bloom, const char *name)
+{
+    uint32_t h1 = fs_nameHash(name, strlen(name));
+    uint32_t h2 = fs_bloomHash2(h1);
+    for (uint32_t i = 0; i < BLOOM_HASHES; i++)
+    {
+        uint32_t bit = (h1 + i * h2) % BLOOM_BITS;
+        bloom->bits[bit / 8] |= (uint8_t)(1u << (bit % 8));
+    }
+    bloom->itemCount++;
+}
+
+static int fs_bloomTest(const DirBloom *bloom, const char *name)
+{
+    uint32_t h1 = fs_nameHash(name, strlen(name));
+    uint32_t h2 = fs_bloomHash2(h1);
+    for (uint32_t i = 0; i < BLOOM_HASHES; i++)
+    {
+        uint32_t bit = (h1 + i * h2) % BLOOM_BITS;
+        if (!(bloom->bits[bit / 8] & (1u << (bit % 8))))
+            return 0;
+    }
+    return 1;
+}
+
+static void fs_bloomClear(DirBloom *bloom)
+{
+    memset(bloom, 0, sizeof(*bloom));
+    bloom->magic = BLOOM_MAGIC;
+}
+
+// the filter blocks of one directory are allocated at a steady stride
+// (one per BLOOM_CAPACITY creates), so the slot is a Fibonacci hash
+static uint32_t fs_bloomSlot(uint32_t bloomBlock)
+{
+    return (bloomBlock * 2654435761u) >> (32 - BLOOM_CACHE_BITS);
+}
+
+// copy of a filter block, -1 if it cannot be read
+static int fs_bloomLoad(uint32_t bloomBlock, DirBloom *bloom)
+{
+    uint32_t slot = fs_bloomSlot(bloomBlock);
+    int rc = 0;
+    pthread_once(&bloomOnce, fs_bloomInit);
+    pthread_mutex_lock(&bloomCache[slot].lock);
+    if (bloomCache[slot].block != bloomBlock)
+    {
+        if (LBAread(&bloomCache[slot].bloom, 1, bloomBlock) != 1 ||
+            bloomCache[slot].bloom.magic != BLOOM_MAGIC)
+        {
+            bloomCache[slot].block = 0;
+            rc = -1;
+        }
+        else
+        {
+            bloomCache[slot].block = bloomBlock;
+        }
+    }
+    if (rc == 0)
+        *bloom = bloomCache[slot].bloom;
+    pthread_mutex_unlock(&bloomCache[slot].lock);
+    return rc;
+}
+
+static int fs_bloomStore(uint32_t bloomBlock, const DirBloom *bloom)
+{
+    uint32_t slot = fs_bloomSlot(bloomBlock);
+    int rc = 0;
+    pthread_once(&bloomOnce, fs_bloomInit);
+    pthread_mutex_lock(&bloomCache[slot].lock);
+    bloomCache[slot].bloom = *bloom;
+    bloomCache[slot].block = bloomBlock;
+    if (LBAwrite((void *)bloom, 1, bloomBlock) != 1)
+    {
+        bloomCache[slot].block = 0;
+        rc = -1;
+    }
+    pthread_mutex_unlock(&bloomCache[slot].lock);
+    return rc;
+}
+
+static void fs_bloomForget(uint32_t bloomBlock)
+{
+    uint32_t slot = fs_bloomSlot(bloomBlock);
+    pthread_once(&bloomOnce, fs_bloomInit);
+    pthread_mutex_lock(&bloomCache[slot].lock);
+    if (bloomCache[slot].block == bloomBlock)
+        bloomCache[slot].block = 0;
+    pthread_mutex_unlock(&bloomCache[slot].lock);
+}
+
+// frees the filter blocks starting at bloomBlock
+void fs_bloomFree(uint32_t bloomBlock)
+{
+    while (bloomBlock != 0)
+    {
+        DirBloom b;
+        uint32_t next = fs_bloomLoad(bloomBlock, &b) == 0 ? b.nextBloomBlock : 0;
+        fs_bloomForget(bloomBlock);
+        fs_freeBlock(bloomBlock);
+        bloomBlock = next;
+    }
+}
+
+// links a fresh block behind the head filter, which then fills it
+static int fs_bloomGrow(DirBloom *head, DirBloom *fill, uint32_t *fillBlock)
+{
+    uint64_t block = fs_allocateBlock();
+    if (block == 0)
+        return -1;
+    fs_bloomClear(fill);
+    fill->nextBloomBlock = head->nextBloomBlock;
+    head->nextBloomBlock = (uint32_t)block;
+    *fillBlock = (uint32_t)block;
+    return 0;
+}
+
+// writes a filter of every name of the chain starting at dirHead into
+// bloomBlock, whose old overflow blocks must already be released.  On
+// failure the head is saturated, so every lookup of the directory walks
+static int fs_bloomBuild(uint32_t bloomBlock, const DirBlock *dirHead)
+{
+    DirBloom head, fill;
+    DirBloom *target = &head;
+    uint32_t fillBlock = 0;
+    DirBlock cur = *dirHead;
+    fs_bloomClear(&head);
+    while (1)
+    {
+        DirEntry e;
+        for (uint32_t i = 0; fs_dirBlockGet(&cur, i, &e) == 0; i++)
+        {
+            if (e.fileType == FT_UNUSED)
+                continue;
+            if (target->itemCount >= BLOOM_CAPACITY)
+            {
+                if (target == &fill && fs_bloomStore(fillBlock, &fill) != 0)
+                    goto fail;
+                if (fs_bloomGrow(&head, &fill, &fillBlock) != 0)
+                    goto fail;
+                target = &fill;
+            }
+            fs_bloomSet(target, e.filename);
+        }
+        if (cur.nextDirBlock == 0)
+            break;
+        if (fs_loadDir(cur.nextDirBlock, &cur) != 0)
+            goto fail;
+    }
+    if (target == &fill && fs_bloomStore(fillBlock, &fill) != 0)
+        goto fail;
+    return fs_bloomStore(bloomBlock, &head);
+
+fail:
+    // the blocks already linked stay reachable for fs_bloomFree
+    memset(head.bits, 0xFF, sizeof(head.bits));
+    fs_bloomStore(bloomBlock, &head);
+    return -1;
+}
+
+// allocates and fills the filter of the directory whose head is given,
+// returns its block or 0 (the directory then simply has no filter)
+uint32_t fs_bloomCreate(const DirBlock *head)
+{
+    uint64_t block = fs_allocateBlock();
+    if (block == 0)
+        return 0;
+    if (fs_bloomBuild((uint32_t)block, head) != 0)
+    {
+        fs_freeBlock(block);
+        return 0;
+    }
+    return (uint32_t)block;
+}
+
+// the head fills first, then the block linked right behind it
+int fs_bloomAdd(uint32_t bloomBlock, const char *name)
+{
+    DirBloom head, fill;
+    uint32_t fillBlock;
+    if (bloomBlock == 0)
+        return 0;
+    // an unreadable filter already answers "maybe" for every name
+    if (fs_bloomLoad(bloomBlock, &head) != 0)
+        return 0;
+    if (head.itemCount < BLOOM_CAPACITY)
+    {
+        fs_bloomSet(&head, name);
+        return fs_bloomStore(bloomBlock, &head);
+    }
+    fillBlock = head.nextBloomBlock;
+    if (fillBlock != 0 && fs_bloomLoad(fillBlock, &fill) == 0 &&
+        fill.itemCount < BLOOM_CAPACITY)
+    {
+        fs_bloomSet(&fill, name);
+        return fs_bloomStore(fillBlock, &fill);
+    }
+    if (fs_bloomGrow(&head, &fill, &fillBlock) != 0)
+        return -1;
+    fs_bloomSet(&fill, name);
+    if (fs_bloomStore(fillBlock, &fill) != 0)
+        return -1;
+    return fs_bloomStore(bloomBlock, &head);
+}
+
+// 0 only when name is certainly not in the directory
+int fs_bloomMayContain(uint32_t bloomBlock, const char *name)
+{
+    if (bloomBlock == 0)
+        return 1;
+    while (bloomBlock != 0)
+    {
+        DirBloom b;
+        if (fs_bloomLoad(bloomBlock, &b) != 0)
+            return 1;
+        if (fs_bloomTest(&b, name))
+            return 1;
+        bloomBlock = b.nextBloomBlock;
+    }
+    return 0;
+}
+
+// a name left the directory; rebuild once half the names are stale
+int fs_bloomRemoved(uint32_t bloomBlock, const DirBlock *head)
+{
+    DirBloom b;
+    if (bloomBlock == 0)
+        return 0;
+    if (fs_bloomLoad(bloomBlock, &b) != 0)
+        return 0;
+    uint32_t removed = ++b.removedCount;
+    uint32_t total = 0;
+    for (DirBloom n = b; ; )
+    {
+        total += n.itemCount;
+        if (n.nextBloomBlock == 0 || fs_bloomLoad(n.nextBloomBlock, &n) != 0)
+            break;
+    }
+    if (removed * 2 <= total)
+        return fs_bloomStore(bloomBlock, &b);
+    return fs_bloomRebuild(bloomBlock, head);
+}
+
+// refills the filter from the chain, e.g. after it was compacted
+int fs_bloomRebuild(uint32_t bloomBlock, const DirBlock *head)
+{
+    DirBloom b;
+    if (bloomBlock == 0)
+        return 0;
+    if (fs_bloomLoad(bloomBlock, &b) == 0)
+        fs_bloomFree(b.nextBloomBlock);
+    return fs_bloomBuild(bloomBlock, head);
+}
+
+// forget cached filters, the volume underneath changed
+void fs_bloomReset(void)
+{
+    pthread_once(&bloomOnce, fs_bloomInit);
+    for (int i = 0; i < BLOOM_CACHE_SLOTS; i++)
+    {
+        pthread_mutex_lock(&bloomCache[i].lock);
+        bloomCache[i].block = 0;
+        pthread_mutex_unlock(&bloomCache[i].lock);
+    }
+}
@@ -14,27 +14,79 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include "fsLow.h"
 #include "fsStruct.h"
 #include "mfs.h"
-#include "b_io.c"
 
 // magic value for file header validation
 const uint32_t FILEHEADER_MAGIC = 0xC5C4F11E; // "CSC4 FILE" stylized
 
+// returned by the *Locked helpers when the call has to be redone holding
+// the tree lock exclusively (it removes or moves a directory)
+#define FS_NEED_TREE -2
+
+// the volume is split into allocation groups, runs of FAT blocks each
+// allocated from under its own lock.  A group keeps its free count and
+// the free entries of every one of its FAT blocks, so full FAT blocks
+// are never read.  A thread allocates in its own group unless it asks
+// for a block near another one; the superblock's free count is summed
+// from the groups only when the superblock is written
+#define ALLOC_GROUPS 16
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    uint64_t firstFat;  // FAT blocks [firstFat, endFat)
+    uint64_t endFat;
+    uint64_t cursor;    // FAT block of the last allocation
+    uint64_t freeCount; // changed under the lock, summed without it
+} AllocGroup;
+
+static AllocGroup allocGroups[ALLOC_GROUPS];
+static uint64_t allocGroupBlocks = 1; // FAT blocks per group
+static uint8_t *fatFree;              // free entries of each FAT block
+static pthread_mutex_t sbLock;
+static pthread_once_t allocOnce = PTHREAD_ONCE_INIT;
+static uint32_t allocNextGroup;       // group handed to the next new thread
+static __thread int allocGroup = -1;  // this thread's own group
+
 // forward helpers
-static int fs_expandDirectoryIfNeeded(uint32_t dirBlock, DirBlock *dir, uint32_t *outUseBlock);
 static int fs_isDirectoryEmpty(uint32_t dirBlock);
 static int fs_addEntryToDir(uint32_t dirBlock, const DirEntry *newEntry);
-static int fs_removeEntryFromDir(uint32_t dirBlock, uint32_t index);
+static int fs_addToChain(uint32_t dirBlock, const DirEntry *newEntry);
+static int fs_locateInDir(uint32_t dirBlock, const char *name, DirEntry *entry,
+                          uint32_t *indexInDir, uint32_t *entryBlock, uint32_t *slot);
+static int fs_removeEntryFromDir(uint32_t dirBlock, uint32_t entryBlock, uint32_t slot);
+static int fs_removeFromChain(uint32_t dirBlock, uint32_t entryBlock, uint32_t slot);
+static int fs_renameInDir(uint32_t dirBlock, uint32_t entryBlock, uint32_t slot, const char *newName);
+static int fs_releaseEntry(uint32_t dirBlock, const DirEntry *e);
+static int fs_resizeLocked(uint32_t headerBlock, uint64_t size);
+static int fs_unlinkDirBlock(uint32_t dirBlock, DirBlock *head, uint32_t block, const DirBlock *dir);
+static void fs_initDirBlock(DirBlock *dir, uint32_t selfBlock, uint32_t parentBlock);
+static int fs_isDotName(const char *name);
+static int fs_isInSubtree(uint32_t dirBlock, uint32_t topBlock);
+static int fs_writeSuperBlock(void);
+static int fs_allocLoad(void);
+static int fs_freeRun(const uint32_t *blocks, uint32_t n);
+static int fs_createLocked(uint32_t dirBlock, const char *name, uint32_t fileType);
+static int fs_deleteLocked(uint32_t dirBlock, const char *name, int exclusive);
+static int fs_renameLocked(uint32_t sDir, const char *sName, uint32_t dDir, const char *dName, int exclusive);
+static int fs_compactLocked(uint32_t dirBlock);
+static int fs_resolveFrom(uint32_t startBlock, const char *path, uint32_t *outDirBlock, char *outName,
+                          size_t outNameSize, int cachedOnly);
 
 int fs_loadDir(uint32_t dirBlock, DirBlock *dir)
 {
     if (LBAread(dir, 1, dirBlock) != 1)
         return -1;
+    if (dir->usedBytes + dir->entryCount * sizeof(uint32_t) > sizeof(dir->data) ||
+        dir->deadCount > dir->entryCount)
+        return -1; // not a directory block
     return 0;
 }
 
@@ -45,27 +97,58 @@ int fs_storeDir(uint32_t dirBlock, const DirBlock *dir)
     return 0;
 }
 
+// lookup answered from the directory cache without a lock when it can
+// be; otherwise the directory's lock is taken shared and the directory
+// is loaded into the cache.  Code that already holds the lock uses
+// fs_locateInDir
 int fs_findInDir(uint32_t dirBlock, const char *name, DirEntry *entry, uint32_t *indexInDir)
+{
+    int rc = 1;
+    if (indexInDir == NULL)
+    {
+        rc = fs_dcacheLookup(dirBlock, name, entry);
+        if (rc <= 0)
+            return rc;
+    }
+    fs_nodeReadLock(dirBlock);
+    if (indexInDir == NULL && fs_dcacheFill(dirBlock) == 0)
+        rc = fs_dcacheLookup(dirBlock, name, entry);
+    if (rc > 0)
+        rc = fs_locateInDir(dirBlock, name, entry, indexInDir, NULL, NULL);
+    fs_nodeUnlock(dirBlock);
+    return rc;
+}
+
+// fs_findInDir that also reports the chain block holding the entry and
+// its slot there, which stays valid until an insert packs that block
+static int fs_locateInDir(uint32_t dirBlock, const char *name, DirEntry *entry,
+                          uint32_t *indexInDir, uint32_t *entryBlock, uint32_t *slot)
 {
     DirBlock cur;
     uint32_t curBlock = dirBlock;
+    uint32_t base = 0; // index of the first entry of curBlock within the chain
     while (curBlock != 0)
     {
         if (fs_loadDir(curBlock, &cur) != 0)
             return -1;
-        for (uint32_t i = 0; i < cur.entryCount; i++)
+        uint32_t i;
+        if (fs_dirBlockFind(&cur, name, entry, &i) == 0)
         {
-            if (strcmp(cur.entries[i].filename, name) == 0)
-            {
-                if (entry)
-                    *entry = cur.entries[i];
-                if (indexInDir)
-                    *indexInDir = i;
-                return 0;
-            }
+            // index across the whole chain
+            if (indexInDir)
+                *indexInDir = base + i;
+            if (entryBlock)
+                *entryBlock = curBlock;
+            if (slot)
+                *slot = i;
+            return 0;
         }
         if (cur.nextDirBlock == 0)
             break;
+        // the head's filter rules out most misses before the chain walk
+        if (curBlock == dirBlock && !fs_bloomMayContain(cur.bloomBlock, name))
+            break;
+        base += cur.entryCount;
         curBlock = cur.nextDirBlock;
     }
     return -1;
@@ -73,18 +156,36 @@ int fs_findInDir(uint32_t dirBlock, const char *name, DirEntry *entry, uint32_t
 
 // path resolver: returns parent directory block and last name component
 int fs_resolvePath(const char *path, uint32_t *outDirBlock, char *outName, size_t outNameSize)
+{
+    return fs_resolvePathAt(0, path, outDirBlock, outName, outNameSize);
+}
+
+// path resolver starting at startBlock (a directory handle); absolute paths
+// start at the root, relative ones with startBlock 0 at the current
+// directory block.  "." and ".." are ordinary entries of every directory.
+// The caller holds the tree lock, so the directories found stay put
+int fs_resolvePathAt(uint32_t startBlock, const char *path, uint32_t *outDirBlock, char *outName, size_t outNameSize)
+{
+    return fs_resolveFrom(startBlock, path, outDirBlock, outName, outNameSize, 0);
+}
+
+// cachedOnly walks the directory cache alone and returns 1 as soon as a
+// directory on the way is not cached
+static int fs_resolveFrom(uint32_t startBlock, const char *path, uint32_t *outDirBlock, char *outName,
+                          size_t outNameSize, int cachedOnly)
 {
     if (!path || !outDirBlock || !outName || outNameSize == 0)
         return -1;
-    // handle absolute paths only; treat relative as from g_currentPath but simplified to root
     const char *p = path;
+    uint32_t currentBlock = startBlock ? startBlock : __atomic_load_n(&g_cwdBlock, __ATOMIC_ACQUIRE);
+    if (*p == '/' || currentBlock == 0)
+        currentBlock = (uint32_t)g_superBlock.rootDirBlock;
     if (*p == '/')
         p++;
     // copy to temp to tokenize
     char temp[MAX_PATH_LEN];
     strncpy(temp, p, sizeof(temp) - 1);
     temp[sizeof(temp) - 1] = '\0';
-    uint32_t currentBlock = (uint32_t)g_superBlock.rootDirBlock;
     char *saveptr = NULL;
     char *token = strtok_r(temp, "/", &saveptr);
     char lastName[MAX_FILENAME_LEN + 1] = {0};
@@ -100,8 +201,9 @@ int fs_resolvePath(const char *path, uint32_t *outDirBlock, char *outName, size_
         }
         // traverse into directory named token
         DirEntry e;
-        if (fs_findInDir(currentBlock, token, &e, NULL) != 0)
-            return -1; // not found
+        int rc = cachedOnly ? fs_dcacheLookup(currentBlock, token, &e) : fs_findInDir(currentBlock, token, &e, NULL);
+        if (rc != 0)
+            return rc; // not found, or not cached
         if (e.fileType != FT_DIR)
             return -1; // not a directory
         currentBlock = e.startBlock;
@@ -145,53 +247,37 @@ int fs_format(uint64_t totalBlocks, uint64_t blockSize)
     g_superBlock.createTime = time(NULL);
     g_superBlock.lastMountTime = time(NULL);
 
-    // write superblock to disk
-    uint64_t result = LBAwrite(&g_superBlock, 1, 0);
-    if (result != 1)
-    {
-        printf("Failed to write superblock\n");
-        return -1;
-    }
-
-    // create root directory with "." and ".." entries
+    // create root directory with "." and ".." entries (root's parent is itself)
     DirBlock rootDir;
-    rootDir.entryCount = 2; // "." and ".." entries
-    rootDir.nextDirBlock = 0;
-    memset(rootDir.entries, 0, sizeof(rootDir.entries));
-
-    // Initialize "." entry (self-reference)
-    strcpy(rootDir.entries[0].filename, ".");
-    rootDir.entries[0].fileType = FT_DIR;
-    rootDir.entries[0].startBlock = g_superBlock.rootDirBlock; // points to itself
-    rootDir.entries[0].fileSize = 0;
-    rootDir.entries[0].createTime = (uint32_t)time(NULL);
-    rootDir.entries[0].modifyTime = rootDir.entries[0].createTime;
-
-    // Initialize ".." entry (parent reference - for root, also points to itself)
-    strcpy(rootDir.entries[1].filename, "..");
-    rootDir.entries[1].fileType = FT_DIR;
-    rootDir.entries[1].startBlock = g_superBlock.rootDirBlock; // root's parent is itself
-    rootDir.entries[1].fileSize = 0;
-    rootDir.entries[1].createTime = (uint32_t)time(NULL);
-    rootDir.entries[1].modifyTime = rootDir.entries[1].createTime;
-
-    result = LBAwrite(&rootDir, 1, g_superBlock.rootDirBlock);
+    fs_initDirBlock(&rootDir, (uint32_t)g_superBlock.rootDirBlock, (uint32_t)g_superBlock.rootDirBlock);
+
+    uint64_t result = LBAwrite(&rootDir, 1, g_superBlock.rootDirBlock);
     if (result != 1)
     {
         printf("Failed to write root directory\n");
         return -1;
     }
 
+    // everything past the FAT blocks holding used entries is free: discard
+    // it, so an old image drops its data and a new one stays sparse.  A
+    // discarded FAT block reads as free entries and need not be written
+    fs_discardReset();
+    uint64_t fatWrite = fatBlocks;
+    uint64_t usedFat = (reserved + FAT_ENTRIES_PER_BLOCK - 1) / FAT_ENTRIES_PER_BLOCK;
+    uint64_t tail = g_superBlock.fatStart + usedFat;
+    if (tail < totalBlocks && LBAdiscard(totalBlocks - tail, tail) == totalBlocks - tail)
+        fatWrite = usedFat;
+
     // initialize FAT: mark reserved blocks as used, others as free
     {
-        uint32_t *fat = malloc((size_t)(fatBlocks * BLOCK_SIZE));
+        uint32_t *fat = malloc((size_t)(fatWrite * BLOCK_SIZE));
         if (!fat)
         {
             printf("Failed to alloc FAT buffer\n");
             return -1;
         }
         // initialize all entries to FAT_FREE first
-        for (uint64_t b = 0; b < totalBlocks; b++)
+        for (uint64_t b = 0; b < fatWrite * FAT_ENTRIES_PER_BLOCK; b++)
         {
             fat[b] = FAT_FREE;
         }
@@ -201,7 +287,7 @@ int fs_format(uint64_t totalBlocks, uint64_t blockSize)
             fat[b] = FAT_RESERVED;
         }
         // write FAT blocks
-        if (LBAwrite(fat, fatBlocks, g_superBlock.fatStart) != fatBlocks)
+        if (LBAwrite(fat, fatWrite, g_superBlock.fatStart) != fatWrite)
         {
             printf("Failed to write FAT\n");
             free(fat);
@@ -210,6 +296,13 @@ int fs_format(uint64_t totalBlocks, uint64_t blockSize)
         free(fat);
     }
 
+    // write superblock to disk, its free count comes from the groups
+    if (fs_allocLoad() != 0 || fs_writeSuperBlock() != 0)
+    {
+        printf("Failed to write superblock\n");
+        return -1;
+    }
+
     printf("File system formatted successfully\n");
     return 0;
 }
@@ -219,13 +312,18 @@ int fs_mount(void)
 {
     printf("Mounting file system...\n");
 
-    // read superblock
-    uint64_t result = LBAread(&g_superBlock, 1, 0);
-    if (result != 1)
+    // read superblock (the struct is smaller than the block)
+    union
+    {
+        SuperBlock sb;
+        char block[BLOCK_SIZE];
+    } buf;
+    if (LBAread(&buf, 1, 0) != 1)
     {
         printf("Failed to read superblock\n");
         return -1;
     }
+    g_superBlock = buf.sb;
 
     // verify magic number
     if (g_superBlock.magic != FS_MAGIC)
@@ -233,10 +331,28 @@ int fs_mount(void)
         printf("Invalid file system magic number\n");
         return -1;
     }
+    // versions 4 and 5 only lack unwritten blocks and holes, they are
+    // upgraded in place
+    if (g_superBlock.version == 4 || g_superBlock.version == 5)
+        g_superBlock.version = FS_VERSION;
+    if (g_superBlock.version != FS_VERSION)
+    {
+        printf("Unsupported file system version %u\n", g_superBlock.version);
+        return -1;
+    }
+
+    fs_bloomReset();
+    fs_dcacheReset();
+    if (fs_allocLoad() != 0)
+        return -1;
 
     // update mount time
     g_superBlock.lastMountTime = time(NULL);
-    LBAwrite(&g_superBlock, 1, 0);
+    fs_writeSuperBlock();
+
+    // start in the root directory
+    __atomic_store_n(&g_cwdBlock, (uint32_t)g_superBlock.rootDirBlock, __ATOMIC_RELEASE);
+    strcpy(g_currentPath, "/");
 
     printf("File system mounted successfully\n");
     return 0;
@@ -249,91 +365,409 @@ int fs_unmount(void)
 
     // update superblock
     g_superBlock.lastMountTime = time(NULL);
-    LBAwrite(&g_superBlock, 1, 0);
+    fs_writeSuperBlock();
+    fs_discardFlush();
 
     printf("File system unmounted successfully\n");
     return 0;
 }
 
 int fs_rename(const char *srcPath, const char *dstPath)
+{
+    return fs_renameAt(0, srcPath, 0, dstPath);
+}
+
+// directories are moved holding the tree lock exclusively, everything
+// else with both parent directories locked
+int fs_renameAt(uint32_t srcAt, const char *srcPath, uint32_t dstAt, const char *dstPath)
 {
     if (!srcPath || !dstPath)
         return -1;
-    // locate src
-    uint32_t sDir = 0;
-    char sName[MAX_FILENAME_LEN + 1];
-    if (fs_resolvePath(srcPath, &sDir, sName, sizeof(sName)) != 0)
+    int rc = FS_NEED_TREE;
+    for (int exclusive = 0; rc == FS_NEED_TREE && exclusive <= 1; exclusive++)
+    {
+        uint32_t sDir = 0, dDir = 0;
+        char sName[MAX_FILENAME_LEN + 1], dName[MAX_FILENAME_LEN + 1];
+        if (exclusive)
+            fs_treeLockExclusive();
+        else
+            fs_treeLockShared();
+        rc = -1;
+        if (fs_resolvePathAt(srcAt, srcPath, &sDir, sName, sizeof(sName)) == 0 &&
+            fs_resolvePathAt(dstAt, dstPath, &dDir, dName, sizeof(dName)) == 0)
+        {
+            fs_nodeWriteLock2(sDir, dDir);
+            rc = fs_renameLocked(sDir, sName, dDir, dName, exclusive);
+            fs_nodeUnlock2(sDir, dDir);
+        }
+        fs_treeUnlock();
+    }
+    return rc;
+}
+
+static int fs_renameLocked(uint32_t sDir, const char *sName, uint32_t dDir, const char *dName, int exclusive)
+{
+    if (sName[0] == '\0' || fs_isDotName(sName))
         return -1;
-    if (sName[0] == '\0')
+    if (dName[0] == '\0' || fs_isDotName(dName))
         return -1;
     DirEntry e;
-    uint32_t sIdx = 0;
-    if (fs_findInDir(sDir, sName, &e, &sIdx) != 0)
-        return -1;
-    // locate dst parent + name
-    uint32_t dDir = 0;
-    char dName[MAX_FILENAME_LEN + 1];
-    if (fs_resolvePath(dstPath, &dDir, dName, sizeof(dName)) != 0)
-        return -1;
-    if (dName[0] == '\0')
+    uint32_t sBlock = 0, sSlot = 0;
+    if (fs_locateInDir(sDir, sName, &e, NULL, &sBlock, &sSlot) != 0)
         return -1;
-    // if target exists -> for simplicity, fail
-    DirEntry tmp;
-    if (fs_findInDir(dDir, dName, &tmp, NULL) == 0)
+    if (e.fileType == FT_DIR && !exclusive)
+        return FS_NEED_TREE;
+    // a directory cannot move below itself
+    if (e.fileType == FT_DIR && fs_isInSubtree(dDir, e.startBlock))
         return -1;
-    // remove from src dir
-    if (fs_removeEntryFromDir(sDir, sIdx) != 0)
-        return -1;
-    // add to dst dir with new name
+    // an existing target is replaced, as with POSIX rename: a file by a
+    // file, an empty directory by a directory
+    DirEntry old;
+    uint32_t oBlock = 0, oSlot = 0;
+    int replace = (fs_locateInDir(dDir, dName, &old, NULL, &oBlock, &oSlot) == 0);
+    if (replace)
+    {
+        if (oBlock == sBlock && oSlot == sSlot)
+            return 0; // renamed onto itself
+        if ((old.fileType == FT_DIR) != (e.fileType == FT_DIR))
+            return -1;
+        if (old.fileType == FT_DIR && (fs_dirBusy(old.startBlock) || !fs_isDirectoryEmpty(old.startBlock)))
+            return -1;
+    }
+    else if (dDir == sDir)
+    {
+        // same directory: rewrite the name where the entry already is
+        int rc = fs_renameInDir(sDir, sBlock, sSlot, dName);
+        if (rc <= 0)
+            return rc;
+    }
+    // the new name is written before the old one is dropped, so a crash
+    // in between leaves the entry under both names rather than neither
     strncpy(e.filename, dName, sizeof(e.filename) - 1);
     e.filename[sizeof(e.filename) - 1] = '\0';
-    if (fs_addEntryToDir(dDir, &e) != 0)
+    if (replace)
+    {
+        // the target's record takes over the moved entry
+        DirBlock blk;
+        if (fs_loadDir(oBlock, &blk) != 0)
+            return -1;
+        fs_dirBlockUpdate(&blk, oSlot, &e);
+        if (fs_storeDir(oBlock, &blk) != 0)
+        {
+            fs_dcacheForget(dDir);
+            return -1;
+        }
+        fs_dcacheAdd(dDir, &e);
+    }
+    else
+    {
+        if (fs_addEntryToDir(dDir, &e) != 0)
+            return -1;
+        // making room may have packed the source's block
+        if (dDir == sDir && fs_locateInDir(sDir, sName, NULL, NULL, &sBlock, &sSlot) != 0)
+            return -1;
+    }
+    if (fs_removeEntryFromDir(sDir, sBlock, sSlot) != 0)
         return -1;
+    if (replace && fs_releaseEntry(dDir, &old) != 0)
+        return -1;
+    // a directory moved to another parent must point its ".." there
+    if (e.fileType == FT_DIR && dDir != sDir)
+    {
+        DirBlock moved;
+        DirEntry parent;
+        uint32_t i;
+        if (fs_loadDir(e.startBlock, &moved) != 0)
+            return -1;
+        if (fs_dirBlockFind(&moved, "..", &parent, &i) == 0)
+        {
+            parent.startBlock = dDir;
+            fs_dirBlockUpdate(&moved, i, &parent);
+            if (fs_storeDir(e.startBlock, &moved) != 0)
+            {
+                fs_dcacheForget(e.startBlock);
+                return -1;
+            }
+            fs_dcacheAdd(e.startBlock, &parent);
+        }
+    }
     return 0;
 }
 
-// allocate a free block using FAT (optimized to read only necessary blocks)
-uint64_t fs_allocateBlock(void)
+// 1 when dirBlock is topBlock or lies below it, following ".." up to the
+// root.  The tree lock is held exclusively, so no ".." changes meanwhile
+// and the directories on the way are read without their locks
+static int fs_isInSubtree(uint32_t dirBlock, uint32_t topBlock)
+{
+    uint32_t root = (uint32_t)g_superBlock.rootDirBlock;
+    for (uint32_t depth = 0; depth < MAX_PATH_LEN; depth++)
+    {
+        if (dirBlock == topBlock)
+            return 1;
+        DirEntry parent;
+        if (dirBlock == root || fs_locateInDir(dirBlock, "..", &parent, NULL, NULL, NULL) != 0 ||
+            parent.startBlock == dirBlock)
+            return 0;
+        dirBlock = parent.startBlock;
+    }
+    return 1; // a loop of ".." entries, take it as below
+}
+
+static void fs_allocInit(void)
+{
+    for (int i = 0; i < ALLOC_GROUPS; i++)
+        pthread_mutex_init(&allocGroups[i].lock, NULL);
+    pthread_mutex_init(&sbLock, NULL);
+}
+
+// counts the free entries of every FAT block and lays out the groups;
+// the counts come from the FAT, whatever the superblock last recorded.
+// Runs before the volume is in use
+static int fs_allocLoad(void)
 {
-    // scan FAT block by block to find a free entry
     uint32_t fatBuffer[FAT_ENTRIES_PER_BLOCK];
+    uint64_t fatBlocks = g_superBlock.fatBlocks;
+    pthread_once(&allocOnce, fs_allocInit);
+    uint8_t *counts = realloc(fatFree, fatBlocks ? fatBlocks : 1);
+    if (counts == NULL)
+    {
+        printf("Failed to alloc FAT summary\n");
+        return -1;
+    }
+    fatFree = counts;
+    allocGroupBlocks = (fatBlocks + ALLOC_GROUPS - 1) / ALLOC_GROUPS;
+    if (allocGroupBlocks == 0)
+        allocGroupBlocks = 1;
+    for (uint32_t g = 0; g < ALLOC_GROUPS; g++)
+    {
+        AllocGroup *grp = &allocGroups[g];
+        grp->firstFat = g * allocGroupBlocks;
+        grp->endFat = grp->firstFat + allocGroupBlocks;
+        if (grp->firstFat > fatBlocks)
+            grp->firstFat = fatBlocks;
+        if (grp->endFat > fatBlocks)
+            grp->endFat = fatBlocks;
+        grp->cursor = grp->firstFat;
+        grp->freeCount = 0;
+        for (uint64_t f = grp->firstFat; f < grp->endFat; f++)
+        {
+            if (LBAread(fatBuffer, 1, g_superBlock.fatStart + f) != 1)
+            {
+                printf("Failed to read FAT block %llu\n", (unsigned long long)f);
+                return -1;
+            }
+            uint32_t n = 0;
+            for (uint32_t i = 0; i < FAT_ENTRIES_PER_BLOCK; i++)
+            {
+                if (f * FAT_ENTRIES_PER_BLOCK + i < g_superBlock.totalBlocks && fatBuffer[i] == FAT_FREE)
+                    n++;
+            }
+            fatFree[f] = (uint8_t)n;
+            grp->freeCount += n;
+        }
+    }
+    fs_freeBlockCount();
+    return 0;
+}
+
+// free blocks summed over the groups; refreshes the superblock's copy
+uint64_t fs_freeBlockCount(void)
+{
+    uint64_t n = 0;
+    for (uint32_t g = 0; g < ALLOC_GROUPS; g++)
+        n += __atomic_load_n(&allocGroups[g].freeCount, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_superBlock.freeBlocks, n, __ATOMIC_RELAXED);
+    return n;
+}
 
-    for (uint64_t fatBlock = 0; fatBlock < g_superBlock.fatBlocks; fatBlock++)
+// writes the superblock.  freeBlocks is summed from the allocation
+// groups, the other fields only change at mount time
+static int fs_writeSuperBlock(void)
+{
+    union
+    {
+        SuperBlock sb;
+        char block[BLOCK_SIZE];
+    } buf;
+    size_t at = offsetof(SuperBlock, freeBlocks);
+    size_t rest = at + sizeof(buf.sb.freeBlocks);
+    pthread_once(&allocOnce, fs_allocInit);
+    memset(&buf, 0, sizeof(buf));
+    pthread_mutex_lock(&sbLock);
+    memcpy(&buf.sb, &g_superBlock, at);
+    buf.sb.freeBlocks = fs_freeBlockCount();
+    memcpy((char *)&buf.sb + rest, (char *)&g_superBlock + rest, sizeof(SuperBlock) - rest);
+    int rc = (LBAwrite(&buf, 1, 0) == 1) ? 0 : -1;
+    pthread_mutex_unlock(&sbLock);
+    return rc;
+}
+
+// takes up to want free blocks in a row from group g, searching from
+// goal's FAT block and entry (goal 0: from the group's last allocation).
+// A run may go on from one FAT block into the next.  The first run of
+// want wins, else the longest one seen if it is at least minLen long.
+// Returns the run's length into blocks; 0 when the group has no run of
+// minLen or, with *ioError set, when the FAT cannot be read or written.
+// A write failing part way returns the blocks already taken.  The
+// group's lock is held
+static uint32_t fs_allocFromGroup(uint32_t g, uint64_t goal, uint32_t want, uint32_t minLen,
+                                  uint32_t *blocks, int *ioError)
+{
+    AllocGroup *grp = &allocGroups[g];
+    uint64_t span = grp->endFat - grp->firstFat;
+    uint64_t start = goal ? goal / FAT_ENTRIES_PER_BLOCK : grp->cursor;
+    uint32_t fatBuffer[FAT_ENTRIES_PER_BLOCK];
+    uint64_t inBuffer = UINT64_MAX;
+    uint64_t prevFat = UINT64_MAX;
+    uint64_t bestAt = 0;
+    uint32_t bestLen = 0, run = 0;
+    if (grp->freeCount < minLen)
+        return 0;
+    // the goal's block is looked at again from its start at the end
+    for (uint64_t k = 0; k < span + (goal ? 1 : 0) && bestLen < want; k++)
+    {
+        uint64_t fatBlock = grp->firstFat + (start - grp->firstFat + k) % span;
+        if (fatBlock != prevFat + 1)
+            run = 0; // wrapped around, the blocks are not consecutive
+        prevFat = fatBlock;
+        if (fatFree[fatBlock] == 0)
+        {
+            run = 0;
+            continue;
+        }
+        // a block whose entries are all free needs no read
+        int allFree = (fatFree[fatBlock] == FAT_ENTRIES_PER_BLOCK);
+        if (!allFree && inBuffer != fatBlock)
+        {
+            if (LBAread(fatBuffer, 1, g_superBlock.fatStart + fatBlock) != 1)
+            {
+                printf("Failed to read FAT block %llu\n", (unsigned long long)fatBlock);
+                *ioError = 1;
+                return 0;
+            }
+            inBuffer = fatBlock;
+        }
+        for (uint32_t i = (k == 0 && goal) ? (uint32_t)(goal % FAT_ENTRIES_PER_BLOCK) : 0; i < FAT_ENTRIES_PER_BLOCK; i++)
+        {
+            uint64_t block = fatBlock * FAT_ENTRIES_PER_BLOCK + i;
+            if (block >= g_superBlock.totalBlocks || (!allFree && fatBuffer[i] != FAT_FREE))
+            {
+                run = 0;
+                continue;
+            }
+            if (++run > bestLen)
+            {
+                bestLen = run;
+                bestAt = block + 1 - run;
+                if (run == want)
+                    break;
+            }
+        }
+    }
+    if (bestLen == 0 || bestLen < minLen)
+        return 0;
+    // found free blocks, mark them as EOF and write back each FAT block
+    // the run has entries in
+    uint32_t taken = 0;
+    while (taken < bestLen)
     {
-        // read one FAT block
-        if (LBAread(fatBuffer, 1, g_superBlock.fatStart + fatBlock) != 1)
+        uint64_t fatBlock = (bestAt + taken) / FAT_ENTRIES_PER_BLOCK;
+        uint32_t first = (uint32_t)((bestAt + taken) % FAT_ENTRIES_PER_BLOCK);
+        uint32_t n = FAT_ENTRIES_PER_BLOCK - first;
+        if (n > bestLen - taken)
+            n = bestLen - taken;
+        if (inBuffer != fatBlock && LBAread(fatBuffer, 1, g_superBlock.fatStart + fatBlock) != 1)
         {
             printf("Failed to read FAT block %llu\n", (unsigned long long)fatBlock);
-            return 0;
+            *ioError = 1;
+            break;
         }
-
-        // scan entries in this FAT block
-        for (uint32_t i = 0; i < FAT_ENTRIES_PER_BLOCK; i++)
+        inBuffer = fatBlock;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            fatBuffer[first + i] = FAT_EOF;
+            blocks[taken + i] = (uint32_t)(bestAt + taken + i);
+        }
+        if (LBAwrite(fatBuffer, 1, g_superBlock.fatStart + fatBlock) != 1)
         {
-            uint64_t blockNumber = fatBlock * FAT_ENTRIES_PER_BLOCK + i;
+            printf("Failed to write FAT block %llu\n", (unsigned long long)fatBlock);
+            *ioError = 1;
+            inBuffer = UINT64_MAX;
+            break;
+        }
+        fatFree[fatBlock] -= n;
+        __atomic_store_n(&grp->freeCount, grp->freeCount - n, __ATOMIC_RELAXED);
+        grp->cursor = fatBlock;
+        taken += n;
+    }
+    if (taken > 0)
+        fs_discardCancel(blocks[0], taken);
+    return taken;
+}
+
+// allocate a free block using FAT
+uint64_t fs_allocateBlock(void)
+{
+    return fs_allocateBlockNear(0);
+}
 
-            // check if we've scanned all blocks
-            if (blockNumber >= g_superBlock.totalBlocks)
-                break;
+// allocates a block close after goal, keeping a file's or a directory's
+// blocks together
+uint64_t fs_allocateBlockNear(uint64_t goal)
+{
+    uint32_t block;
+    return fs_allocateExtent(goal, 1, &block) == 1 ? block : 0;
+}
 
-            if (fatBuffer[i] == FAT_FREE)
+// allocates count blocks in as few runs of consecutive blocks as it can,
+// the first as close after goal as possible, into blocks in order.  The
+// goal's group and then every other group are searched for one run of
+// all the blocks still wanted before shorter runs are taken.  A goal
+// group another thread is allocating from is not waited for; the calling
+// thread's own group serves instead.  Returns how many blocks it got,
+// fewer than count when the volume is full or the FAT fails
+uint32_t fs_allocateExtent(uint64_t goal, uint32_t count, uint32_t *blocks)
+{
+    int ioError = 0;
+    uint32_t got = 0;
+    pthread_once(&allocOnce, fs_allocInit);
+    if (allocGroup < 0)
+        allocGroup = (int)(__atomic_fetch_add(&allocNextGroup, 1, __ATOMIC_RELAXED) % ALLOC_GROUPS);
+    while (got < count && !ioError)
+    {
+        uint32_t n = 0;
+        uint32_t want = count - got;
+        // first pass: one run of want, second: the longest runs there are
+        for (int pass = (want > 1) ? 0 : 1; n == 0 && !ioError && pass < 2; pass++)
+        {
+            uint32_t minLen = (pass == 0) ? want : 1;
+            if (goal != 0 && goal < g_superBlock.totalBlocks)
             {
-                // found a free block, mark it as EOF and write back
-                fatBuffer[i] = FAT_EOF;
-                if (LBAwrite(fatBuffer, 1, g_superBlock.fatStart + fatBlock) != 1)
+                uint32_t g = (uint32_t)(goal / FAT_ENTRIES_PER_BLOCK / allocGroupBlocks);
+                if (pthread_mutex_trylock(&allocGroups[g].lock) == 0)
                 {
-                    printf("Failed to write FAT block %llu\n", (unsigned long long)fatBlock);
-                    return 0;
+                    n = fs_allocFromGroup(g, goal, want, minLen, blocks + got, &ioError);
+                    pthread_mutex_unlock(&allocGroups[g].lock);
                 }
-                g_superBlock.freeBlocks--;
-                LBAwrite(&g_superBlock, 1, 0);
-                return blockNumber;
+            }
+            for (uint32_t s = 0; n == 0 && !ioError && s < ALLOC_GROUPS; s++)
+            {
+                uint32_t g = (allocGroup + s) % ALLOC_GROUPS;
+                if (__atomic_load_n(&allocGroups[g].freeCount, __ATOMIC_RELAXED) < minLen)
+                    continue;
+                pthread_mutex_lock(&allocGroups[g].lock);
+                n = fs_allocFromGroup(g, 0, want, minLen, blocks + got, &ioError);
+                pthread_mutex_unlock(&allocGroups[g].lock);
             }
         }
+        if (n == 0)
+            break;
+        got += n;
+        goal = blocks[got - 1];
     }
-
-    printf("No free blocks available\n");
-    return 0;
+    if (got < count && !ioError)
+        printf("No free blocks available\n");
+    return got;
 }
 
 // free a block using FAT (optimized to read only necessary block)
@@ -344,89 +778,242 @@ int fs_freeBlock(uint64_t blockNumber)
         printf("Invalid block number: %llu\n", (unsigned long long)blockNumber);
         return -1;
     }
+    uint32_t block = (uint32_t)blockNumber;
+    return fs_freeRun(&block, 1);
+}
 
-    // calculate which FAT block contains this entry
-    uint64_t fatBlock = blockNumber / FAT_ENTRIES_PER_BLOCK;
-    uint32_t fatIndex = blockNumber % FAT_ENTRIES_PER_BLOCK;
+// frees blocks that all have their entry in one FAT block, reading and
+// writing that FAT block once.  Blocks already free are skipped, so the
+// counts do not move twice
+static int fs_freeRun(const uint32_t *blocks, uint32_t n)
+{
+    // calculate which FAT block contains the entries
+    uint64_t fatBlock = blocks[0] / FAT_ENTRIES_PER_BLOCK;
+    AllocGroup *grp = &allocGroups[fatBlock / allocGroupBlocks];
 
     // read the specific FAT block
     uint32_t fatBuffer[FAT_ENTRIES_PER_BLOCK];
+    pthread_once(&allocOnce, fs_allocInit);
+    pthread_mutex_lock(&grp->lock);
     if (LBAread(fatBuffer, 1, g_superBlock.fatStart + fatBlock) != 1)
     {
+        pthread_mutex_unlock(&grp->lock);
         printf("Failed to read FAT block %llu\n", (unsigned long long)fatBlock);
         return -1;
     }
 
-    // mark the block as free
-    fatBuffer[fatIndex] = FAT_FREE;
+    // mark the blocks as free
+    uint32_t freedBlocks[FAT_ENTRIES_PER_BLOCK];
+    uint32_t freed = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint32_t fatIndex = blocks[i] % FAT_ENTRIES_PER_BLOCK;
+        if (fatBuffer[fatIndex] != FAT_FREE)
+        {
+            fatBuffer[fatIndex] = FAT_FREE;
+            freedBlocks[freed++] = blocks[i];
+        }
+    }
 
     // write the updated FAT block back
-    if (LBAwrite(fatBuffer, 1, g_superBlock.fatStart + fatBlock) != 1)
+    if (freed > 0 && LBAwrite(fatBuffer, 1, g_superBlock.fatStart + fatBlock) != 1)
     {
+        pthread_mutex_unlock(&grp->lock);
         printf("Failed to write FAT block %llu\n", (unsigned long long)fatBlock);
         return -1;
     }
-
-    g_superBlock.freeBlocks++;
-    LBAwrite(&g_superBlock, 1, 0);
+    fatFree[fatBlock] += freed;
+    __atomic_store_n(&grp->freeCount, grp->freeCount + freed, __ATOMIC_RELAXED);
+    // queued under the group lock, so a reallocation cancels it
+    fs_discardQueue(freedBlocks, freed);
+    pthread_mutex_unlock(&grp->lock);
     return 0;
 }
 
+static int fs_compareBlocks(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// frees n blocks, sorted so the blocks sharing a FAT block are freed
+// with one read and one write of it.  Block 0 entries are skipped
+int fs_freeBlocks(const uint32_t *blocks, uint32_t n)
+{
+    uint32_t local[MAX_FILE_BLOCKS + 1];
+    uint32_t *sorted = local;
+    if (n > MAX_FILE_BLOCKS + 1)
+    {
+        sorted = malloc(n * sizeof(uint32_t));
+        if (sorted == NULL)
+        {
+            // still correct, one FAT update per block
+            int rc = 0;
+            for (uint32_t i = 0; i < n; i++)
+            {
+                if (blocks[i] != 0 && fs_freeBlock(blocks[i]) != 0)
+                    rc = -1;
+            }
+            return rc;
+        }
+    }
+    memcpy(sorted, blocks, n * sizeof(uint32_t));
+    qsort(sorted, n, sizeof(uint32_t), fs_compareBlocks);
+
+    int rc = 0;
+    uint32_t i = 0;
+    while (i < n && sorted[i] == 0)
+        i++;
+    while (i < n)
+    {
+        if (sorted[i] >= g_superBlock.totalBlocks)
+        {
+            // sorted, so the rest are out of range as well
+            printf("Invalid block number: %u\n", sorted[i]);
+            rc = -1;
+            break;
+        }
+        uint32_t j = i + 1;
+        while (j < n && sorted[j] / FAT_ENTRIES_PER_BLOCK == sorted[i] / FAT_ENTRIES_PER_BLOCK)
+            j++;
+        if (fs_freeRun(sorted + i, j - i) != 0)
+            rc = -1;
+        i = j;
+    }
+    if (sorted != local)
+        free(sorted);
+    return rc;
+}
+
+// blocks a file takes on disk: its header and the data blocks it has,
+// preallocated ones too, holes not.  0 for a file never written
+uint64_t fs_fileBlocksUsed(uint32_t headerBlock)
+{
+    FileHeader fh;
+    uint64_t n = 0;
+    if (headerBlock == 0)
+        return 0;
+    fs_treeLockShared();
+    fs_nodeReadLock(headerBlock);
+    if (LBAread(&fh, 1, headerBlock) == 1 && fh.magic == FILEHEADER_MAGIC)
+    {
+        n = 1;
+        for (uint32_t i = 0; i < fh.dataBlockCount && i < MAX_FILE_BLOCKS; i++)
+            if (fh.dataBlocks[i] != BLOCK_HOLE)
+                n++;
+    }
+    fs_nodeUnlock(headerBlock);
+    fs_treeUnlock();
+    return n;
+}
+
+// frees a file's data blocks and its header in one batch
+int fs_freeFileBlocks(uint32_t headerBlock)
+{
+    FileHeader fh;
+    uint32_t blocks[MAX_FILE_BLOCKS + 1];
+    uint32_t n = 0;
+    if (LBAread(&fh, 1, headerBlock) != 1)
+        return -1;
+    if (fh.magic == FILEHEADER_MAGIC)
+    {
+        for (uint32_t i = 0; i < fh.dataBlockCount && i < MAX_FILE_BLOCKS; i++)
+            if (fh.dataBlocks[i] != BLOCK_HOLE)
+                blocks[n++] = BLOCK_NUMBER(fh.dataBlocks[i]);
+    }
+    blocks[n++] = headerBlock;
+    return fs_freeBlocks(blocks, n);
+}
+
 // find file
 int fs_findFile(const char *path, DirEntry *entry)
+{
+    return fs_findFileAt(0, path, entry);
+}
+
+int fs_findFileAt(uint32_t atBlock, const char *path, DirEntry *entry)
 {
     if (path == NULL || entry == NULL)
         return -1;
     // resolve parent dir + name
     uint32_t dirBlock = 0;
     char name[MAX_FILENAME_LEN + 1];
-    if (fs_resolvePath(path, &dirBlock, name, sizeof(name)) != 0)
-        return -1;
-    if (name[0] == '\0')
-        return -1; // root itself has no DirEntry by name
-    return fs_findInDir(dirBlock, name, entry, NULL);
+    int rc = -1;
+    // a path whose directories are all cached resolves without a lock,
+    // unless a directory moved meanwhile
+    uint32_t seq = fs_treeSeqBegin();
+    if ((seq & 1) == 0)
+    {
+        rc = fs_resolveFrom(atBlock, path, &dirBlock, name, sizeof(name), 1);
+        if (rc == 0)
+            rc = (name[0] != '\0') ? fs_dcacheLookup(dirBlock, name, entry) : -1;
+        if (rc <= 0 && !fs_treeSeqRetry(seq))
+            return rc;
+    }
+    rc = -1;
+    fs_treeLockShared();
+    // the root itself has no DirEntry by name
+    if (fs_resolvePathAt(atBlock, path, &dirBlock, name, sizeof(name)) == 0 && name[0] != '\0')
+        rc = fs_findInDir(dirBlock, name, entry, NULL);
+    fs_treeUnlock();
+    return rc;
 }
 
 // create file
 int fs_createFile(const char *path, uint32_t fileType)
+{
+    return fs_createFileAt(0, path, fileType);
+}
+
+int fs_createFileAt(uint32_t atBlock, const char *path, uint32_t fileType)
 {
     if (path == NULL)
         return -1;
     // parent dir + name
     uint32_t dirBlock = 0;
     char name[MAX_FILENAME_LEN + 1];
-    if (fs_resolvePath(path, &dirBlock, name, sizeof(name)) != 0)
-        return -1;
-    if (name[0] == '\0')
-        return -1;
-    // already exists?
-    DirEntry tmp;
-    if (fs_findInDir(dirBlock, name, &tmp, NULL) == 0)
+    int rc = -1;
+    fs_treeLockShared();
+    if (fs_resolvePathAt(atBlock, path, &dirBlock, name, sizeof(name)) == 0 && name[0] != '\0')
+    {
+        fs_nodeWriteLock(dirBlock);
+        rc = fs_createLocked(dirBlock, name, fileType);
+        fs_nodeUnlock(dirBlock);
+    }
+    fs_treeUnlock();
+    return rc;
+}
+
+static int fs_createLocked(uint32_t dirBlock, const char *name, uint32_t fileType)
+{
+    // already exists?  A cached directory answers without a read
+    int rc = fs_dcacheLookup(dirBlock, name, NULL);
+    if (rc == 0 || (rc > 0 && fs_locateInDir(dirBlock, name, NULL, NULL, NULL, NULL) == 0))
         return -1;
     // prepare entry
     DirEntry newEntry;
     memset(&newEntry, 0, sizeof(newEntry));
-    strncpy(newEntry.filename, name, sizeof(newEntry.filename) - 1);
+    snprintf(newEntry.filename, sizeof(newEntry.filename), "%s", name);
     newEntry.fileType = fileType;
     newEntry.fileSize = 0;
     newEntry.createTime = (uint32_t)time(NULL);
     newEntry.modifyTime = newEntry.createTime;
+    // a new directory goes to this thread's group, spreading directories
+    // out; a file starts next to its directory
     if (fileType == FT_DIR)
     {
         newEntry.startBlock = fs_allocateBlock();
         if (newEntry.startBlock == 0)
             return -1;
         DirBlock nd;
-        nd.entryCount = 0;
-        nd.nextDirBlock = 0;
-        memset(nd.entries, 0, sizeof(nd.entries));
+        fs_initDirBlock(&nd, newEntry.startBlock, dirBlock);
         if (LBAwrite(&nd, 1, newEntry.startBlock) != 1)
             return -1;
     }
     else if (fileType == FT_FILE)
     {
         // allocate header and initialize
-        newEntry.startBlock = fs_allocateBlock();
+        newEntry.startBlock = fs_allocateBlockNear(dirBlock);
         if (newEntry.startBlock == 0)
             return -1;
         FileHeader fh;
@@ -445,136 +1032,547 @@ int fs_createFile(const char *path, uint32_t fileType)
 
 // delete file
 int fs_deleteFile(const char *path)
+{
+    return fs_deleteFileAt(0, path);
+}
+
+// files go with their directory locked, directories holding the tree
+// lock exclusively
+int fs_deleteFileAt(uint32_t atBlock, const char *path)
 {
     if (path == NULL)
         return -1;
-    uint32_t dirBlock = 0;
-    char name[MAX_FILENAME_LEN + 1];
-    if (fs_resolvePath(path, &dirBlock, name, sizeof(name)) != 0)
+    int rc = FS_NEED_TREE;
+    for (int exclusive = 0; rc == FS_NEED_TREE && exclusive <= 1; exclusive++)
+    {
+        uint32_t dirBlock = 0;
+        char name[MAX_FILENAME_LEN + 1];
+        if (exclusive)
+            fs_treeLockExclusive();
+        else
+            fs_treeLockShared();
+        rc = -1;
+        if (fs_resolvePathAt(atBlock, path, &dirBlock, name, sizeof(name)) == 0)
+        {
+            fs_nodeWriteLock(dirBlock);
+            rc = fs_deleteLocked(dirBlock, name, exclusive);
+            fs_nodeUnlock(dirBlock);
+        }
+        fs_treeUnlock();
+    }
+    return rc;
+}
+
+static int fs_deleteLocked(uint32_t dirBlock, const char *name, int exclusive)
+{
+    if (fs_isDotName(name))
         return -1;
     DirEntry e;
-    uint32_t idx = 0;
-    if (fs_findInDir(dirBlock, name, &e, &idx) != 0)
+    uint32_t entryBlock = 0, slot = 0;
+    if (fs_locateInDir(dirBlock, name, &e, NULL, &entryBlock, &slot) != 0)
+        return -1;
+    if (e.fileType == FT_DIR && !exclusive)
+        return FS_NEED_TREE;
+    // the current directory, and one open as a handle, stays alive
+    if (e.fileType == FT_DIR && (fs_dirBusy(e.startBlock) || !fs_isDirectoryEmpty(e.startBlock)))
         return -1;
-    if (e.fileType == FT_DIR)
+    if (fs_releaseEntry(dirBlock, &e) != 0)
+        return -1;
+    if (fs_removeEntryFromDir(dirBlock, entryBlock, slot) != 0)
+        return -1;
+    return 0;
+}
+
+// frees the blocks of an entry of dirBlock that is being dropped, under
+// dirBlock's write lock; a directory must already be empty, a file still
+// open keeps its blocks until the last descriptor closes
+static int fs_releaseEntry(uint32_t dirBlock, const DirEntry *e)
+{
+    if (e->fileType == FT_DIR)
     {
-        if (!fs_isDirectoryEmpty(e.startBlock))
-            return -1;
+        // release the filter, the (now empty) overflow blocks and the
+        // head, a batch at a time
+        DirBlock d;
+        uint32_t batch[FAT_ENTRIES_PER_BLOCK];
+        uint32_t n = 0;
+        fs_dcacheForget(e->startBlock);
+        if (fs_loadDir(e->startBlock, &d) == 0)
+        {
+            fs_bloomFree(d.bloomBlock);
+            uint32_t next = d.nextDirBlock;
+            while (next != 0 && fs_loadDir(next, &d) == 0)
+            {
+                batch[n++] = next;
+                if (n == FAT_ENTRIES_PER_BLOCK)
+                {
+                    fs_freeBlocks(batch, n);
+                    n = 0;
+                }
+                next = d.nextDirBlock;
+            }
+        }
+        batch[n++] = e->startBlock;
+        return fs_freeBlocks(batch, n);
     }
-    else if (e.fileType == FT_FILE)
+    else if (e->fileType == FT_FILE && !b_unlinked(dirBlock, e->filename, e->startBlock) && e->startBlock)
     {
         // free header and data blocks
-        FileHeader fh;
-        if (LBAread(&fh, 1, e.startBlock) != 1)
-            return -1;
-        if (fh.magic == FILEHEADER_MAGIC)
+        return fs_freeFileBlocks(e->startBlock);
+    }
+    return 0;
+}
+
+// set file size
+int fs_setFileSize(const char *path, uint64_t size)
+{
+    if (path == NULL)
+        return -1;
+    uint32_t dirBlock = 0;
+    char name[MAX_FILENAME_LEN + 1];
+    int rc = -1;
+    fs_treeLockShared();
+    if (fs_resolvePathAt(0, path, &dirBlock, name, sizeof(name)) == 0 && name[0] != '\0')
+        rc = fs_truncateInDir(dirBlock, name, size);
+    fs_treeUnlock();
+    return rc;
+}
+
+// sets the size of file name of dirBlock, shrinking or growing it, and
+// records it in the entry.  The caller holds the tree lock shared
+int fs_truncateInDir(uint32_t dirBlock, const char *name, uint64_t size)
+{
+    DirEntry e;
+    uint32_t entryBlock = 0, slot = 0;
+    if (size > (uint64_t)MAX_FILE_BLOCKS * BLOCK_SIZE)
+        return -1;
+    if (fs_findInDir(dirBlock, name, &e, NULL) != 0 || e.fileType != FT_FILE)
+        return -1;
+    uint32_t headerBlock = e.startBlock;
+    int rc = -1;
+    fs_nodeWriteLock2(dirBlock, headerBlock);
+    // the entry may have moved on before the locks were taken
+    if (fs_locateInDir(dirBlock, name, &e, NULL, &entryBlock, &slot) == 0 &&
+        e.fileType == FT_FILE && e.startBlock == headerBlock)
+    {
+        if (headerBlock != 0)
+            rc = fs_resizeLocked(headerBlock, size);
+        else
+            rc = (size == 0) ? 0 : -1; // no blocks yet, nothing to cut
+    }
+    if (rc == 0)
+    {
+        DirBlock blk;
+        e.fileSize = (uint32_t)size;
+        e.modifyTime = (uint32_t)time(NULL);
+        if (fs_loadDir(entryBlock, &blk) != 0)
+            rc = -1;
+        else
         {
-            for (uint32_t i = 0; i < fh.dataBlockCount; i++)
-                fs_freeBlock(fh.dataBlocks[i]);
+            fs_dirBlockUpdate(&blk, slot, &e);
+            rc = fs_storeDir(entryBlock, &blk);
         }
+        if (rc == 0)
+            fs_dcacheAdd(dirBlock, &e);
+        else
+            fs_dcacheForget(dirBlock);
     }
-    if (e.startBlock)
-        fs_freeBlock(e.startBlock);
-    if (fs_removeEntryFromDir(dirBlock, idx) != 0)
-        return -1;
-    return 0;
+    fs_nodeUnlock2(dirBlock, headerBlock);
+    return rc;
 }
 
-// dir helpers
-static int fs_expandDirectoryIfNeeded(uint32_t dirBlock, DirBlock *dir, uint32_t *outUseBlock)
+// resizes the file of headerBlock, whose node lock is held.  The header
+// is written before the cut blocks are freed, all in one batch, so it
+// never points at free blocks; the rest of the new last block is zeroed
+// so a later extension reads zeros.  Growing adds holes
+static int fs_resizeLocked(uint32_t headerBlock, uint64_t size)
 {
-    if (dir->entryCount < MAX_DIR_ENTRIES)
+    FileHeader fh;
+    char blk[BLOCK_SIZE];
+    uint32_t cut[MAX_FILE_BLOCKS];
+    uint32_t cutCount = 0;
+    if (LBAread(&fh, 1, headerBlock) != 1 || fh.magic != FILEHEADER_MAGIC)
+        return -1;
+    uint32_t keep = (uint32_t)((size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    if (fh.dataBlockCount > MAX_FILE_BLOCKS)
+        return -1;
+    while (fh.dataBlockCount > keep)
     {
-        if (outUseBlock)
-            *outUseBlock = dirBlock;
-        return 0;
+        uint32_t entry = fh.dataBlocks[--fh.dataBlockCount];
+        if (entry != BLOCK_HOLE)
+            cut[cutCount++] = BLOCK_NUMBER(entry);
     }
-    if (dir->nextDirBlock == 0)
+
+    // zero past the end that stays, the old one when growing
+    uint64_t end = (size < fh.fileSize) ? size : fh.fileSize;
+    if (end % BLOCK_SIZE != 0 && end / BLOCK_SIZE < fh.dataBlockCount &&
+        BLOCK_HAS_DATA(fh.dataBlocks[end / BLOCK_SIZE]))
     {
-        uint64_t nb = fs_allocateBlock();
-        if (nb == 0)
-            return -1;
-        DirBlock nd;
-        nd.entryCount = 0;
-        nd.nextDirBlock = 0;
-        memset(nd.entries, 0, sizeof(nd.entries));
-        if (LBAwrite(&nd, 1, nb) != 1)
+        uint32_t lba = fh.dataBlocks[end / BLOCK_SIZE];
+        if (LBAread(blk, 1, lba) != 1)
             return -1;
-        dir->nextDirBlock = (uint32_t)nb;
-        if (fs_storeDir(dirBlock, dir) != 0)
+        memset(blk + end % BLOCK_SIZE, 0, BLOCK_SIZE - end % BLOCK_SIZE);
+        if (LBAwrite(blk, 1, lba) != 1)
             return -1;
-        if (outUseBlock)
-            *outUseBlock = (uint32_t)nb;
-        return 0;
     }
-    if (outUseBlock)
-        *outUseBlock = dir->nextDirBlock;
+    // growing leaves holes, they read as zeros and take no space
+    while (fh.dataBlockCount < keep)
+        fh.dataBlocks[fh.dataBlockCount++] = BLOCK_HOLE;
+    fh.fileSize = size;
+    if (LBAwrite(&fh, 1, headerBlock) != 1)
+        return -1;
+    b_truncated(headerBlock, size);
+    if (cutCount > 0 && fs_freeBlocks(cut, cutCount) != 0)
+        return -1;
     return 0;
 }
 
+// Packs the live entries of a directory, in their current order, into
+// as few of its chain blocks as they need and frees the rest.  The read
+// cursor never falls behind the write cursor, so a block is only
+// overwritten once everything it held has been packed into the blocks
+// before it; a crash part way leaves duplicates, never lost entries.
+// Fails while a stream is reading the directory.
+int fs_compactDir(uint32_t dirBlock)
+{
+    fs_treeLockShared();
+    fs_nodeWriteLock(dirBlock);
+    // the blocks it frees may be the next ones of an open stream
+    int rc = fs_dirStreaming(dirBlock) ? -1 : fs_compactLocked(dirBlock);
+    fs_nodeUnlock(dirBlock);
+    fs_treeUnlock();
+    return rc;
+}
+
+static int fs_compactLocked(uint32_t dirBlock)
+{
+    DirBlock src, dst, head;
+    uint32_t *chain = NULL;
+    uint32_t chainLen = 0, chainCap = 0;
+    uint32_t k = 0; // dst is written to chain[k]
+    uint32_t srcBlock = dirBlock;
+    int rc = -1;
+    while (srcBlock != 0)
+    {
+        if (fs_loadDir(srcBlock, &src) != 0)
+            goto out;
+        if (chainLen == chainCap)
+        {
+            uint32_t *grown = realloc(chain, (chainCap ? chainCap * 2 : 16) * sizeof(*chain));
+            if (grown == NULL)
+                goto out;
+            chain = grown;
+            chainCap = chainCap ? chainCap * 2 : 16;
+        }
+        chain[chainLen++] = srcBlock;
+        if (srcBlock == dirBlock)
+        {
+            // the head keeps its own header fields
+            head = src;
+            dst = src;
+            dst.entryCount = 0;
+            dst.usedBytes = 0;
+            dst.deadCount = 0;
+            memset(dst.data, 0, sizeof(dst.data));
+        }
+        DirEntry e;
+        for (uint32_t i = 0; fs_dirBlockGet(&src, i, &e) == 0; i++)
+        {
+            if (e.fileType == FT_UNUSED || fs_dirBlockAdd(&dst, &e) == 0)
+                continue;
+            // dst is full; chain[k + 1] has already been read by now
+            if (k + 1 >= chainLen)
+                goto out;
+            dst.nextDirBlock = chain[k + 1];
+            if (k == 0)
+                head = dst;
+            if (fs_storeDir(chain[k], &dst) != 0)
+                goto out;
+            k++;
+            fs_dirBlockInit(&dst);
+            dst.prevDirBlock = chain[k - 1];
+            if (fs_dirBlockAdd(&dst, &e) != 0)
+                goto out;
+        }
+        srcBlock = src.nextDirBlock;
+    }
+    dst.nextDirBlock = 0;
+    if (k == 0)
+        head = dst;
+    else if (fs_storeDir(chain[k], &dst) != 0)
+        goto out;
+    head.tailBlock = (k == 0) ? 0 : chain[k];
+    head.holeBlock = 0;
+    if (k == 0 && head.bloomBlock != 0)
+    {
+        // back to a single block, which is not worth filtering
+        fs_bloomFree(head.bloomBlock);
+        head.bloomBlock = 0;
+    }
+    if (fs_storeDir(dirBlock, &head) != 0)
+        goto out;
+    if (chainLen > k + 1)
+        fs_freeBlocks(chain + k + 1, chainLen - k - 1);
+    rc = fs_bloomRebuild(head.bloomBlock, &head);
+out:
+    free(chain);
+    return rc;
+}
+
+// dir helpers
+// adds newEntry on disk and then to the directory cache; a failure part
+// way leaves the disk unknown, so the cache forgets the directory
 static int fs_addEntryToDir(uint32_t dirBlock, const DirEntry *newEntry)
 {
-    uint32_t targetBlock = dirBlock;
+    if (fs_addToChain(dirBlock, newEntry) != 0)
+    {
+        fs_dcacheForget(dirBlock);
+        return -1;
+    }
+    fs_dcacheAdd(dirBlock, newEntry);
+    return 0;
+}
+
+// appends to the head, to the block the head names as holding
+// tombstones, or to the tail block, growing the chain when all are full;
+// the head remembers its tail so big directories are not walked
+static int fs_addToChain(uint32_t dirBlock, const DirEntry *newEntry)
+{
+    DirBlock head;
+    if (fs_loadDir(dirBlock, &head) != 0)
+        return -1;
+    if (fs_dirBlockAdd(&head, newEntry) == 0)
+    {
+        if (fs_storeDir(dirBlock, &head) != 0)
+            return -1;
+        return fs_bloomAdd(head.bloomBlock, newEntry->filename);
+    }
     DirBlock cur;
-    while (1)
+    if (head.holeBlock != 0)
+    {
+        uint32_t holeBlock = head.holeBlock;
+        if (fs_loadDir(holeBlock, &cur) != 0)
+            return -1;
+        int added = (fs_dirBlockAdd(&cur, newEntry) == 0);
+        if (added && fs_storeDir(holeBlock, &cur) != 0)
+            return -1;
+        // forget the hint once its tombstones are used up
+        if (!added || cur.deadCount == 0)
+        {
+            head.holeBlock = 0;
+            if (fs_storeDir(dirBlock, &head) != 0)
+                return -1;
+        }
+        if (added)
+            return fs_bloomAdd(head.bloomBlock, newEntry->filename);
+    }
+    uint32_t targetBlock = head.tailBlock ? head.tailBlock : head.nextDirBlock;
+    uint32_t lastBlock = dirBlock;
+    while (targetBlock != 0)
     {
         if (fs_loadDir(targetBlock, &cur) != 0)
             return -1;
-        if (cur.entryCount < MAX_DIR_ENTRIES)
+        if (fs_dirBlockAdd(&cur, newEntry) == 0)
         {
-            cur.entries[cur.entryCount] = *newEntry;
-            cur.entryCount++;
-            return fs_storeDir(targetBlock, &cur);
+            if (fs_storeDir(targetBlock, &cur) != 0)
+                return -1;
+            return fs_bloomAdd(head.bloomBlock, newEntry->filename);
         }
-        if (cur.nextDirBlock == 0)
+        lastBlock = targetBlock;
+        targetBlock = cur.nextDirBlock;
+    }
+    // expand
+    uint64_t nb = fs_allocateBlockNear(lastBlock);
+    if (nb == 0)
+        return -1;
+    DirBlock nd;
+    fs_dirBlockInit(&nd);
+    nd.prevDirBlock = lastBlock;
+    if (fs_dirBlockAdd(&nd, newEntry) != 0)
+        return -1;
+    if (fs_storeDir((uint32_t)nb, &nd) != 0)
+        return -1;
+    if (lastBlock == dirBlock)
+    {
+        head.nextDirBlock = (uint32_t)nb;
+    }
+    else
+    {
+        cur.nextDirBlock = (uint32_t)nb;
+        if (fs_storeDir(lastBlock, &cur) != 0)
+            return -1;
+    }
+    head.tailBlock = (uint32_t)nb;
+    // a second block makes lookups worth filtering
+    if (head.bloomBlock == 0)
+        head.bloomBlock = fs_bloomCreate(&head);
+    else if (fs_bloomAdd(head.bloomBlock, newEntry->filename) != 0)
+        return -1;
+    return fs_storeDir(dirBlock, &head);
+}
+
+// removes the entry on disk and from the directory cache
+static int fs_removeEntryFromDir(uint32_t dirBlock, uint32_t entryBlock, uint32_t slot)
+{
+    DirBlock cur;
+    DirEntry gone;
+    if (fs_loadDir(entryBlock, &cur) != 0 || fs_dirBlockGet(&cur, slot, &gone) != 0)
+        return -1;
+    if (fs_removeFromChain(dirBlock, entryBlock, slot) != 0)
+    {
+        fs_dcacheForget(dirBlock);
+        return -1;
+    }
+    fs_dcacheRemove(dirBlock, gone.filename);
+    return 0;
+}
+
+// tombstones slot of entryBlock, one of the blocks of dirBlock's chain.
+// An overflow block left without live entries is freed, unless a stream
+// is reading the directory and may go on into it: then it stays, all
+// tombstones, for inserts to reuse or fs_compactDir to free
+static int fs_removeFromChain(uint32_t dirBlock, uint32_t entryBlock, uint32_t slot)
+{
+    DirBlock head, cur;
+    if (fs_loadDir(entryBlock, &cur) != 0)
+        return -1;
+    if (fs_dirBlockRemove(&cur, slot) != 0)
+        return -1;
+    if (entryBlock == dirBlock)
+    {
+        if (fs_storeDir(entryBlock, &cur) != 0)
+            return -1;
+        head = cur;
+    }
+    else
+    {
+        if (fs_loadDir(dirBlock, &head) != 0)
+            return -1;
+        if (cur.entryCount == cur.deadCount && !fs_dirStreaming(dirBlock))
         {
-            // expand
-            uint32_t useBlock = 0;
-            if (fs_expandDirectoryIfNeeded(targetBlock, &cur, &useBlock) != 0)
+            if (fs_unlinkDirBlock(dirBlock, &head, entryBlock, &cur) != 0)
                 return -1;
-            if (useBlock == targetBlock)
-                continue; // retry same block
-            targetBlock = useBlock;
         }
         else
         {
-            targetBlock = cur.nextDirBlock;
+            if (fs_storeDir(entryBlock, &cur) != 0)
+                return -1;
+            // point inserts at the new tombstone
+            if (head.holeBlock == 0 && cur.deadCount > 0)
+            {
+                head.holeBlock = entryBlock;
+                if (fs_storeDir(dirBlock, &head) != 0)
+                    return -1;
+            }
         }
     }
+    return fs_bloomRemoved(head.bloomBlock, &head);
 }
 
-static int fs_removeEntryFromDir(uint32_t dirBlock, uint32_t index)
+// takes the overflow block out of the chain and frees it; head is
+// updated in memory and on disk
+static int fs_unlinkDirBlock(uint32_t dirBlock, DirBlock *head, uint32_t block, const DirBlock *dir)
 {
-    DirBlock cur;
-    uint32_t curBlock = dirBlock;
-    while (curBlock)
+    DirBlock nb;
+    uint32_t prev = dir->prevDirBlock;
+    uint32_t next = dir->nextDirBlock;
+    if (prev == dirBlock)
     {
-        if (fs_loadDir(curBlock, &cur) != 0)
+        head->nextDirBlock = next;
+    }
+    else
+    {
+        if (fs_loadDir(prev, &nb) != 0)
+            return -1;
+        nb.nextDirBlock = next;
+        if (fs_storeDir(prev, &nb) != 0)
             return -1;
-        if (index < cur.entryCount)
-        {
-            for (uint32_t i = index; i + 1 < cur.entryCount; i++)
-                cur.entries[i] = cur.entries[i + 1];
-            cur.entryCount--;
-            return fs_storeDir(curBlock, &cur);
-        }
-        index -= cur.entryCount;
-        curBlock = cur.nextDirBlock;
     }
-    return -1;
+    if (next != 0)
+    {
+        if (fs_loadDir(next, &nb) != 0)
+            return -1;
+        nb.prevDirBlock = prev;
+        if (fs_storeDir(next, &nb) != 0)
+            return -1;
+    }
+    if (head->tailBlock == block)
+        head->tailBlock = (prev == dirBlock) ? 0 : prev;
+    if (head->holeBlock == block)
+        head->holeBlock = 0;
+    if (fs_storeDir(dirBlock, head) != 0)
+        return -1;
+    return fs_freeBlock(block);
+}
+
+// renames slot of entryBlock where it is.  Returns 1, having written
+// nothing, when the new name does not fit in that block
+static int fs_renameInDir(uint32_t dirBlock, uint32_t entryBlock, uint32_t slot, const char *newName)
+{
+    DirBlock head, cur;
+    DirEntry e;
+    char oldName[MAX_FILENAME_LEN + 1];
+    if (fs_loadDir(entryBlock, &cur) != 0 || fs_dirBlockGet(&cur, slot, &e) != 0)
+        return -1;
+    if (fs_dirBlockRename(&cur, slot, newName) != 0)
+        return 1;
+    if (fs_storeDir(entryBlock, &cur) != 0)
+    {
+        fs_dcacheForget(dirBlock);
+        return -1;
+    }
+    // the cache, like the disk order elsewhere, shows the new name
+    // before the old one goes
+    strcpy(oldName, e.filename);
+    strncpy(e.filename, newName, sizeof(e.filename) - 1);
+    e.filename[sizeof(e.filename) - 1] = '\0';
+    fs_dcacheAdd(dirBlock, &e);
+    fs_dcacheRemove(dirBlock, oldName);
+    if (entryBlock == dirBlock)
+        head = cur;
+    else if (fs_loadDir(dirBlock, &head) != 0)
+        return -1;
+    // the old name only counts as removed, its filter bits stay set
+    if (fs_bloomAdd(head.bloomBlock, newName) != 0)
+        return -1;
+    return fs_bloomRemoved(head.bloomBlock, &head);
 }
 
+// overflow blocks left all tombstones under a stream count as empty
 static int fs_isDirectoryEmpty(uint32_t dirBlock)
 {
     DirBlock cur;
-    uint32_t curBlock = dirBlock;
-    while (curBlock)
+    for (uint32_t block = dirBlock; block != 0; block = cur.nextDirBlock)
     {
-        if (fs_loadDir(curBlock, &cur) != 0)
-            return 0;
-        if (cur.entryCount != 0)
+        if (fs_loadDir(block, &cur) != 0)
             return 0;
-        curBlock = cur.nextDirBlock;
+        DirEntry e;
+        for (uint32_t i = 0; fs_dirBlockGet(&cur, i, &e) == 0; i++)
+        {
+            if (e.fileType != FT_UNUSED && !fs_isDotName(e.filename))
+                return 0;
+        }
     }
     return 1;
 }
+
+static int fs_isDotName(const char *name)
+{
+    return strcmp(name, ".") == 0 || strcmp(name, "..") == 0;
+}
+
+// fresh directory block holding only "." and ".."
+static void fs_initDirBlock(DirBlock *dir, uint32_t selfBlock, uint32_t parentBlock)
+{
+    DirEntry e;
+    memset(&e, 0, sizeof(e));
+    fs_dirBlockInit(dir);
+    e.fileType = FT_DIR;
+    e.createTime = (uint32_t)time(NULL);
+    e.modifyTime = e.createTime;
+    strcpy(e.filename, ".");
+    e.startBlock = selfBlock;
+    fs_dirBlockAdd(dir, &e);
+    strcpy(e.filename, "..");
+    e.startBlock = parentBlock;
+    fs_dirBlockAdd(dir, &e);
+}
@@ -0,0 +1,540 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: fsDcache.c
+ *
+ * Description:: In-memory directory cache with lock-free lookups.
+ *	A cached directory is a hash table of all its names, so a lookup
+ *	answers both "here it is" and "not there" without reading a
+ *	block.  The table is direct mapped by directory block; the first
+ *	lookup that misses loads the whole chain and publishes it.  A
+ *	directory with too many names gets an empty version marked too
+ *	big instead, so its lookups go to the disk without trying again.
+ *
+ *	Readers take no lock.  Everything they can reach is immutable
+ *	once published: a writer changes an entry by linking in a new
+ *	name record in place of the old one, and grows a table by
+ *	publishing a whole new version.  What a writer unlinks is retired
+ *	and only freed once every reader that might still hold it has
+ *	left (epoch based reclamation: a reader announces the global
+ *	epoch on entry, the epoch only advances when all active readers
+ *	have seen it, and retired memory waits two epochs).
+ *
+ *	Writers hold the directory's node lock exclusively, as for the
+ *	on-disk change they mirror, plus the lock of the table slot so
+ *	a fill or eviction of another directory cannot retire the
+ *	version they are changing.
+ *
+ **************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "fsStruct.h"
+
+#define DCACHE_BITS 8
+#define DCACHE_SLOTS (1 << DCACHE_BITS)
+#define DCACHE_MAX_NAMES 65536  // bigger directories are not cached
+#define DCACHE_MIN_BUCKETS 8
+#define DCACHE_RETIRE_BATCH 64  // retired objects between reclaim passes
+
+// header of everything that is freed through the epochs
+typedef struct dcRetired
+{
+    struct dcRetired *next;
+    uint64_t epoch;             // global epoch when it was unlinked
+    int isDir;
+} dcRetired;
+
+typedef struct dcName
+{
+    dcRetired retired;
+    struct dcName *next;        // bucket chain
+    uint32_t hash;
+    uint32_t fileType;
+    uint32_t startBlock;
+    uint32_t fileSize;
+    uint32_t createTime;
+    uint32_t modifyTime;
+    uint16_t nameLen;
+    char name[];
+} dcName;
+
+typedef struct
+{
+    dcRetired retired;
+    uint32_t dirBlock;
+    uint32_t count;             // names, changed under the slot lock
+    uint32_t mask;              // buckets - 1
+    // not cached, too many names: count is a lower bound, lowered by
+    // removals only, and the table stays empty
+    uint32_t tooBig;
+    dcName *buckets[];
+} dcDir;
+
+// a reader thread's announcement
+typedef struct epochRecord
+{
+    struct epochRecord *next;   // registry, records are never unlinked
+    uint64_t epoch;             // global epoch seen on entry
+    uint32_t active;            // inside a lookup
+    uint32_t inUse;             // owned by a live thread
+} epochRecord;
+
+static dcDir *dcSlots[DCACHE_SLOTS];
+static pthread_mutex_t dcSlotLocks[DCACHE_SLOTS];
+static pthread_once_t dcOnce = PTHREAD_ONCE_INIT;
+
+static uint64_t globalEpoch;
+static epochRecord *epochRecords;
+static pthread_key_t epochKey;
+static __thread epochRecord *myRecord;
+
+static pthread_mutex_t limboLock = PTHREAD_MUTEX_INITIALIZER;
+static dcRetired *limbo;
+static uint32_t limboCount;
+
+// a record goes back to the pool when its thread exits
+static void fs_epochRelease(void *arg)
+{
+    epochRecord *r = arg;
+    __atomic_store_n(&r->inUse, 0, __ATOMIC_RELEASE);
+}
+
+static void fs_dcacheInit(void)
+{
+    for (int i = 0; i < DCACHE_SLOTS; i++)
+        pthread_mutex_init(&dcSlotLocks[i], NULL);
+    pthread_key_create(&epochKey, fs_epochRelease);
+}
+
+static uint32_t fs_dcacheSlot(uint32_t dirBlock)
+{
+    return (dirBlock * 2654435761u) >> (32 - DCACHE_BITS);
+}
+
+// this thread's record, NULL if none can be had
+static epochRecord *fs_epochRecord(void)
+{
+    epochRecord *r = myRecord;
+    if (r != NULL)
+        return r;
+    pthread_once(&dcOnce, fs_dcacheInit);
+    for (r = __atomic_load_n(&epochRecords, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+    {
+        uint32_t unused = 0;
+        if (__atomic_compare_exchange_n(&r->inUse, &unused, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+    if (r == NULL)
+    {
+        r = calloc(1, sizeof(*r));
+        if (r == NULL)
+            return NULL;
+        r->inUse = 1;
+        r->next = __atomic_load_n(&epochRecords, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&epochRecords, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    pthread_setspecific(epochKey, r);
+    myRecord = r;
+    return r;
+}
+
+static epochRecord *fs_epochEnter(void)
+{
+    epochRecord *r = fs_epochRecord();
+    if (r == NULL)
+        return NULL;
+    __atomic_store_n(&r->epoch, __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    __atomic_store_n(&r->active, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return r;
+}
+
+static void fs_epochExit(epochRecord *r)
+{
+    __atomic_store_n(&r->active, 0, __ATOMIC_RELEASE);
+}
+
+static void fs_dcacheFree(dcRetired *x)
+{
+    if (x->isDir)
+    {
+        dcDir *d = (dcDir *)x;
+        for (uint32_t i = 0; i <= d->mask; i++)
+        {
+            dcName *n = d->buckets[i];
+            while (n != NULL)
+            {
+                dcName *next = n->next;
+                free(n);
+                n = next;
+            }
+        }
+    }
+    free(x);
+}
+
+// advances the epoch if every active reader has seen it and frees what
+// was retired two epochs ago; limboLock held
+static void fs_epochCollect(void)
+{
+    uint64_t e = __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST);
+    int behind = 0;
+    for (epochRecord *r = __atomic_load_n(&epochRecords, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+    {
+        if (__atomic_load_n(&r->active, __ATOMIC_SEQ_CST) &&
+            __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST) != e)
+        {
+            behind = 1;
+            break;
+        }
+    }
+    if (!behind)
+        __atomic_store_n(&globalEpoch, ++e, __ATOMIC_SEQ_CST);
+    for (dcRetired **pp = &limbo; *pp != NULL; )
+    {
+        dcRetired *x = *pp;
+        if (x->epoch + 2 <= e)
+        {
+            *pp = x->next;
+            limboCount--;
+            fs_dcacheFree(x);
+        }
+        else
+        {
+            pp = &x->next;
+        }
+    }
+}
+
+// x is unreachable for new readers; free it once the old ones are gone
+static void fs_dcacheRetire(dcRetired *x)
+{
+    pthread_mutex_lock(&limboLock);
+    x->epoch = __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST);
+    x->next = limbo;
+    limbo = x;
+    if (++limboCount >= DCACHE_RETIRE_BATCH)
+        fs_epochCollect();
+    pthread_mutex_unlock(&limboLock);
+}
+
+static dcName *fs_dcacheName(const DirEntry *e)
+{
+    size_t len = strlen(e->filename);
+    dcName *n = malloc(sizeof(dcName) + len + 1);
+    if (n == NULL)
+        return NULL;
+    n->retired.isDir = 0;
+    n->next = NULL;
+    n->hash = fs_nameHash(e->filename, len);
+    n->fileType = e->fileType;
+    n->startBlock = e->startBlock;
+    n->fileSize = e->fileSize;
+    n->createTime = e->createTime;
+    n->modifyTime = e->modifyTime;
+    n->nameLen = (uint16_t)len;
+    memcpy(n->name, e->filename, len + 1);
+    return n;
+}
+
+static dcDir *fs_dcacheDir(uint32_t dirBlock, uint32_t names)
+{
+    uint32_t buckets = DCACHE_MIN_BUCKETS;
+    while (buckets < names)
+        buckets *= 2;
+    dcDir *d = calloc(1, sizeof(dcDir) + buckets * sizeof(dcName *));
+    if (d == NULL)
+        return NULL;
+    d->retired.isDir = 1;
+    d->dirBlock = dirBlock;
+    d->mask = buckets - 1;
+    return d;
+}
+
+// links n into an unpublished table
+static void fs_dcacheLink(dcDir *d, dcName *n)
+{
+    n->next = d->buckets[n->hash & d->mask];
+    d->buckets[n->hash & d->mask] = n;
+    d->count++;
+}
+
+// 0 found (entry filled if given), -1 not in the directory, 1 the
+// directory is not cached
+int fs_dcacheLookup(uint32_t dirBlock, const char *name, DirEntry *entry)
+{
+    epochRecord *r = fs_epochEnter();
+    if (r == NULL)
+        return 1;
+    size_t len = strlen(name);
+    uint32_t h = fs_nameHash(name, len);
+    int rc = 1;
+    dcDir *d = __atomic_load_n(&dcSlots[fs_dcacheSlot(dirBlock)], __ATOMIC_ACQUIRE);
+    if (d != NULL && d->dirBlock == dirBlock && !d->tooBig)
+    {
+        rc = -1;
+        for (dcName *n = __atomic_load_n(&d->buckets[h & d->mask], __ATOMIC_ACQUIRE); n != NULL;
+             n = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE))
+        {
+            if (n->hash != h || n->nameLen != len || memcmp(n->name, name, len) != 0)
+                continue;
+            if (entry)
+            {
+                memcpy(entry->filename, n->name, n->nameLen + 1);
+                entry->fileType = n->fileType;
+                entry->startBlock = n->startBlock;
+                entry->fileSize = n->fileSize;
+                entry->createTime = n->createTime;
+                entry->modifyTime = n->modifyTime;
+            }
+            rc = 0;
+            break;
+        }
+    }
+    fs_epochExit(r);
+    return rc;
+}
+
+// publishes a too big version for dirBlock in slot, whose lock is held
+static void fs_dcacheMarkBig(uint32_t slot, uint32_t dirBlock, uint32_t count)
+{
+    dcDir *old = dcSlots[slot];
+    dcDir *d = fs_dcacheDir(dirBlock, 0);
+    if (d != NULL)
+    {
+        d->count = count;
+        d->tooBig = 1;
+    }
+    __atomic_store_n(&dcSlots[slot], d, __ATOMIC_RELEASE);
+    if (old != NULL)
+        fs_dcacheRetire(&old->retired);
+}
+
+static dcDir *fs_dcacheOwn(uint32_t dirBlock, uint32_t *slot);
+
+// loads the chain of dirBlock and publishes it; the caller holds the
+// directory's node lock (shared is enough, writers are kept out).  -1
+// for a directory known to be too big, without reading it again
+int fs_dcacheFill(uint32_t dirBlock)
+{
+    DirBlock cur;
+    dcName *names = NULL;
+    uint32_t count = 0;
+    uint32_t curBlock = dirBlock;
+    uint32_t slot;
+    dcDir *known = fs_dcacheOwn(dirBlock, &slot);
+    if (known != NULL)
+    {
+        pthread_mutex_unlock(&dcSlotLocks[slot]);
+        return known->tooBig ? -1 : 0;
+    }
+    while (curBlock != 0 && count <= DCACHE_MAX_NAMES)
+    {
+        DirEntry e;
+        if (fs_loadDir(curBlock, &cur) != 0)
+            goto fail;
+        for (uint32_t i = 0; fs_dirBlockGet(&cur, i, &e) == 0; i++)
+        {
+            if (e.fileType == FT_UNUSED)
+                continue;
+            dcName *n = fs_dcacheName(&e);
+            if (n == NULL)
+                goto fail;
+            n->next = names;
+            names = n;
+            count++;
+        }
+        curBlock = cur.nextDirBlock;
+    }
+    if (count > DCACHE_MAX_NAMES)
+    {
+        pthread_mutex_lock(&dcSlotLocks[slot]);
+        if (dcSlots[slot] == NULL || dcSlots[slot]->dirBlock != dirBlock)
+            fs_dcacheMarkBig(slot, dirBlock, count);
+        pthread_mutex_unlock(&dcSlotLocks[slot]);
+        goto fail;
+    }
+    dcDir *d = fs_dcacheDir(dirBlock, count);
+    if (d == NULL)
+        goto fail;
+    while (names != NULL)
+    {
+        dcName *next = names->next;
+        fs_dcacheLink(d, names);
+        names = next;
+    }
+
+    pthread_mutex_lock(&dcSlotLocks[slot]);
+    dcDir *old = dcSlots[slot];
+    if (old != NULL && old->dirBlock == dirBlock)
+    {
+        // another reader filled it meanwhile
+        pthread_mutex_unlock(&dcSlotLocks[slot]);
+        fs_dcacheFree(&d->retired);
+        return 0;
+    }
+    __atomic_store_n(&dcSlots[slot], d, __ATOMIC_RELEASE);
+    if (old != NULL)
+        fs_dcacheRetire(&old->retired);
+    pthread_mutex_unlock(&dcSlotLocks[slot]);
+    return 0;
+
+fail:
+    while (names != NULL)
+    {
+        dcName *next = names->next;
+        free(names);
+        names = next;
+    }
+    return -1;
+}
+
+// the cached version of dirBlock with its slot locked, or NULL
+static dcDir *fs_dcacheOwn(uint32_t dirBlock, uint32_t *slot)
+{
+    *slot = fs_dcacheSlot(dirBlock);
+    pthread_once(&dcOnce, fs_dcacheInit);
+    pthread_mutex_lock(&dcSlotLocks[*slot]);
+    dcDir *d = dcSlots[*slot];
+    if (d != NULL && d->dirBlock == dirBlock)
+        return d;
+    pthread_mutex_unlock(&dcSlotLocks[*slot]);
+    return NULL;
+}
+
+// unpublishes the version in slot; its lock is held
+static void fs_dcacheDrop(uint32_t slot)
+{
+    dcDir *d = dcSlots[slot];
+    __atomic_store_n(&dcSlots[slot], NULL, __ATOMIC_RELEASE);
+    fs_dcacheRetire(&d->retired);
+}
+
+// publishes a copy of d with twice the buckets; d stays if memory is short
+static void fs_dcacheGrow(uint32_t slot, dcDir *d)
+{
+    dcDir *nd = fs_dcacheDir(d->dirBlock, (d->mask + 1) * 2);
+    if (nd == NULL)
+        return;
+    for (uint32_t i = 0; i <= d->mask; i++)
+    {
+        for (dcName *n = d->buckets[i]; n != NULL; n = n->next)
+        {
+            dcName *copy = malloc(sizeof(dcName) + n->nameLen + 1);
+            if (copy == NULL)
+            {
+                fs_dcacheFree(&nd->retired);
+                return;
+            }
+            memcpy(copy, n, sizeof(dcName) + n->nameLen + 1);
+            fs_dcacheLink(nd, copy);
+        }
+    }
+    __atomic_store_n(&dcSlots[slot], nd, __ATOMIC_RELEASE);
+    fs_dcacheRetire(&d->retired);
+}
+
+// entry was added to dirBlock or changed there (matched by name)
+void fs_dcacheAdd(uint32_t dirBlock, const DirEntry *entry)
+{
+    uint32_t slot;
+    dcDir *d = fs_dcacheOwn(dirBlock, &slot);
+    if (d == NULL)
+        return;
+    if (d->tooBig)
+    {
+        pthread_mutex_unlock(&dcSlotLocks[slot]);
+        return;
+    }
+    dcName *n = fs_dcacheName(entry);
+    if (n == NULL)
+    {
+        // cannot mirror the change, so stop answering for the directory
+        fs_dcacheDrop(slot);
+        pthread_mutex_unlock(&dcSlotLocks[slot]);
+        return;
+    }
+    dcName **pp = &d->buckets[n->hash & d->mask];
+    while (*pp != NULL &&
+           ((*pp)->hash != n->hash || (*pp)->nameLen != n->nameLen || memcmp((*pp)->name, n->name, n->nameLen) != 0))
+        pp = &(*pp)->next;
+    dcName *old = *pp;
+    if (old != NULL)
+    {
+        n->next = old->next;
+        __atomic_store_n(pp, n, __ATOMIC_RELEASE);
+        fs_dcacheRetire(&old->retired);
+    }
+    else
+    {
+        n->next = d->buckets[n->hash & d->mask];
+        __atomic_store_n(&d->buckets[n->hash & d->mask], n, __ATOMIC_RELEASE);
+        if (++d->count > DCACHE_MAX_NAMES)
+            fs_dcacheMarkBig(slot, dirBlock, d->count);
+        else if (d->count > 2 * (d->mask + 1))
+            fs_dcacheGrow(slot, d);
+    }
+    pthread_mutex_unlock(&dcSlotLocks[slot]);
+}
+
+// name left dirBlock
+void fs_dcacheRemove(uint32_t dirBlock, const char *name)
+{
+    uint32_t slot;
+    dcDir *d = fs_dcacheOwn(dirBlock, &slot);
+    if (d == NULL)
+        return;
+    if (d->tooBig)
+    {
+        // once well below the limit, the next lookup tries a fill again
+        if (--d->count <= DCACHE_MAX_NAMES / 2)
+            fs_dcacheDrop(slot);
+        pthread_mutex_unlock(&dcSlotLocks[slot]);
+        return;
+    }
+    size_t len = strlen(name);
+    uint32_t h = fs_nameHash(name, len);
+    dcName **pp = &d->buckets[h & d->mask];
+    while (*pp != NULL &&
+           ((*pp)->hash != h || (*pp)->nameLen != len || memcmp((*pp)->name, name, len) != 0))
+        pp = &(*pp)->next;
+    dcName *old = *pp;
+    if (old != NULL)
+    {
+        __atomic_store_n(pp, old->next, __ATOMIC_RELEASE);
+        fs_dcacheRetire(&old->retired);
+        d->count--;
+    }
+    pthread_mutex_unlock(&dcSlotLocks[slot]);
+}
+
+// dirBlock is gone or its on-disk change could not be mirrored
+void fs_dcacheForget(uint32_t dirBlock)
+{
+    uint32_t slot;
+    if (fs_dcacheOwn(dirBlock, &slot) == NULL)
+        return;
+    fs_dcacheDrop(slot);
+    pthread_mutex_unlock(&dcSlotLocks[slot]);
+}
+
+// forget every directory, the volume underneath changed
+void fs_dcacheReset(void)
+{
+    pthread_once(&dcOnce, fs_dcacheInit);
+    for (uint32_t i = 0; i < DCACHE_SLOTS; i++)
+    {
+        pthread_mutex_lock(&dcSlotLocks[i]);
+        if (dcSlots[i] != NULL)
+            fs_dcacheDrop(i);
+        pthread_mutex_unlock(&dcSlotLocks[i]);
+    }
+}
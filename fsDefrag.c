@@ -0,0 +1,335 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: fsDefrag.c
+ *
+ * Description:: Online defragmenter.  fs_defrag walks a tree and
+ *	measures every file in extents (runs of consecutive blocks) for
+ *	its number of blocks, and every directory by the runs of its
+ *	overflow chain.  The file threshold is given for a file of the
+ *	largest size (MAX_FILE_BLOCKS) and scales down with the file: with
+ *	no file over 60 KB a per MB measure would call any file in two
+ *	extents fragmented.  A file at or over it, and a chain in more than
+ *	one run, is copied into one freshly allocated extent with one
+ *	read per old run and one write per new one, then switched over by
+ *	rewriting the single block that points at it - the file header,
+ *	the directory head - and only then are the old blocks freed.  A
+ *	crash before that write leaves the old copy in place.
+ *
+ *	A file is moved with its directory and its header locked, after
+ *	checking the entry still names it; a directory with its head
+ *	locked, once the walk is past it.  Readers and writers wait out
+ *	the move; the head block of a directory, which the entries below
+ *	it refer to, never moves.
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fsLow.h"
+#include "fsStruct.h"
+#include "mfs.h"
+
+#define DEFRAG_MAX_EXTENTS 8 // default threshold for a file of MAX_FILE_BLOCKS
+
+#define DEFRAG_LEFT 1  // fragmented, not moved
+#define DEFRAG_MOVED 2
+
+typedef struct
+{
+    unsigned maxExtents;
+    int dryRun;
+    void (*report)(const char *path, uint32_t before, uint32_t after, uint32_t blocks, void *arg);
+    void *arg;
+    fs_defragstats stats;
+} defragRun;
+
+// runs of consecutive blocks in the list, 0 entries (holes) skipped
+static uint32_t fs_countExtents(const uint32_t *blocks, uint32_t n)
+{
+    uint32_t extents = 0, prev = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint32_t b = BLOCK_NUMBER(blocks[i]);
+        if (b == BLOCK_HOLE)
+            continue;
+        if (extents == 0 || b != prev + 1)
+            extents++;
+        prev = b;
+    }
+    return extents;
+}
+
+// writes the n images in buf to the blocks in to, one LBAwrite per run
+static int fs_writeRuns(const char *buf, const uint32_t *to, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; )
+    {
+        uint32_t run = 1;
+        while (i + run < n && to[i + run] == to[i] + run)
+            run++;
+        if (LBAwrite((void *)(buf + (size_t)i * BLOCK_SIZE), run, to[i]) != run)
+            return -1;
+        i += run;
+    }
+    return 0;
+}
+
+// reads the n blocks in from into buf, one LBAread per run
+static int fs_readRuns(char *buf, const uint32_t *from, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; )
+    {
+        uint32_t run = 1;
+        while (i + run < n && from[i + run] == from[i] + run)
+            run++;
+        if (LBAread(buf + (size_t)i * BLOCK_SIZE, run, from[i]) != run)
+            return -1;
+        i += run;
+    }
+    return 0;
+}
+
+// allocates n blocks near goal in fewer than extents runs; 0 if the free
+// space cannot do better
+static int fs_allocateBetter(uint32_t goal, uint32_t n, uint32_t extents, uint32_t *to)
+{
+    uint32_t got = fs_allocateExtent(goal, n, to);
+    if (got == n && fs_countExtents(to, n) < extents)
+        return 0;
+    fs_freeBlocks(to, got);
+    return -1;
+}
+
+// the entry named name in the chain of dirBlock, whose lock is held
+static int fs_defragLookup(uint32_t dirBlock, const char *name, DirEntry *entry)
+{
+    DirBlock cur;
+    for (uint32_t block = dirBlock; block != 0; block = cur.nextDirBlock)
+    {
+        if (fs_loadDir(block, &cur) != 0)
+            return -1;
+        if (fs_dirBlockFind(&cur, name, entry, NULL) == 0)
+            return 0;
+    }
+    return -1;
+}
+
+// moves the blocks of the file with header headerBlock, whose lock is
+// held, into one extent.  *before and *after get its extents, *blocks
+// its blocks.  Returns DEFRAG_MOVED, DEFRAG_LEFT (fragmented, but a dry
+// run or no better free space), 0 (not fragmented) or -1
+static int fs_defragFileLocked(uint32_t headerBlock, const defragRun *r,
+                               uint32_t *before, uint32_t *after, uint32_t *blocks)
+{
+    FileHeader fh;
+    uint32_t from[MAX_FILE_BLOCKS], to[MAX_FILE_BLOCKS];
+    uint32_t n = 0;
+    if (LBAread(&fh, 1, headerBlock) != 1 || fh.magic != FILEHEADER_MAGIC ||
+        fh.dataBlockCount > MAX_FILE_BLOCKS)
+        return -1;
+    for (uint32_t i = 0; i < fh.dataBlockCount; i++)
+    {
+        if (fh.dataBlocks[i] != BLOCK_HOLE)
+            from[n++] = BLOCK_NUMBER(fh.dataBlocks[i]);
+    }
+    uint32_t extents = fs_countExtents(from, n);
+    *before = *after = extents;
+    *blocks = n;
+    if (extents <= 1 || (uint64_t)extents * MAX_FILE_BLOCKS < (uint64_t)r->maxExtents * n)
+        return 0;
+    if (r->dryRun || fs_allocateBetter(headerBlock, n, extents, to) != 0)
+        return DEFRAG_LEFT;
+
+    // unwritten blocks are copied too, the copy is one sequential write
+    char *buf = malloc((size_t)n * BLOCK_SIZE);
+    if (buf == NULL || fs_readRuns(buf, from, n) != 0 || fs_writeRuns(buf, to, n) != 0)
+    {
+        free(buf);
+        fs_freeBlocks(to, n);
+        return -1;
+    }
+    free(buf);
+    for (uint32_t i = 0, k = 0; i < fh.dataBlockCount; i++)
+    {
+        if (fh.dataBlocks[i] != BLOCK_HOLE)
+            fh.dataBlocks[i] = to[k++] | (fh.dataBlocks[i] & BLOCK_UNWRITTEN);
+    }
+    if (LBAwrite(&fh, 1, headerBlock) != 1)
+    {
+        fs_freeBlocks(to, n);
+        return -1;
+    }
+    *after = fs_countExtents(to, n);
+    return (fs_freeBlocks(from, n) == 0) ? DEFRAG_MOVED : -1;
+}
+
+// moves the overflow chain of the directory headed by dirBlock, whose
+// lock is held, into one extent behind the head; like fs_defragFileLocked
+static int fs_defragDirLocked(uint32_t dirBlock, const defragRun *r,
+                              uint32_t *before, uint32_t *after, uint32_t *blocks)
+{
+    DirBlock head;
+    DirBlock *chain = NULL;
+    uint32_t *from = NULL, *to = NULL;
+    uint32_t n = 0, cap = 0;
+    int rc = -1;
+    if (fs_loadDir(dirBlock, &head) != 0)
+        return -1;
+    for (uint32_t block = head.nextDirBlock; block != 0; block = chain[n - 1].nextDirBlock)
+    {
+        if (n == cap)
+        {
+            cap = cap ? cap * 2 : 16;
+            DirBlock *grownChain = realloc(chain, cap * sizeof(DirBlock));
+            if (grownChain != NULL)
+                chain = grownChain;
+            uint32_t *grownFrom = realloc(from, cap * sizeof(uint32_t));
+            if (grownFrom != NULL)
+                from = grownFrom;
+            if (grownChain == NULL || grownFrom == NULL)
+                goto out;
+        }
+        if (fs_loadDir(block, &chain[n]) != 0)
+            goto out;
+        from[n++] = block;
+    }
+    uint32_t extents = fs_countExtents(from, n);
+    *before = *after = extents;
+    *blocks = n;
+    rc = 0;
+    if (extents <= 1)
+        goto out;
+    rc = DEFRAG_LEFT;
+    to = malloc(n * sizeof(uint32_t));
+    // an open stream may go on into the old blocks
+    if (r->dryRun || to == NULL || fs_dirStreaming(dirBlock) ||
+        fs_allocateBetter(dirBlock, n, extents, to) != 0)
+        goto out;
+    rc = -1;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        chain[i].prevDirBlock = (i == 0) ? dirBlock : to[i - 1];
+        chain[i].nextDirBlock = (i + 1 < n) ? to[i + 1] : 0;
+        if (head.holeBlock == from[i])
+            head.holeBlock = to[i];
+    }
+    if (fs_writeRuns((const char *)chain, to, n) != 0)
+    {
+        fs_freeBlocks(to, n);
+        goto out;
+    }
+    head.nextDirBlock = to[0];
+    head.tailBlock = to[n - 1];
+    if (fs_storeDir(dirBlock, &head) != 0)
+    {
+        fs_freeBlocks(to, n);
+        goto out;
+    }
+    *after = fs_countExtents(to, n);
+    rc = (fs_freeBlocks(from, n) == 0) ? DEFRAG_MOVED : -1;
+out:
+    free(chain);
+    free(from);
+    free(to);
+    return rc;
+}
+
+static void fs_defragCount(defragRun *r, const fs_walkentry *we, int rc,
+                           uint32_t before, uint32_t after, uint32_t blocks)
+{
+    if (rc < 0)
+        printf("Failed to defragment %s\n", we->path);
+    r->stats.extentsBefore += before;
+    r->stats.extentsAfter += after;
+    if (rc == DEFRAG_LEFT || rc == DEFRAG_MOVED)
+    {
+        r->stats.fragmented++;
+        if (r->report != NULL)
+            r->report(we->path, before, after, blocks, r->arg);
+    }
+    if (rc == DEFRAG_MOVED)
+    {
+        r->stats.moved++;
+        r->stats.blocksMoved += blocks;
+    }
+}
+
+static int fs_defragVisit(const fs_walkentry *we, void *arg)
+{
+    defragRun *r = arg;
+    DirEntry e;
+    uint32_t headerBlock = FS_WALKITEM(we)->entry->startBlock;
+    uint32_t dirBlock = FS_WALKITEM(we)->parentBlock;
+    uint32_t before = 0, after = 0, blocks = 0;
+    int rc = 0;
+    if (FS_WALKITEM(we)->entry->fileType != FT_FILE)
+        return 0;
+    r->stats.files++;
+    if (headerBlock == 0 || dirBlock == 0)
+        return 0; // no blocks yet
+    fs_treeLockShared();
+    fs_nodeWriteLock2(dirBlock, headerBlock);
+    // the file may have been removed or replaced since the walk saw it
+    if (fs_defragLookup(dirBlock, we->name, &e) == 0 &&
+        e.fileType == FT_FILE && e.startBlock == headerBlock)
+        rc = fs_defragFileLocked(headerBlock, r, &before, &after, &blocks);
+    fs_nodeUnlock2(dirBlock, headerBlock);
+    fs_treeUnlock();
+    fs_defragCount(r, we, rc, before, after, blocks);
+    return 0;
+}
+
+// a directory is moved once all of it was walked
+static int fs_defragPost(const fs_walkentry *we, void *arg)
+{
+    defragRun *r = arg;
+    DirEntry e;
+    uint32_t parentBlock = FS_WALKITEM(we)->parentBlock;
+    uint32_t dirBlock = FS_WALKITEM(we)->entry->startBlock;
+    uint32_t before = 0, after = 0, blocks = 0;
+    int rc = 0;
+    r->stats.dirs++;
+    fs_treeLockShared();
+    // removing or moving a directory takes the tree lock exclusively, so
+    // once the entry checks out it stays
+    if (parentBlock == 0 ||
+        (fs_findInDir(parentBlock, we->name, &e, NULL) == 0 &&
+         e.fileType == FT_DIR && e.startBlock == dirBlock))
+    {
+        fs_nodeWriteLock(dirBlock);
+        rc = fs_defragDirLocked(dirBlock, r, &before, &after, &blocks);
+        fs_nodeUnlock(dirBlock);
+    }
+    fs_treeUnlock();
+    fs_defragCount(r, we, rc, before, after, blocks);
+    return 0;
+}
+
+int fs_defrag(const char *pathname, const fs_defragopts *opts, fs_defragstats *stats)
+{
+    defragRun r;
+    if (pathname == NULL)
+        return -1;
+    memset(&r, 0, sizeof(r));
+    if (opts != NULL)
+    {
+        r.maxExtents = opts->maxExtents;
+        r.dryRun = opts->dryRun;
+        r.report = opts->report;
+        r.arg = opts->arg;
+    }
+    if (r.maxExtents == 0)
+        r.maxExtents = DEFRAG_MAX_EXTENTS;
+    fs_walkops ops = {NULL, fs_defragVisit, fs_defragPost, &r, 0};
+    int rc = fs_walk(pathname, &ops);
+    if (stats != NULL)
+        *stats = r.stats;
+    return rc;
+}
@@ -16,12 +16,107 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include "fsLow.h"
 #include "mfs.h"
 #include "fsStruct.h"
 
+// guards g_currentPath; fs_setcwd and fs_getcwd hold it while they walk
+// the tree, so it is taken before the tree lock
+static pthread_mutex_t cwdLock = PTHREAD_MUTEX_INITIALIZER;
+
+// directories held by open fdDirHandles and fdDir streams, with counts
+// per directory.  A handle is pinned under the tree lock, which rmdir
+// holds exclusive when it checks; a stream under its directory's lock,
+// which anything freeing blocks of the chain holds when it checks
+typedef struct {
+    uint32_t dirBlock;
+    uint32_t handles;
+    uint32_t streams;
+} DirPin;
+static pthread_mutex_t pinLock = PTHREAD_MUTEX_INITIALIZER;
+static DirPin *pins = NULL;
+static uint32_t pinCount = 0, pinCap = 0;
+
+static int fs_pinDir(uint32_t dirBlock, int stream) {
+    int rc = 0;
+    pthread_mutex_lock(&pinLock);
+    uint32_t i = 0;
+    while (i < pinCount && pins[i].dirBlock != dirBlock) i++;
+    if (i == pinCount) {
+        if (pinCount == pinCap) {
+            uint32_t cap = pinCap ? pinCap * 2 : 16;
+            DirPin *grown = realloc(pins, cap * sizeof(DirPin));
+            if (grown != NULL) {
+                pins = grown;
+                pinCap = cap;
+            }
+        }
+        if (pinCount < pinCap) {
+            pins[pinCount].dirBlock = dirBlock;
+            pins[pinCount].handles = 0;
+            pins[pinCount].streams = 0;
+            pinCount++;
+        } else {
+            printf("Failed to allocate directory pin\n");
+            rc = -1;
+        }
+    }
+    if (rc == 0) {
+        if (stream) pins[i].streams++;
+        else pins[i].handles++;
+    }
+    pthread_mutex_unlock(&pinLock);
+    return rc;
+}
+
+static void fs_unpinDir(uint32_t dirBlock, int stream) {
+    pthread_mutex_lock(&pinLock);
+    for (uint32_t i = 0; i < pinCount; i++) {
+        if (pins[i].dirBlock == dirBlock) {
+            if (stream) pins[i].streams--;
+            else pins[i].handles--;
+            if (pins[i].handles == 0 && pins[i].streams == 0) pins[i] = pins[--pinCount];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pinLock);
+}
+
+int fs_dirBusy(uint32_t dirBlock) {
+    if (dirBlock == __atomic_load_n(&g_cwdBlock, __ATOMIC_ACQUIRE)) return 1;
+    int busy = 0;
+    pthread_mutex_lock(&pinLock);
+    for (uint32_t i = 0; i < pinCount && !busy; i++) busy = (pins[i].dirBlock == dirBlock);
+    pthread_mutex_unlock(&pinLock);
+    return busy;
+}
+
+int fs_dirStreaming(uint32_t dirBlock) {
+    int streaming = 0;
+    pthread_mutex_lock(&pinLock);
+    for (uint32_t i = 0; i < pinCount && !streaming; i++)
+        streaming = (pins[i].dirBlock == dirBlock && pins[i].streams > 0);
+    pthread_mutex_unlock(&pinLock);
+    return streaming;
+}
+
+// block of the directory pathname names, 0 if there is none; the caller
+// holds the tree lock
+static uint32_t fs_dirBlockOf(uint32_t atBlock, const char *pathname) {
+    uint32_t dirBlock = 0; char name[MAX_FILENAME_LEN+1];
+    if (fs_resolvePathAt(atBlock, pathname, &dirBlock, name, sizeof(name)) != 0) return 0;
+    if (name[0] != '\0') {
+        DirEntry e;
+        if (fs_findInDir(dirBlock, name, &e, NULL) != 0 || e.fileType != FT_DIR) return 0;
+        dirBlock = e.startBlock;
+    }
+    return dirBlock;
+}
+
 // create directory
 int fs_mkdir(const char *pathname, mode_t mode) {
+    (void)mode; // no permissions are kept
     if (pathname == NULL) {
         return -1;
     }
@@ -71,6 +166,22 @@ int fs_rmdir(const char *pathname) {
     return 0;
 }
 
+// pack a directory and free its unneeded blocks
+int fs_compactdir(const char *pathname) {
+    if (pathname == NULL) {
+        return -1;
+    }
+
+    fs_treeLockShared();
+    uint32_t dirBlock = fs_dirBlockOf(0, pathname);
+    int result = (dirBlock != 0) ? fs_compactDir(dirBlock) : -1;
+    fs_treeUnlock();
+
+    return result;
+}
+
+static fdDir * fs_opendirBlock(uint32_t dirBlock);
+
 // open directory
 fdDir * fs_opendir(const char *pathname) {
     if (pathname == NULL) {
@@ -80,34 +191,69 @@ fdDir * fs_opendir(const char *pathname) {
     printf("Opening directory: %s\n", pathname);
     
     // resolve dir block
-    uint32_t dirBlock = 0; char name[MAX_FILENAME_LEN+1];
-    if (fs_resolvePath(pathname, &dirBlock, name, sizeof(name)) != 0) return NULL;
-    if (name[0] != '\0') {
-        DirEntry e; if (fs_findInDir(dirBlock, name, &e, NULL) != 0) return NULL; if (e.fileType != FT_DIR) return NULL; dirBlock = e.startBlock;
-    }
+    fs_treeLockShared();
+    uint32_t dirBlock = fs_dirBlockOf(0, pathname);
+    fdDir *dirp = (dirBlock != 0) ? fs_opendirBlock(dirBlock) : NULL;
+    fs_treeUnlock();
     
+    return dirp;
+}
+
+// directory descriptor over an already resolved directory block
+static fdDir * fs_opendirBlock(uint32_t dirBlock) {
     // allocate directory descriptor
     fdDir *dirp = malloc(sizeof(fdDir));
     if (dirp == NULL) return NULL;
     dirp->d_reclen = sizeof(struct fs_diriteminfo);
     dirp->dirEntryPosition = 0;
+    dirp->headDirBlock = dirBlock;
     dirp->currentDirBlock = dirBlock;
-    fs_loadDir(dirp->currentDirBlock, &dirp->cachedDir);
+    // while the stream is open no block of the chain is freed, so the
+    // next block it follows is still one of the directory's
+    fs_treeLockShared();
+    fs_nodeReadLock(dirBlock);
+    int rc = fs_pinDir(dirBlock, 1);
+    if (rc == 0) fs_loadDir(dirp->currentDirBlock, &dirp->cachedDir);
+    fs_nodeUnlock(dirBlock);
+    fs_treeUnlock();
+    if (rc != 0) {
+        free(dirp);
+        return NULL;
+    }
     dirp->di = NULL;
+    dirp->dip = NULL;
     return dirp;
 }
 
+// advance to the next entry of the cached directory block chain,
+// stepping over tombstones
+static DirEntry *fs_nextDirEntry(fdDir *dirp) {
+    do {
+        // if need next block
+        while (dirp->dirEntryPosition >= dirp->cachedDir.entryCount) {
+            if (dirp->cachedDir.nextDirBlock == 0) return NULL;
+            dirp->currentDirBlock = dirp->cachedDir.nextDirBlock;
+            fs_treeLockShared();
+            fs_nodeReadLock(dirp->headDirBlock);
+            int rc = fs_loadDir(dirp->currentDirBlock, &dirp->cachedDir);
+            fs_nodeUnlock(dirp->headDirBlock);
+            fs_treeUnlock();
+            if (rc != 0) return NULL;
+            dirp->dirEntryPosition = 0;
+        }
+        if (fs_dirBlockGet(&dirp->cachedDir, dirp->dirEntryPosition++, &dirp->currentEntry) != 0) return NULL;
+    } while (dirp->currentEntry.fileType == FT_UNUSED);
+    return &dirp->currentEntry;
+}
+
 // read directory entry
 struct fs_diriteminfo *fs_readdir(fdDir *dirp) {
     if (dirp == NULL) {
         return NULL;
     }
-    // if need next block
-    while (dirp->dirEntryPosition >= dirp->cachedDir.entryCount) {
-        if (dirp->cachedDir.nextDirBlock == 0) return NULL;
-        dirp->currentDirBlock = dirp->cachedDir.nextDirBlock;
-        if (fs_loadDir(dirp->currentDirBlock, &dirp->cachedDir) != 0) return NULL;
-        dirp->dirEntryPosition = 0;
+    DirEntry *entry = fs_nextDirEntry(dirp);
+    if (entry == NULL) {
+        return NULL;
     }
     
     // allocate directory entry info structure
@@ -119,21 +265,44 @@ struct fs_diriteminfo *fs_readdir(fdDir *dirp) {
         }
     }
     
-    // get directory entry
-    DirEntry *entry = &dirp->cachedDir.entries[dirp->dirEntryPosition];
-    
     // fill directory entry info
     dirp->di->d_reclen = sizeof(struct fs_diriteminfo);
     dirp->di->fileType = (entry->fileType == FT_DIR) ? FT_DIRECTORY : FT_REGFILE;
-    strncpy(dirp->di->d_name, entry->filename, 255);
-    dirp->di->d_name[255] = '\0';
-    
-    // move to next entry
-    dirp->dirEntryPosition++;
+    snprintf(dirp->di->d_name, sizeof(dirp->di->d_name), "%s", entry->filename);
     
     return dirp->di;
 }
 
+// read directory entry together with its attributes, straight from the
+// cached DirBlock (b_io stores the entry's fileSize whenever a write changes it)
+struct fs_diriteminfoplus *fs_readdirplus(fdDir *dirp) {
+    if (dirp == NULL) {
+        return NULL;
+    }
+    DirEntry *entry = fs_nextDirEntry(dirp);
+    if (entry == NULL) {
+        return NULL;
+    }
+    if (dirp->dip == NULL) {
+        dirp->dip = malloc(sizeof(struct fs_diriteminfoplus));
+        if (dirp->dip == NULL) {
+            printf("Failed to allocate memory for directory item info\n");
+            return NULL;
+        }
+    }
+    
+    struct fs_diriteminfoplus *dip = dirp->dip;
+    dip->d_reclen = sizeof(struct fs_diriteminfoplus);
+    dip->fileType = (entry->fileType == FT_DIR) ? FT_DIRECTORY : FT_REGFILE;
+    snprintf(dip->d_name, sizeof(dip->d_name), "%s", entry->filename);
+    dip->st_size = (entry->fileType == FT_FILE) ? (off_t)entry->fileSize : 0;
+    dip->st_blocks = (dip->st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    dip->st_modtime = entry->modifyTime;
+    dip->st_createtime = entry->createTime;
+    
+    return dip;
+}
+
 // close directory
 int fs_closedir(fdDir *dirp) {
     if (dirp == NULL) {
@@ -147,26 +316,88 @@ int fs_closedir(fdDir *dirp) {
         free(dirp->di);
         dirp->di = NULL;
     }
+    if (dirp->dip != NULL) {
+        free(dirp->dip);
+        dirp->dip = NULL;
+    }
     
+    fs_unpinDir(dirp->headDirBlock, 1);
     free(dirp);
     
     return 0;
 }
 
+// copies the name dirBlock has in its parent parentBlock
+static int fs_nameInDir(uint32_t parentBlock, uint32_t dirBlock, char *name, size_t size) {
+    DirBlock d;
+    DirEntry e;
+    int rc = -1;
+    fs_nodeReadLock(parentBlock);
+    for (uint32_t b = parentBlock; rc != 0 && b != 0 && fs_loadDir(b, &d) == 0; b = d.nextDirBlock) {
+        for (uint32_t i = 0; i < d.entryCount; i++) {
+            if (fs_dirBlockGet(&d, i, &e) == 0 && e.fileType == FT_DIR && e.startBlock == dirBlock &&
+                strcmp(e.filename, ".") != 0 && strcmp(e.filename, "..") != 0) {
+                snprintf(name, size, "%s", e.filename);
+                rc = 0;
+                break;
+            }
+        }
+    }
+    fs_nodeUnlock(parentBlock);
+    return rc;
+}
+
+// the canonical path of the directory dirBlock, put together going up
+// its ".." entries to the root; the tree lock is held, so none of the
+// directories on the way moves meanwhile.  path is left alone on error
+static int fs_dirPath(uint32_t dirBlock, char *path, size_t size) {
+    char buf[MAX_PATH_LEN];
+    char name[MAX_FILENAME_LEN+1];
+    size_t start = sizeof(buf) - 1;
+    buf[start] = '\0';
+    for (uint32_t cur = dirBlock; cur != (uint32_t)g_superBlock.rootDirBlock; ) {
+        DirEntry parent;
+        if (fs_findInDir(cur, "..", &parent, NULL) != 0 ||
+            fs_nameInDir(parent.startBlock, cur, name, sizeof(name)) != 0) {
+            return -1;
+        }
+        size_t len = strlen(name);
+        if (len + 1 > start) return -1;
+        start -= len;
+        memcpy(buf + start, name, len);
+        buf[--start] = '/';
+        cur = parent.startBlock;
+    }
+    if (buf[start] == '\0') buf[--start] = '/';
+    snprintf(path, size, "%s", buf + start);
+    return 0;
+}
+
 // get current working directory
 char * fs_getcwd(char *pathname, size_t size) {
     if (pathname == NULL || size == 0) {
         return NULL;
     }
     
-    // simplified implementation: always return root directory
+    // the path is rebuilt from the cwd block: a rename of the cwd or of
+    // a directory above it leaves the one stored behind
+    pthread_mutex_lock(&cwdLock);
+    fs_treeLockShared();
+    fs_dirPath(__atomic_load_n(&g_cwdBlock, __ATOMIC_ACQUIRE), g_currentPath, sizeof(g_currentPath));
+    fs_treeUnlock();
     strncpy(pathname, g_currentPath, size - 1);
+    pthread_mutex_unlock(&cwdLock);
     pathname[size - 1] = '\0';
     
     return pathname;
 }
 
+static int fs_setcwdLocked(const char *pathname);
+
 // set current working directory
+// the cwd is kept as its resolved directory block (where relative lookups
+// start) plus its canonical path, rebuilt from the block here and by
+// fs_getcwd
 int fs_setcwd(char * pathname) {
     if (pathname == NULL) {
         return -1;
@@ -174,27 +405,45 @@ int fs_setcwd(char * pathname) {
     
     printf("Changing directory to: %s\n", pathname);
     
-    // simplified implementation: only support root directory
-    if (strcmp(pathname, "/") == 0 || strcmp(pathname, ".") == 0) {
-        strcpy(g_currentPath, "/");
-        return 0;
-    }
+    pthread_mutex_lock(&cwdLock);
+    fs_treeLockShared();
+    int result = fs_setcwdLocked(pathname);
+    fs_treeUnlock();
+    pthread_mutex_unlock(&cwdLock);
     
-    // check if directory exists
-    DirEntry entry;
-    if (fs_findFile(pathname, &entry) != 0) {
+    return result;
+}
+
+// fs_setcwd holding the cwd and tree locks
+static int fs_setcwdLocked(const char *pathname) {
+    // resolve the directory block, ".." goes through the stored parent entry
+    uint32_t dirBlock = 0; char name[MAX_FILENAME_LEN+1];
+    if (fs_resolvePath(pathname, &dirBlock, name, sizeof(name)) != 0) {
         printf("Directory not found: %s\n", pathname);
         return -1;
     }
+    if (name[0] != '\0') {
+        DirEntry entry;
+        if (fs_findInDir(dirBlock, name, &entry, NULL) != 0) {
+            printf("Directory not found: %s\n", pathname);
+            return -1;
+        }
+        if (entry.fileType != FT_DIR) {
+            printf("Not a directory: %s\n", pathname);
+            return -1;
+        }
+        dirBlock = entry.startBlock;
+    }
     
-    if (entry.fileType != FT_DIR) {
-        printf("Not a directory: %s\n", pathname);
+    // canonical path, from the directory itself
+    char newPath[MAX_PATH_LEN];
+    if (fs_dirPath(dirBlock, newPath, sizeof(newPath)) != 0) {
+        printf("Directory not found: %s\n", pathname);
         return -1;
     }
     
-    // update current path
-    strncpy(g_currentPath, pathname, MAX_PATH_LEN - 1);
-    g_currentPath[MAX_PATH_LEN - 1] = '\0';
+    __atomic_store_n(&g_cwdBlock, dirBlock, __ATOMIC_RELEASE);
+    strcpy(g_currentPath, newPath);
     
     return 0;
 }
@@ -204,19 +453,9 @@ int fs_isFile(char * filename) {
     if (filename == NULL) {
         return 0;
     }
-    // resolve relative to current path if needed
-    char pathbuf[MAX_PATH_LEN];
-    if (filename[0] == '/') {
-        strncpy(pathbuf, filename, sizeof(pathbuf)-1);
-        pathbuf[sizeof(pathbuf)-1] = '\0';
-    } else {
-        if (strcmp(g_currentPath, "/") == 0)
-            snprintf(pathbuf, sizeof(pathbuf), "/%s", filename);
-        else
-            snprintf(pathbuf, sizeof(pathbuf), "%s/%s", g_currentPath, filename);
-    }
+    // relative names resolve from the cwd block
     DirEntry entry;
-    if (fs_findFile(pathbuf, &entry) != 0) {
+    if (fs_findFile(filename, &entry) != 0) {
         return 0; // file does not exist
     }
     
@@ -228,18 +467,8 @@ int fs_isDir(char * pathname) {
     if (pathname == NULL) {
         return 0;
     }
-    char pathbuf[MAX_PATH_LEN];
-    if (pathname[0] == '/') {
-        strncpy(pathbuf, pathname, sizeof(pathbuf)-1);
-        pathbuf[sizeof(pathbuf)-1] = '\0';
-    } else {
-        if (strcmp(g_currentPath, "/") == 0)
-            snprintf(pathbuf, sizeof(pathbuf), "/%s", pathname);
-        else
-            snprintf(pathbuf, sizeof(pathbuf), "%s/%s", g_currentPath, pathname);
-    }
     DirEntry entry;
-    if (fs_findFile(pathbuf, &entry) != 0) {
+    if (fs_findFile(pathname, &entry) != 0) {
         return 0; // directory does not exist
     }
     
@@ -272,39 +501,290 @@ int fs_delete(char* filename) {
 }
 
 // get file statistics
+// fill statistics info - the directory entry holds the file's size:
+// b_io stores its header's size there whenever that changes, under the
+// file's lock, and a truncate its new one, so no FileHeader read is needed
+static void fs_fillStat(const DirEntry *entry, struct fs_stat *buf) {
+    uint64_t size = (entry->fileType == FT_FILE) ? entry->fileSize : 0;
+    buf->st_size = (off_t)size;
+    buf->st_blksize = BLOCK_SIZE;
+    buf->st_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE; // calculate block count
+    buf->st_accesstime = entry->modifyTime; // use modify time as access time
+    buf->st_modtime = entry->modifyTime;
+    buf->st_createtime = entry->createTime;
+}
+
 int fs_stat(const char *filename, struct fs_stat *buf) {
     if (filename == NULL || buf == NULL) {
         return -1;
     }
-    char pathbuf[MAX_PATH_LEN];
-    if (filename[0] == '/') {
-        strncpy(pathbuf, filename, sizeof(pathbuf)-1);
-        pathbuf[sizeof(pathbuf)-1] = '\0';
-    } else {
-        if (strcmp(g_currentPath, "/") == 0)
-            snprintf(pathbuf, sizeof(pathbuf), "/%s", filename);
-        else
-            snprintf(pathbuf, sizeof(pathbuf), "%s/%s", g_currentPath, filename);
-    }
     // find file
     DirEntry entry;
-    if (fs_findFile(pathbuf, &entry) != 0) {
+    if (fs_findFile(filename, &entry) != 0) {
         return -1;
     }
     
-    // fill statistics info
-    uint64_t size = entry.fileSize;
-    if (entry.fileType == FT_FILE && entry.startBlock != 0) {
-        FileHeader fh; if (LBAread(&fh, 1, entry.startBlock) == 1 && fh.magic == FILEHEADER_MAGIC) {
-            size = fh.fileSize;
+    fs_fillStat(&entry, buf);
+    return 0;
+}
+
+// one path of an fs_statv batch
+typedef struct {
+    int index;                  // position in the caller's arrays
+    char *path;                 // normalized copy of the path
+    uint32_t base;              // block it resolves from: the root, or the cwd
+    char *parent;               // parent directory path from base ("" for base)
+    char *name;                 // last component
+    uint32_t dirBlock;          // resolved parent directory, 0 if unresolved
+    int found;
+} statvItem;
+
+static int fs_statvByParent(const void *a, const void *b) {
+    const statvItem *x = *(const statvItem * const *)a;
+    const statvItem *y = *(const statvItem * const *)b;
+    if (x->base != y->base) return x->base < y->base ? -1 : 1;
+    int c = strcmp(x->parent, y->parent);
+    return c != 0 ? c : x->index - y->index;
+}
+
+static int fs_statvByBlock(const void *a, const void *b) {
+    const statvItem *x = *(const statvItem * const *)a;
+    const statvItem *y = *(const statvItem * const *)b;
+    if (x->dirBlock != y->dirBlock) return x->dirBlock < y->dirBlock ? -1 : 1;
+    return x->index - y->index;
+}
+
+// split a path into parent and name in place, squeezing repeated and
+// trailing slashes the same way fs_resolvePath skips them.  A relative
+// path's parent is relative to the cwd, "" for a name right in it
+static int fs_statvSplit(char *path, statvItem *item) {
+    char *w = path;
+    for (char *r = path; *r; r++) {
+        if (*r == '/' && w > path && w[-1] == '/') continue;
+        *w++ = *r;
+    }
+    while (w > path + 1 && w[-1] == '/') w--;
+    *w = '\0';
+    char *slash = strrchr(path, '/');
+    if (path[0] == '\0' || (slash != NULL && slash[1] == '\0')) return -1; // root has no DirEntry
+    if (slash == NULL) {
+        item->parent = w; // ""
+        item->name = path;
+    } else {
+        *slash = '\0';
+        item->parent = (path[0] == '/') ? path + 1 : path;
+        item->name = slash + 1;
+    }
+    if (strlen(item->name) > MAX_FILENAME_LEN) return -1;
+    return 0;
+}
+
+// stat many paths in one call: the paths are sorted by parent directory so
+// neighbours share the already resolved prefix, then the lookups are grouped
+// by directory block and issued in LBA order, scanning each chain once
+int fs_statv(const char *paths[], int n, struct fs_stat out[], int status[]) {
+    if (paths == NULL || out == NULL || n < 0) {
+        return -1;
+    }
+    if (n == 0) return 0;
+    
+    statvItem *items = calloc((size_t)n, sizeof(statvItem));
+    statvItem **order = malloc((size_t)n * sizeof(statvItem *));
+    uint32_t *blocks = malloc((MAX_PATH_LEN / 2 + 1) * sizeof(uint32_t));
+    if (items == NULL || order == NULL || blocks == NULL) {
+        printf("Failed to allocate memory for fs_statv\n");
+        free(items); free(order); free(blocks);
+        return -1;
+    }
+    
+    // relative paths resolve from the cwd's block, like fs_resolvePath;
+    // the cwd cannot be removed while it is the cwd
+    uint32_t root = (uint32_t)g_superBlock.rootDirBlock;
+    uint32_t cwd = __atomic_load_n(&g_cwdBlock, __ATOMIC_ACQUIRE);
+    if (cwd == 0) cwd = root;
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        if (status) status[i] = -1;
+        items[i].index = i;
+        if (paths[i] == NULL) continue;
+        items[i].base = (paths[i][0] == '/') ? root : cwd;
+        items[i].path = strdup(paths[i]);
+        if (items[i].path == NULL || fs_statvSplit(items[i].path, &items[i]) != 0) continue;
+        order[count++] = &items[i];
+    }
+    
+    // resolve the parent directories, reusing the blocks of the components
+    // shared with the previous parent from the same base (blocks[k] is the
+    // block after k names)
+    qsort(order, count, sizeof(statvItem *), fs_statvByParent);
+    fs_treeLockShared();
+    const char *prev = NULL;
+    int prevDepth = 0;      // components of prev that resolved
+    uint32_t prevBlock = 0;
+    for (int k = 0; k < count; k++) {
+        statvItem *item = order[k];
+        if (k > 0 && order[k - 1]->base != item->base) prev = NULL;
+        if (prev != NULL && strcmp(prev, item->parent) == 0) {
+            item->dirBlock = prevBlock;
+            continue;
+        }
+        // skip the leading components already resolved for prev
+        int depth = 0;
+        const char *p = item->parent;
+        const char *q = prev;
+        blocks[0] = item->base;
+        while (q != NULL && depth < prevDepth) {
+            size_t lp = strcspn(p, "/"), lq = strcspn(q, "/");
+            if (lp == 0 || lp != lq || memcmp(p, q, lp) != 0) break;
+            depth++;
+            p += lp; if (*p == '/') p++;
+            q += lq; if (*q == '/') q++;
         }
+        int failed = 0;
+        while (*p) {
+            char comp[MAX_FILENAME_LEN + 1];
+            size_t len = strcspn(p, "/");
+            if (len > MAX_FILENAME_LEN) { failed = 1; break; }
+            memcpy(comp, p, len);
+            comp[len] = '\0';
+            DirEntry e;
+            if (fs_findInDir(blocks[depth], comp, &e, NULL) != 0 || e.fileType != FT_DIR) {
+                failed = 1;
+                break;
+            }
+            blocks[++depth] = e.startBlock;
+            p += len;
+            if (*p == '/') p++;
+        }
+        prev = item->parent;
+        prevDepth = depth;
+        prevBlock = failed ? 0 : blocks[depth];
+        item->dirBlock = prevBlock;
+    }
+    
+    // look the names up by directory in LBA order, one pass per chain
+    int ready = 0;
+    for (int k = 0; k < count; k++) {
+        if (order[k]->dirBlock != 0) order[ready++] = order[k];
+    }
+    qsort(order, ready, sizeof(statvItem *), fs_statvByBlock);
+    int done = 0;
+    DirBlock cur;
+    for (int k = 0; k < ready; ) {
+        int end = k;
+        while (end < ready && order[end]->dirBlock == order[k]->dirBlock) end++;
+        int left = end - k;
+        uint32_t curBlock = order[k]->dirBlock;
+        fs_nodeReadLock(order[k]->dirBlock);
+        while (curBlock != 0 && left > 0) {
+            if (fs_loadDir(curBlock, &cur) != 0) break;
+            for (int m = k; m < end && left > 0; m++) {
+                statvItem *item = order[m];
+                DirEntry e;
+                if (item->found || fs_dirBlockFind(&cur, item->name, &e, NULL) != 0) continue;
+                fs_fillStat(&e, &out[item->index]);
+                if (status) status[item->index] = 0;
+                item->found = 1;
+                left--;
+                done++;
+            }
+            curBlock = cur.nextDirBlock;
+        }
+        fs_nodeUnlock(order[k]->dirBlock);
+        k = end;
+    }
+    fs_treeUnlock();
+    
+    for (int i = 0; i < n; i++) free(items[i].path);
+    free(items); free(order); free(blocks);
+    return done;
+}
+
+// start block of an *at call; a NULL handle resolves like the plain calls
+static uint32_t fs_atBlock(fdDirHandle *dh) {
+    return (dh != NULL) ? dh->dirBlock : 0;
+}
+
+// open a directory handle; later *at calls resolve from its block
+fdDirHandle * fs_opendirh(fdDirHandle *dh, const char *pathname) {
+    if (pathname == NULL) {
+        return NULL;
     }
-    buf->st_size = (off_t)size;
-    buf->st_blksize = BLOCK_SIZE;
-    buf->st_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE; // calculate block count
-    buf->st_accesstime = entry.modifyTime; // use modify time as access time
-    buf->st_modtime = entry.modifyTime;
-    buf->st_createtime = entry.createTime;
     
+    fdDirHandle *handle = malloc(sizeof(fdDirHandle));
+    if (handle == NULL) {
+        printf("Failed to allocate directory handle\n");
+        return NULL;
+    }
+    // pinned before the tree lock is dropped, so it cannot be removed
+    // between the lookup and the pin
+    fs_treeLockShared();
+    uint32_t dirBlock = fs_dirBlockOf(fs_atBlock(dh), pathname);
+    if (dirBlock != 0 && fs_pinDir(dirBlock, 0) != 0) dirBlock = 0;
+    fs_treeUnlock();
+    if (dirBlock == 0) {
+        free(handle);
+        return NULL;
+    }
+    handle->dirBlock = dirBlock;
+    return handle;
+}
+
+int fs_closedirh(fdDirHandle *dh) {
+    if (dh == NULL) {
+        return -1;
+    }
+    fs_unpinDir(dh->dirBlock, 0);
+    free(dh);
     return 0;
 }
+
+// iterate the directory of a handle with fs_readdir / fs_readdirplus
+fdDir * fs_fdopendir(fdDirHandle *dh) {
+    if (dh == NULL) {
+        return NULL;
+    }
+    return fs_opendirBlock(dh->dirBlock);
+}
+
+b_io_fd fs_openat(fdDirHandle *dh, const char *pathname, int flags) {
+    if (pathname == NULL) {
+        return -1;
+    }
+    return b_openAt(fs_atBlock(dh), (char *)pathname, flags);
+}
+
+int fs_statat(fdDirHandle *dh, const char *pathname, struct fs_stat *buf) {
+    if (pathname == NULL || buf == NULL) {
+        return -1;
+    }
+    DirEntry entry;
+    if (fs_findFileAt(fs_atBlock(dh), pathname, &entry) != 0) {
+        return -1;
+    }
+    fs_fillStat(&entry, buf);
+    return 0;
+}
+
+int fs_mkdirat(fdDirHandle *dh, const char *pathname, mode_t mode) {
+    (void)mode;
+    if (pathname == NULL) {
+        return -1;
+    }
+    return fs_createFileAt(fs_atBlock(dh), pathname, FT_DIR);
+}
+
+// removes a file or an empty directory
+int fs_unlinkat(fdDirHandle *dh, const char *pathname) {
+    if (pathname == NULL) {
+        return -1;
+    }
+    return fs_deleteFileAt(fs_atBlock(dh), pathname);
+}
+
+int fs_renameat(fdDirHandle *olddh, const char *oldpath, fdDirHandle *newdh, const char *newpath) {
+    if (oldpath == NULL || newpath == NULL) {
+        return -1;
+    }
+    return fs_renameAt(fs_atBlock(olddh), oldpath, fs_atBlock(newdh), newpath);
+}
@@ -0,0 +1,356 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: fsDirBlock.c
+ *
+ * Description:: On-disk format of directory blocks.  Entries are
+ *	variable-length records, so a block holds as many names as fit
+ *	instead of a fixed 6 slots.  Everything outside this file works
+ *	with the decoded DirEntry form through the fs_dirBlock* helpers.
+ *
+ *	DirBlock.data is a slotted page: the 32-bit name hashes of all
+ *	entries form one contiguous array at the front (slot order), the
+ *	records are packed from the back.  The newest record sits lowest,
+ *	so slot i is found by skipping entryCount-1-i records from the
+ *	start of the record area.  Lookups compare the probe hash against
+ *	the whole hash array with SSE2/AVX2 and only decode a record on a
+ *	hash hit.
+ *
+ *	A removed entry becomes a tombstone: its type is set to FT_UNUSED
+ *	and its slot and record stay, so the other slots keep their
+ *	numbers.  Inserts reuse a tombstone before taking a new slot, and
+ *	tombstones at the end of the slot array are dropped outright.
+ *
+ *	Record layout (byte offsets, integers in host order):
+ *	  [0]  name length      [1] file type
+ *	  [2]  start block      [6] file size
+ *	  [10] create time      [14] modify time
+ *	  [18] name, not NUL terminated
+ *
+ **************************************************************/
+
+#include <string.h>
+#include <pthread.h>
+#include "fsStruct.h"
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(FS_NO_SIMD)
+#define FS_HASH_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define REC_NAMELEN 0
+#define REC_TYPE 1
+#define REC_START 2
+#define REC_SIZE 6
+#define REC_CTIME 10
+#define REC_MTIME 14
+#define REC_NAME 18
+
+#define DIR_HASH_SIZE sizeof(uint32_t)
+
+// FNV-1a, 32 bit
+uint32_t fs_nameHash(const char *name, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t fs_recGet32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void fs_recPut32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+// first slot at or after from whose hash equals h, -1 if none
+typedef int (*fs_hashScanFn)(const uint8_t *hashes, uint32_t count, uint32_t h, uint32_t from);
+
+static int fs_hashScanScalar(const uint8_t *hashes, uint32_t count, uint32_t h, uint32_t from)
+{
+    for (uint32_t i = from; i < count; i++)
+    {
+        if (fs_recGet32(hashes + i * DIR_HASH_SIZE) == h)
+            return (int)i;
+    }
+    return -1;
+}
+
+#ifdef FS_HASH_SIMD
+static int fs_hashScanSSE2(const uint8_t *hashes, uint32_t count, uint32_t h, uint32_t from)
+{
+    __m128i probe = _mm_set1_epi32((int)h);
+    uint32_t i = from;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(hashes + i * DIR_HASH_SIZE));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, probe)));
+        if (mask)
+            return (int)i + __builtin_ctz(mask);
+    }
+    return fs_hashScanScalar(hashes, count, h, i);
+}
+
+__attribute__((target("avx2")))
+static int fs_hashScanAVX2(const uint8_t *hashes, uint32_t count, uint32_t h, uint32_t from)
+{
+    __m256i probe = _mm256_set1_epi32((int)h);
+    uint32_t i = from;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(hashes + i * DIR_HASH_SIZE));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, probe)));
+        if (mask)
+            return (int)i + __builtin_ctz(mask);
+    }
+    // finish here rather than in the SSE2 version: mixing legacy SSE code
+    // with dirty upper AVX state costs far more than the scan itself
+    for (; i < count; i++)
+    {
+        if (fs_recGet32(hashes + i * DIR_HASH_SIZE) == h)
+            return (int)i;
+    }
+    return -1;
+}
+#endif
+
+static fs_hashScanFn fs_hashScan = fs_hashScanScalar;
+static pthread_once_t hashScanOnce = PTHREAD_ONCE_INIT;
+
+// picked once from the CPU; every choice returns the same slot
+static void fs_hashScanSelect(void)
+{
+#ifdef FS_HASH_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        fs_hashScan = fs_hashScanAVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        fs_hashScan = fs_hashScanSSE2;
+#endif
+}
+
+// byte offset of the record of slot index within dir->data
+static uint32_t fs_dirRecordOffset(const DirBlock *dir, uint32_t index)
+{
+    uint32_t off = sizeof(dir->data) - dir->usedBytes;
+    for (uint32_t i = dir->entryCount - 1; i > index; i--)
+        off += REC_NAME + dir->data[off + REC_NAMELEN];
+    return off;
+}
+
+static void fs_dirRecordDecode(const uint8_t *rec, DirEntry *entry)
+{
+    uint32_t len = rec[REC_NAMELEN];
+    memcpy(entry->filename, rec + REC_NAME, len);
+    entry->filename[len] = '\0';
+    entry->fileType = rec[REC_TYPE];
+    entry->startBlock = fs_recGet32(rec + REC_START);
+    entry->fileSize = fs_recGet32(rec + REC_SIZE);
+    entry->createTime = fs_recGet32(rec + REC_CTIME);
+    entry->modifyTime = fs_recGet32(rec + REC_MTIME);
+}
+
+// gives the record of slot index room for a name of len bytes.  The
+// record keeps its end, so only the newer records below it shift; NULL
+// when the block has no room for a longer name
+static uint8_t *fs_dirRecordResize(DirBlock *dir, uint32_t index, size_t len)
+{
+    uint32_t start = sizeof(dir->data) - dir->usedBytes;
+    uint32_t off = fs_dirRecordOffset(dir, index);
+    int delta = (int)len - dir->data[off + REC_NAMELEN];
+    if (delta > 0 && dir->entryCount * DIR_HASH_SIZE + dir->usedBytes + delta > sizeof(dir->data))
+        return NULL;
+    uint8_t header[REC_NAME];
+    memcpy(header, dir->data + off, REC_NAME);
+    memmove(dir->data + start - delta, dir->data + start, off - start);
+    if (delta < 0)
+        memset(dir->data + start, 0, (size_t)-delta);
+    uint8_t *rec = dir->data + off - delta;
+    memcpy(rec, header, REC_NAME);
+    rec[REC_NAMELEN] = (uint8_t)len;
+    dir->usedBytes = (uint16_t)(dir->usedBytes + delta);
+    return rec;
+}
+
+// attributes only, the name (and so the record length) stays
+static void fs_dirRecordStore(uint8_t *rec, const DirEntry *entry)
+{
+    rec[REC_TYPE] = (uint8_t)entry->fileType;
+    fs_recPut32(rec + REC_START, entry->startBlock);
+    fs_recPut32(rec + REC_SIZE, entry->fileSize);
+    fs_recPut32(rec + REC_CTIME, entry->createTime);
+    fs_recPut32(rec + REC_MTIME, entry->modifyTime);
+}
+
+void fs_dirBlockInit(DirBlock *dir)
+{
+    memset(dir, 0, sizeof(*dir));
+}
+
+// a tombstone decodes with fileType FT_UNUSED
+int fs_dirBlockGet(const DirBlock *dir, uint32_t index, DirEntry *entry)
+{
+    if (index >= dir->entryCount)
+        return -1;
+    fs_dirRecordDecode(dir->data + fs_dirRecordOffset(dir, index), entry);
+    return 0;
+}
+
+// only slots whose stored hash equals the probe's are decoded
+int fs_dirBlockFind(const DirBlock *dir, const char *name, DirEntry *entry, uint32_t *index)
+{
+    size_t len = strlen(name);
+    if (len == 0 || len > MAX_FILENAME_LEN)
+        return -1;
+    pthread_once(&hashScanOnce, fs_hashScanSelect);
+    uint32_t h = fs_nameHash(name, len);
+    int slot = fs_hashScan(dir->data, dir->entryCount, h, 0);
+    while (slot >= 0)
+    {
+        const uint8_t *rec = dir->data + fs_dirRecordOffset(dir, (uint32_t)slot);
+        if (rec[REC_TYPE] != FT_UNUSED && rec[REC_NAMELEN] == len &&
+            memcmp(rec + REC_NAME, name, len) == 0)
+        {
+            if (entry)
+                fs_dirRecordDecode(rec, entry);
+            if (index)
+                *index = (uint32_t)slot;
+            return 0;
+        }
+        slot = fs_hashScan(dir->data, dir->entryCount, h, (uint32_t)slot + 1);
+    }
+    return -1;
+}
+
+// first tombstoned slot, -1 if none
+static int fs_dirFirstTombstone(const DirBlock *dir)
+{
+    if (dir->deadCount == 0)
+        return -1;
+    uint32_t off = sizeof(dir->data) - dir->usedBytes;
+    for (uint32_t i = dir->entryCount; i-- > 0;)
+    {
+        if (dir->data[off + REC_TYPE] == FT_UNUSED)
+            return (int)i;
+        off += REC_NAME + dir->data[off + REC_NAMELEN];
+    }
+    return -1;
+}
+
+// stores entry into a tombstone or a new slot, -1 when the block has no
+// room for it
+int fs_dirBlockAdd(DirBlock *dir, const DirEntry *entry)
+{
+    size_t len = strlen(entry->filename);
+    if (len == 0 || len > MAX_FILENAME_LEN)
+        return -1;
+    uint8_t *rec;
+    int slot = fs_dirFirstTombstone(dir);
+    if (slot >= 0 && (rec = fs_dirRecordResize(dir, (uint32_t)slot, len)) != NULL)
+    {
+        dir->deadCount--;
+    }
+    else
+    {
+        // the tombstones may still add up to enough room together
+        if (slot >= 0)
+            fs_dirBlockPack(dir);
+        size_t hashBytes = (dir->entryCount + 1) * DIR_HASH_SIZE;
+        if (hashBytes + dir->usedBytes + REC_NAME + len > sizeof(dir->data))
+            return -1;
+        slot = dir->entryCount++;
+        dir->usedBytes += (uint16_t)(REC_NAME + len);
+        rec = dir->data + sizeof(dir->data) - dir->usedBytes;
+        rec[REC_NAMELEN] = (uint8_t)len;
+    }
+    fs_dirRecordStore(rec, entry);
+    memcpy(rec + REC_NAME, entry->filename, len);
+    fs_recPut32(dir->data + slot * DIR_HASH_SIZE, fs_nameHash(entry->filename, len));
+    return 0;
+}
+
+// tombstones slot index; tombstones left at the end of the slot array
+// (the newest records) are dropped along with it
+int fs_dirBlockRemove(DirBlock *dir, uint32_t index)
+{
+    if (index >= dir->entryCount)
+        return -1;
+    uint32_t off = fs_dirRecordOffset(dir, index);
+    if (dir->data[off + REC_TYPE] == FT_UNUSED)
+        return -1;
+    dir->data[off + REC_TYPE] = FT_UNUSED;
+    dir->deadCount++;
+    while (dir->entryCount > 0)
+    {
+        // the record of the last slot is the lowest one
+        uint32_t start = sizeof(dir->data) - dir->usedBytes;
+        if (dir->data[start + REC_TYPE] != FT_UNUSED)
+            break;
+        uint32_t recLen = REC_NAME + dir->data[start + REC_NAMELEN];
+        memset(dir->data + start, 0, recLen);
+        dir->usedBytes -= (uint16_t)recLen;
+        dir->entryCount--;
+        dir->deadCount--;
+        memset(dir->data + dir->entryCount * DIR_HASH_SIZE, 0, DIR_HASH_SIZE);
+    }
+    return 0;
+}
+
+// drops every tombstone; the live slots keep their order, not their numbers
+void fs_dirBlockPack(DirBlock *dir)
+{
+    if (dir->deadCount == 0)
+        return;
+    DirBlock packed = *dir;
+    packed.entryCount = 0;
+    packed.usedBytes = 0;
+    packed.deadCount = 0;
+    memset(packed.data, 0, sizeof(packed.data));
+    DirEntry e;
+    for (uint32_t i = 0; fs_dirBlockGet(dir, i, &e) == 0; i++)
+    {
+        if (e.fileType != FT_UNUSED)
+            fs_dirBlockAdd(&packed, &e);
+    }
+    *dir = packed;
+}
+
+// rewrites the attributes of slot index; the name is not changed
+int fs_dirBlockUpdate(DirBlock *dir, uint32_t index, const DirEntry *entry)
+{
+    if (index >= dir->entryCount)
+        return -1;
+    uint8_t *rec = dir->data + fs_dirRecordOffset(dir, index);
+    if (rec[REC_TYPE] == FT_UNUSED)
+        return -1;
+    fs_dirRecordStore(rec, entry);
+    return 0;
+}
+
+// renames slot index in place.  -1 when the longer name does not fit in
+// this block
+int fs_dirBlockRename(DirBlock *dir, uint32_t index, const char *newName)
+{
+    size_t len = strlen(newName);
+    if (index >= dir->entryCount || len == 0 || len > MAX_FILENAME_LEN)
+        return -1;
+    uint8_t *rec = fs_dirRecordResize(dir, index, len);
+    if (rec == NULL)
+        return -1;
+    memcpy(rec + REC_NAME, newName, len);
+    fs_recPut32(dir->data + index * DIR_HASH_SIZE, fs_nameHash(newName, len));
+    return 0;
+}
@@ -0,0 +1,252 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: fsDiscard.c
+ *
+ * Description:: Discard of freed blocks.  Freeing a block only
+ *	changes the FAT; its old contents stay in the volume file.  The
+ *	ranges freed are queued here, merged with their neighbours, and
+ *	a worker thread hands them to LBAdiscard once DISCARD_BATCH
+ *	blocks are waiting or the queue has sat for DISCARD_DELAY_MS, so
+ *	the host gets the space back without a hole punched per block.
+ *
+ *	A queued block may be allocated again before its discard runs.
+ *	The allocator cancels it, under the allocation group lock that
+ *	also covers the free that queued it; when the worker has already
+ *	taken it, the cancel waits until that discard is done, so it can
+ *	never land on the block's new data.  Dropping a discard is always
+ *	safe, so a full queue simply drops ranges.
+ *
+ *	Lock order: allocation group > discard queue.
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "fsLow.h"
+#include "fsStruct.h"
+
+#define DISCARD_RANGES 256
+#define DISCARD_BATCH 256   // blocks that wake the worker
+#define DISCARD_DELAY_MS 500
+
+typedef struct
+{
+    uint32_t start;
+    uint32_t count;
+} DiscardRange;
+
+static pthread_mutex_t discardLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t discardWake = PTHREAD_COND_INITIALIZER;  // worker: work queued
+static pthread_cond_t discardDone = PTHREAD_COND_INITIALIZER;  // a batch was issued
+static pthread_once_t discardOnce = PTHREAD_ONCE_INIT;
+static DiscardRange queue[DISCARD_RANGES];
+static uint32_t queueCount;
+static uint32_t queuedBlocks;       // read without the lock to skip cancels
+static DiscardRange flight[DISCARD_RANGES]; // being discarded
+static uint32_t flightCount;        // read without the lock as well
+
+static int fs_compareRanges(const void *a, const void *b)
+{
+    uint32_t x = ((const DiscardRange *)a)->start, y = ((const DiscardRange *)b)->start;
+    return (x > y) - (x < y);
+}
+
+// moves the queue into flight, sorted; the discard lock is held
+static uint32_t fs_discardTake(void)
+{
+    uint32_t n = queueCount;
+    memcpy(flight, queue, n * sizeof(DiscardRange));
+    qsort(flight, n, sizeof(DiscardRange), fs_compareRanges);
+    __atomic_store_n(&flightCount, n, __ATOMIC_RELAXED);
+    queueCount = 0;
+    // a cancel seeing the queue empty sees the flight
+    __atomic_store_n(&queuedBlocks, 0, __ATOMIC_RELEASE);
+    return n;
+}
+
+// discards the ranges in flight, taken with the lock held but issued
+// without it; clears them when done
+static void fs_discardIssue(void)
+{
+    uint32_t n = flightCount;
+    pthread_mutex_unlock(&discardLock);
+    for (uint32_t i = 0; i < n; )
+    {
+        uint32_t end = flight[i].start + flight[i].count;
+        uint32_t j = i + 1;
+        while (j < n && flight[j].start <= end)
+        {
+            if (flight[j].start + flight[j].count > end)
+                end = flight[j].start + flight[j].count;
+            j++;
+        }
+        LBAdiscard(end - flight[i].start, flight[i].start);
+        i = j;
+    }
+    pthread_mutex_lock(&discardLock);
+    __atomic_store_n(&flightCount, 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&discardDone);
+}
+
+static void *fs_discardWorker(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&discardLock);
+    while (1)
+    {
+        while (queueCount == 0)
+            pthread_cond_wait(&discardWake, &discardLock);
+        // give a trickle of frees time to gather into larger ranges
+        if (queuedBlocks < DISCARD_BATCH)
+        {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += DISCARD_DELAY_MS * 1000000L;
+            until.tv_sec += until.tv_nsec / 1000000000L;
+            until.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&discardWake, &discardLock, &until);
+        }
+        // a flush may have issued them meanwhile, or be issuing its own
+        if (queueCount == 0 || flightCount > 0)
+            continue;
+        fs_discardTake();
+        fs_discardIssue();
+    }
+    return NULL;
+}
+
+static void fs_discardStart(void)
+{
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, fs_discardWorker, NULL) == 0)
+        pthread_detach(worker);
+    else
+        printf("Failed to start the discard worker, freed blocks are discarded at unmount\n");
+}
+
+// adds [start, start + count) to the queue, merged into a range it
+// touches; the discard lock is held
+static void fs_discardAdd(uint32_t start, uint32_t count)
+{
+    for (uint32_t i = 0; i < queueCount; i++)
+    {
+        DiscardRange *r = &queue[i];
+        if (start + count == r->start || r->start + r->count == start)
+        {
+            if (start < r->start)
+                r->start = start;
+            r->count += count;
+            return;
+        }
+    }
+    if (queueCount == DISCARD_RANGES)
+        return; // the blocks just keep their data
+    queue[queueCount].start = start;
+    queue[queueCount].count = count;
+    queueCount++;
+}
+
+// queues freed blocks, sorted, for discard.  Called with the allocation
+// group lock of the free held
+void fs_discardQueue(const uint32_t *blocks, uint32_t n)
+{
+    if (n == 0)
+        return;
+    pthread_once(&discardOnce, fs_discardStart);
+    pthread_mutex_lock(&discardLock);
+    for (uint32_t i = 0; i < n; )
+    {
+        uint32_t j = i + 1;
+        while (j < n && blocks[j] == blocks[i] + (j - i))
+            j++;
+        fs_discardAdd(blocks[i], j - i);
+        i = j;
+    }
+    uint32_t queued = queuedBlocks + n;
+    __atomic_store_n(&queuedBlocks, queued, __ATOMIC_RELAXED);
+    if (queued >= DISCARD_BATCH || queued == n)
+        pthread_cond_signal(&discardWake);
+    pthread_mutex_unlock(&discardLock);
+}
+
+// [start, start + count) has just been allocated: takes it off the queue
+// and waits out a discard of it already under way.  Called with the
+// allocation group lock held
+void fs_discardCancel(uint32_t start, uint32_t count)
+{
+    uint32_t end = start + count;
+    if (__atomic_load_n(&queuedBlocks, __ATOMIC_ACQUIRE) == 0 &&
+        __atomic_load_n(&flightCount, __ATOMIC_ACQUIRE) == 0)
+        return;
+    pthread_mutex_lock(&discardLock);
+    for (int busy = 1; busy; )
+    {
+        busy = 0;
+        for (uint32_t i = 0; i < flightCount && !busy; i++)
+            busy = flight[i].start < end && start < flight[i].start + flight[i].count;
+        if (busy)
+            pthread_cond_wait(&discardDone, &discardLock);
+    }
+    for (uint32_t i = 0; i < queueCount; i++)
+    {
+        DiscardRange *r = &queue[i];
+        uint32_t rEnd = r->start + r->count;
+        if (r->start >= end || start >= rEnd)
+            continue;
+        // what is left on either side of the allocation
+        uint32_t before = start > r->start ? start - r->start : 0;
+        uint32_t after = rEnd > end ? rEnd - end : 0;
+        if (before > 0 && after > 0 && queueCount < DISCARD_RANGES)
+        {
+            queue[queueCount].start = end;
+            queue[queueCount].count = after;
+            queueCount++;
+            after = 0;
+        }
+        if (before > 0)
+        {
+            r->count = before;
+        }
+        else if (after > 0)
+        {
+            r->start = end;
+            r->count = after;
+        }
+        else
+        {
+            queue[i--] = queue[--queueCount];
+        }
+    }
+    pthread_mutex_unlock(&discardLock);
+}
+
+// issues everything queued and waits for it, e.g. before unmounting
+void fs_discardFlush(void)
+{
+    pthread_mutex_lock(&discardLock);
+    while (flightCount > 0)
+        pthread_cond_wait(&discardDone, &discardLock);
+    if (fs_discardTake() > 0)
+        fs_discardIssue();
+    pthread_mutex_unlock(&discardLock);
+}
+
+// forgets the queue, the volume underneath is being formatted
+void fs_discardReset(void)
+{
+    pthread_mutex_lock(&discardLock);
+    while (flightCount > 0)
+        pthread_cond_wait(&discardDone, &discardLock);
+    queueCount = 0;
+    __atomic_store_n(&queuedBlocks, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&discardLock);
+}
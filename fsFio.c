@@ -0,0 +1,488 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: fsFio.c
+ *
+ * Description:: fio-like data path workload generator for the
+ *	b_open/b_read/b_write/b_seek interface.  Jobs come from an
+ *	ini style job file ([global] plus one section per job) or from
+ *	key=value arguments on the command line.  Every job reports
+ *	bandwidth, IOPS and latency percentiles for its reads and writes.
+ *
+ *	Usage: fsfio [-B file|ram] [-v volume] [-s volumeBytes]
+ *	             [-f json|csv] [-o outfile] [jobfile | key=value ...]
+ *
+ *	Job keys:
+ *	  rw        read, write, randread, randwrite, rw, randrw
+ *	  bs        bytes per request (k/m suffix allowed)
+ *	  iodepth   requests kept in flight, issued round robin over
+ *	            that many open files
+ *	  nrfiles   number of files the job works on
+ *	  filesize  size of each file
+ *	  rwmixread percentage of reads for rw/randrw
+ *	  loops     passes over the whole file set
+ *	  directory file system directory holding the job's files
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include "basicfs.h"
+#include "fsStruct.h"
+#include "fsBenchUtil.h"
+
+#define FIO_MAX_JOBS 32
+#define FIO_MAX_DEPTH 16 // b_io has a small fixed descriptor table
+#define FIO_NAME_LEN 64
+
+typedef struct
+{
+    char name[FIO_NAME_LEN];
+    int random;   // random offsets instead of sequential
+    int readPct;  // 100 = read only, 0 = write only
+    uint64_t bs;
+    int iodepth;
+    int nrfiles;
+    uint64_t filesize;
+    int loops;
+    char directory[MAX_PATH_LEN];
+} fioJob;
+
+typedef struct
+{
+    b_io_fd fd;
+    int file;         // index of the file currently open in this slot
+    uint64_t *offsets; // request offsets for that file, in issue order
+    uint64_t next;    // next request to issue
+    uint64_t count;
+} fioSlot;
+
+static uint64_t rngState = 0xF10F10F10ULL;
+
+static uint64_t fio_random(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+static uint64_t fio_parseSize(const char *text)
+{
+    char *end;
+    uint64_t value = strtoull(text, &end, 10);
+    switch (tolower((unsigned char)*end))
+    {
+    case 'k':
+        value *= 1024;
+        break;
+    case 'm':
+        value *= 1024 * 1024;
+        break;
+    default:
+        break;
+    }
+    return value;
+}
+
+static void fio_defaultJob(fioJob *job)
+{
+    memset(job, 0, sizeof(*job));
+    strcpy(job->name, "job");
+    job->random = 0;
+    job->readPct = 100;
+    job->bs = 4096;
+    job->iodepth = 1;
+    job->nrfiles = 1;
+    job->filesize = 32 * 1024;
+    job->loops = 1;
+    strcpy(job->directory, "/fio");
+}
+
+static char *fio_trim(char *s)
+{
+    while (isspace((unsigned char)*s))
+        s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    return s;
+}
+
+// applies one key=value setting, returns -1 for unknown keys or values
+static int fio_setOption(fioJob *job, const char *key, const char *value)
+{
+    if (strcmp(key, "rw") == 0 || strcmp(key, "readwrite") == 0)
+    {
+        static const struct
+        {
+            const char *mode;
+            int random;
+            int readPct;
+        } modes[] = {{"read", 0, 100}, {"write", 0, 0}, {"randread", 1, 100}, {"randwrite", 1, 0}, {"rw", 0, 50}, {"readwrite", 0, 50}, {"randrw", 1, 50}};
+        for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+        {
+            if (strcmp(value, modes[i].mode) == 0)
+            {
+                job->random = modes[i].random;
+                job->readPct = modes[i].readPct;
+                return 0;
+            }
+        }
+        return -1;
+    }
+    if (strcmp(key, "bs") == 0)
+        job->bs = fio_parseSize(value);
+    else if (strcmp(key, "iodepth") == 0)
+        job->iodepth = atoi(value);
+    else if (strcmp(key, "nrfiles") == 0)
+        job->nrfiles = atoi(value);
+    else if (strcmp(key, "filesize") == 0 || strcmp(key, "size") == 0)
+        job->filesize = fio_parseSize(value);
+    else if (strcmp(key, "rwmixread") == 0)
+        job->readPct = atoi(value);
+    else if (strcmp(key, "loops") == 0)
+        job->loops = atoi(value);
+    else if (strcmp(key, "directory") == 0)
+        strncpy(job->directory, value, sizeof(job->directory) - 1);
+    else if (strcmp(key, "name") == 0)
+        strncpy(job->name, value, sizeof(job->name) - 1);
+    else
+        return -1;
+    return 0;
+}
+
+static int fio_parseSetting(fioJob *job, char *line)
+{
+    char *eq = strchr(line, '=');
+    if (eq == NULL)
+        return -1;
+    *eq = '\0';
+    char *key = fio_trim(line);
+    char *value = fio_trim(eq + 1);
+    if (fio_setOption(job, key, value) != 0)
+    {
+        printf("Unknown job setting: %s=%s\n", key, value);
+        return -1;
+    }
+    return 0;
+}
+
+// reads an ini style job file, [global] settings seed every later job
+static int fio_loadJobFile(const char *path, fioJob *jobs, int *jobCount)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        printf("Failed to open job file: %s\n", path);
+        return -1;
+    }
+    fioJob global;
+    fioJob *cur = NULL;
+    char line[512];
+    int lineNo = 0;
+    fio_defaultJob(&global);
+    *jobCount = 0;
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineNo++;
+        char *text = fio_trim(line);
+        if (*text == '\0' || *text == '#' || *text == ';')
+            continue;
+        if (*text == '[')
+        {
+            char *close = strchr(text, ']');
+            if (close == NULL)
+                goto bad;
+            *close = '\0';
+            if (strcmp(text + 1, "global") == 0)
+            {
+                cur = &global;
+                continue;
+            }
+            if (*jobCount >= FIO_MAX_JOBS)
+                goto bad;
+            cur = &jobs[(*jobCount)++];
+            *cur = global;
+            strncpy(cur->name, text + 1, sizeof(cur->name) - 1);
+            cur->name[sizeof(cur->name) - 1] = '\0';
+            continue;
+        }
+        if (cur == NULL || fio_parseSetting(cur, text) != 0)
+            goto bad;
+    }
+    fclose(fp);
+    return 0;
+bad:
+    printf("%s:%d: invalid job file line\n", path, lineNo);
+    fclose(fp);
+    return -1;
+}
+
+static int fio_validate(const fioJob *job)
+{
+    if (job->bs == 0 || job->filesize < job->bs || job->nrfiles <= 0 || job->loops <= 0 ||
+        job->iodepth <= 0 || job->iodepth > FIO_MAX_DEPTH || job->readPct < 0 || job->readPct > 100)
+    {
+        printf("Job %s: invalid parameters\n", job->name);
+        return -1;
+    }
+    if (job->filesize > (uint64_t)MAX_FILE_BLOCKS * BLOCK_SIZE)
+    {
+        printf("Job %s: filesize exceeds the %d byte file limit\n", job->name,
+               MAX_FILE_BLOCKS * BLOCK_SIZE);
+        return -1;
+    }
+    return 0;
+}
+
+static int fio_filePath(const fioJob *job, int file, char *out, size_t size)
+{
+    int n = snprintf(out, size, "%s/%s.%d", job->directory, job->name, file);
+    if (n < 0 || (size_t)n >= size)
+    {
+        printf("Job %s: path of file %d too long\n", job->name, file);
+        return -1;
+    }
+    return 0;
+}
+
+// creates the job's files at full size so reads and overwrites hit real data
+static int fio_layout(const fioJob *job, char *buf)
+{
+    char path[MAX_PATH_LEN];
+    strcpy(path, job->directory);
+    if (!fs_isDir(path) && fs_createFile(path, FT_DIR) != 0)
+        return -1;
+    for (int f = 0; f < job->nrfiles; f++)
+    {
+        if (fio_filePath(job, f, path, sizeof(path)) != 0)
+            return -1;
+        b_io_fd fd = b_open(path, O_WRONLY | O_CREAT);
+        if (fd < 0)
+            return -1;
+        for (uint64_t off = 0; off < job->filesize; off += job->bs)
+            b_write(fd, buf, (int)job->bs);
+        b_close(fd);
+    }
+    return 0;
+}
+
+// (re)opens the slot on its next file and builds that file's request order
+static int fio_openSlot(const fioJob *job, fioSlot *slot, int file)
+{
+    char path[MAX_PATH_LEN];
+    if (fio_filePath(job, file, path, sizeof(path)) != 0)
+        return -1;
+    slot->fd = b_open(path, O_RDWR);
+    if (slot->fd < 0)
+        return -1;
+    slot->file = file;
+    slot->next = 0;
+    slot->count = job->filesize / job->bs;
+    for (uint64_t i = 0; i < slot->count; i++)
+        slot->offsets[i] = i * job->bs;
+    if (job->random)
+    {
+        for (uint64_t i = slot->count - 1; i > 0; i--)
+        {
+            uint64_t j = fio_random() % (i + 1);
+            uint64_t t = slot->offsets[i];
+            slot->offsets[i] = slot->offsets[j];
+            slot->offsets[j] = t;
+        }
+    }
+    return 0;
+}
+
+static void fio_runJob(const fioJob *job, benchReport *rep, const char *backend)
+{
+    char param[64];
+    char *buf = malloc(job->bs);
+    fioSlot slots[FIO_MAX_DEPTH];
+    benchLatency readLat, writeLat;
+    uint64_t readBytes = 0, writeBytes = 0;
+    uint64_t perFile = job->filesize / job->bs;
+    int depth = job->iodepth < job->nrfiles ? job->iodepth : job->nrfiles;
+
+    if (buf == NULL)
+        return;
+    memset(buf, 'f', job->bs);
+    if (fio_layout(job, buf) != 0)
+    {
+        printf("Job %s: failed to lay out files\n", job->name);
+        free(buf);
+        return;
+    }
+    bench_latencyInit(&readLat, (size_t)(perFile * job->nrfiles));
+    bench_latencyInit(&writeLat, (size_t)(perFile * job->nrfiles));
+    for (int s = 0; s < depth; s++)
+        slots[s].offsets = malloc(sizeof(uint64_t) * perFile);
+
+    uint64_t start = bench_nowNs();
+    for (int loop = 0; loop < job->loops; loop++)
+    {
+        // slot s works through files s, s + depth, s + 2 * depth, ...
+        int active = 0;
+        for (int s = 0; s < depth; s++)
+        {
+            if (fio_openSlot(job, &slots[s], s) == 0)
+                active++;
+            else
+                slots[s].fd = -1;
+        }
+        while (active > 0)
+        {
+            for (int s = 0; s < depth; s++)
+            {
+                fioSlot *slot = &slots[s];
+                if (slot->fd < 0)
+                    continue;
+                int isRead = (int)(fio_random() % 100) < job->readPct;
+                uint64_t t0 = bench_nowNs();
+                b_seek(slot->fd, (off_t)slot->offsets[slot->next], SEEK_SET);
+                int n = isRead ? b_read(slot->fd, buf, (int)job->bs)
+                               : b_write(slot->fd, buf, (int)job->bs);
+                uint64_t ns = bench_nowNs() - t0;
+                if (isRead)
+                {
+                    bench_latencyAdd(&readLat, ns);
+                    readBytes += n > 0 ? (uint64_t)n : 0;
+                }
+                else
+                {
+                    bench_latencyAdd(&writeLat, ns);
+                    writeBytes += n > 0 ? (uint64_t)n : 0;
+                }
+                if (++slot->next < slot->count)
+                    continue;
+                // file finished, move the slot on to its next file
+                b_close(slot->fd);
+                slot->fd = -1;
+                if (slot->file + depth >= job->nrfiles ||
+                    fio_openSlot(job, slot, slot->file + depth) != 0)
+                    active--;
+            }
+        }
+    }
+    double seconds = (double)(bench_nowNs() - start) / 1e9;
+
+    benchResult result;
+    char name[FIO_NAME_LEN + 8];
+    snprintf(param, sizeof(param), "bs=%llu,iodepth=%d,nrfiles=%d,%s",
+             (unsigned long long)job->bs, job->iodepth, job->nrfiles, backend);
+    if (readLat.count)
+    {
+        snprintf(name, sizeof(name), "%s/read", job->name);
+        bench_summarize(&readLat, seconds, readBytes, name, param, &result);
+        bench_reportAdd(rep, &result);
+    }
+    if (writeLat.count)
+    {
+        snprintf(name, sizeof(name), "%s/write", job->name);
+        bench_summarize(&writeLat, seconds, writeBytes, name, param, &result);
+        bench_reportAdd(rep, &result);
+    }
+    for (int s = 0; s < depth; s++)
+        free(slots[s].offsets);
+    bench_latencyFree(&readLat);
+    bench_latencyFree(&writeLat);
+    free(buf);
+}
+
+static void fio_usage(void)
+{
+    printf("Usage: fsfio [-B file|ram] [-v volume] [-s volumeBytes] [-f json|csv]\n"
+           "             [-o outfile] [jobfile | key=value ...]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static fioJob jobs[FIO_MAX_JOBS];
+    int jobCount = 0;
+    const char *volume = "BenchVolume";
+    const char *backend = "file";
+    const char *outPath = "bench_output.txt";
+    uint64_t volumeBytes = 10000000;
+    int format = BENCH_FMT_JSON;
+    int c;
+
+    while ((c = getopt(argc, argv, "B:v:s:f:o:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'B':
+            backend = optarg;
+            break;
+        case 'v':
+            volume = optarg;
+            break;
+        case 's':
+            volumeBytes = strtoull(optarg, NULL, 10);
+            break;
+        case 'f':
+            format = bench_parseFormat(optarg);
+            break;
+        case 'o':
+            outPath = optarg;
+            break;
+        default:
+            fio_usage();
+            return -1;
+        }
+    }
+    if (strcmp(backend, "ram") == 0)
+        volume = LBA_RAM_VOLUME;
+    else if (strcmp(backend, "file") != 0)
+        format = -1;
+    if (format < 0)
+    {
+        fio_usage();
+        return -1;
+    }
+
+    if (optind < argc && strchr(argv[optind], '=') == NULL)
+    {
+        if (fio_loadJobFile(argv[optind], jobs, &jobCount) != 0)
+            return -1;
+    }
+    else
+    {
+        // a single job described on the command line
+        fio_defaultJob(&jobs[0]);
+        jobCount = 1;
+        for (int k = optind; k < argc; k++)
+        {
+            if (fio_parseSetting(&jobs[0], argv[k]) != 0)
+                return -1;
+        }
+    }
+    for (int j = 0; j < jobCount; j++)
+    {
+        if (fio_validate(&jobs[j]) != 0)
+            return -1;
+    }
+
+    benchReport rep;
+    if (bench_reportOpen(&rep, outPath, format) != 0)
+        return -1;
+    for (int j = 0; j < jobCount; j++)
+    {
+        // fresh volume per job, like fio's per job file layout
+        if (bench_mountVolume(volume, volumeBytes, BLOCK_SIZE) != 0)
+            break;
+        fio_runJob(&jobs[j], &rep, backend);
+        bench_unmountVolume();
+    }
+    bench_reportClose(&rep);
+    return 0;
+}
@@ -27,6 +27,7 @@
 SuperBlock g_superBlock;
 FileControlBlock g_fcbArray[MAX_OPEN_FILES];
 char g_currentPath[MAX_PATH_LEN] = "/";
+uint32_t g_cwdBlock = 0;	// directory block of g_currentPath, 0 until mounted
 
 int initFileSystem (uint64_t numberOfBlocks, uint64_t blockSize)
 	{
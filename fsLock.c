@@ -0,0 +1,143 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: fsLock.c
+ *
+ * Description:: Locks that let several threads use the file system at
+ *	once.  Two kinds:
+ *
+ *	- the tree lock.  Every call that walks or changes the namespace
+ *	  holds it shared, so they all run side by side.  Only the calls
+ *	  that can take a directory away from under a resolved path -
+ *	  removing a directory, renaming one - hold it exclusively.
+ *	  Shared holds may nest (readers are preferred).
+ *
+ *	- node locks, reader/writer locks keyed by the head block of a
+ *	  directory or the header block of a file.  Lookups hold the
+ *	  directory's lock shared, inserts and removals exclusively;
+ *	  b_read and b_write do the same with the file's.  The locks are
+ *	  striped, so two nodes may share one; a thread only ever holds
+ *	  one node lock, or two taken with fs_nodeWriteLock2.
+ *
+ *	Lookups served from the directory cache (fsDcache.c) take neither;
+ *	an exclusive hold of the tree lock bumps a sequence count, which
+ *	sends a lock-free path walk that overlapped it back to the locked
+ *	path.
+ *
+ *	Lock order: open file (b_io) > tree > node > allocator shard,
+ *	superblock, filter cache and directory cache locks.
+ *
+ **************************************************************/
+
+#define _GNU_SOURCE // pthread_rwlockattr_setkind_np
+#include <pthread.h>
+#include "fsStruct.h"
+
+#define NODE_LOCK_BITS 8
+#define NODE_LOCK_STRIPES (1 << NODE_LOCK_BITS)
+
+static pthread_rwlock_t treeLock;
+static pthread_rwlock_t nodeLocks[NODE_LOCK_STRIPES];
+static pthread_once_t lockOnce = PTHREAD_ONCE_INIT;
+static int treeExclusive;        // written only by the exclusive holder
+static uint32_t treeSeq;         // odd while a directory is being moved
+
+static void fs_lockInit(void)
+{
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_READER_NP);
+    pthread_rwlock_init(&treeLock, &attr);
+    for (int i = 0; i < NODE_LOCK_STRIPES; i++)
+        pthread_rwlock_init(&nodeLocks[i], &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+// blocks of neighbouring nodes are close together, so spread them
+static uint32_t fs_nodeStripe(uint32_t block)
+{
+    return (block * 2654435761u) >> (32 - NODE_LOCK_BITS);
+}
+
+void fs_treeLockShared(void)
+{
+    pthread_once(&lockOnce, fs_lockInit);
+    pthread_rwlock_rdlock(&treeLock);
+}
+
+void fs_treeLockExclusive(void)
+{
+    pthread_once(&lockOnce, fs_lockInit);
+    pthread_rwlock_wrlock(&treeLock);
+    treeExclusive = 1;
+    __atomic_fetch_add(&treeSeq, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void fs_treeUnlock(void)
+{
+    if (treeExclusive)
+    {
+        treeExclusive = 0;
+        __atomic_fetch_add(&treeSeq, 1, __ATOMIC_RELEASE);
+    }
+    pthread_rwlock_unlock(&treeLock);
+}
+
+// lookups that take no lock bracket their walk with these; an odd value
+// or a change means a directory moved meanwhile
+uint32_t fs_treeSeqBegin(void)
+{
+    return __atomic_load_n(&treeSeq, __ATOMIC_ACQUIRE);
+}
+
+int fs_treeSeqRetry(uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&treeSeq, __ATOMIC_RELAXED) != seq;
+}
+
+void fs_nodeReadLock(uint32_t block)
+{
+    pthread_once(&lockOnce, fs_lockInit);
+    pthread_rwlock_rdlock(&nodeLocks[fs_nodeStripe(block)]);
+}
+
+void fs_nodeWriteLock(uint32_t block)
+{
+    pthread_once(&lockOnce, fs_lockInit);
+    pthread_rwlock_wrlock(&nodeLocks[fs_nodeStripe(block)]);
+}
+
+void fs_nodeUnlock(uint32_t block)
+{
+    pthread_rwlock_unlock(&nodeLocks[fs_nodeStripe(block)]);
+}
+
+// both nodes exclusively, in stripe order so two threads locking the
+// same pair cannot deadlock
+void fs_nodeWriteLock2(uint32_t a, uint32_t b)
+{
+    uint32_t sa = fs_nodeStripe(a), sb = fs_nodeStripe(b);
+    pthread_once(&lockOnce, fs_lockInit);
+    if (sa == sb)
+    {
+        pthread_rwlock_wrlock(&nodeLocks[sa]);
+        return;
+    }
+    pthread_rwlock_wrlock(&nodeLocks[sa < sb ? sa : sb]);
+    pthread_rwlock_wrlock(&nodeLocks[sa < sb ? sb : sa]);
+}
+
+void fs_nodeUnlock2(uint32_t a, uint32_t b)
+{
+    uint32_t sa = fs_nodeStripe(a), sb = fs_nodeStripe(b);
+    pthread_rwlock_unlock(&nodeLocks[sa]);
+    if (sa != sb)
+        pthread_rwlock_unlock(&nodeLocks[sb]);
+}
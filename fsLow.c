@@ -9,11 +9,17 @@
 * File:: fsLow.c
 *
 * Description:: Simplified low-level file system implementation
+*	LBAread/LBAwrite may be called from several threads at once:
+*	file volumes use positioned I/O (no shared seek offset) and the
+*	statistics are updated atomically.  LBAdiscard punches holes
+*	into a file volume where supported.
 *
 **************************************************************/
 
+#define _GNU_SOURCE // fallocate
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -21,11 +27,30 @@
 #include "fsLow.h"
 
 static int volume_fd = -1;
+static char *volume_mem = NULL; // backing store of a RAM volume
 static uint64_t volume_size = 0;
 static uint64_t block_size = 0;
+static LBAstats lba_stats;
+static int discard_unsupported = 0; // the host file system cannot punch holes
 
 int startPartitionSystem(char *filename, uint64_t *volSize, uint64_t *blockSize) {
     printf("Starting partition system: %s\n", filename);
+    LBAresetStats();
+    
+    if (strcmp(filename, LBA_RAM_VOLUME) == 0) {
+        // RAM volume, always starts out zeroed like a new file
+        block_size = *blockSize;
+        volume_size = *volSize / block_size;
+        volume_mem = calloc(volume_size, block_size);
+        if (volume_mem == NULL) {
+            printf("Failed to allocate RAM volume\n");
+            return -2;
+        }
+        *volSize = volume_size * block_size;
+        printf("Volume size: %llu blocks, Block size: %llu bytes (RAM)\n",
+               (unsigned long long)volume_size, (unsigned long long)block_size);
+        return 0;
+    }
     
     // open or create file
     volume_fd = open(filename, O_RDWR | O_CREAT, 0644);
@@ -43,10 +68,10 @@ int startPartitionSystem(char *filename, uint64_t *volSize, uint64_t *blockSize)
     }
     
     if (st.st_size == 0) {
-        // new file, needs initialization
+        // new file, needs initialization (volSize is given in bytes)
         printf("Creating new volume file\n");
-        volume_size = *volSize;
         block_size = *blockSize;
+        volume_size = *volSize / block_size;
         
         // create file
         if (ftruncate(volume_fd, volume_size * block_size) == -1) {
@@ -60,7 +85,8 @@ int startPartitionSystem(char *filename, uint64_t *volSize, uint64_t *blockSize)
         block_size = *blockSize;
     }
     
-    *volSize = volume_size;
+    // report the volume size back in bytes, callers divide by the block size
+    *volSize = volume_size * block_size;
     *blockSize = block_size;
     
     printf("Volume size: %llu blocks, Block size: %llu bytes\n", 
@@ -70,15 +96,20 @@ int startPartitionSystem(char *filename, uint64_t *volSize, uint64_t *blockSize)
 }
 
 int closePartitionSystem(void) {
+    if (volume_mem != NULL) {
+        free(volume_mem);
+        volume_mem = NULL;
+    }
     if (volume_fd != -1) {
         close(volume_fd);
         volume_fd = -1;
     }
+    discard_unsupported = 0;
     return 0;
 }
 
 uint64_t LBAwrite(void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
-    if (volume_fd == -1) {
+    if (volume_fd == -1 && volume_mem == NULL) {
         printf("Volume not opened\n");
         return 0;
     }
@@ -88,13 +119,16 @@ uint64_t LBAwrite(void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
         return 0;
     }
     
-    off_t offset = lbaPosition * block_size;
-    if (lseek(volume_fd, offset, SEEK_SET) == -1) {
-        printf("Failed to seek to position %llu\n", (unsigned long long)offset);
-        return 0;
+    __atomic_fetch_add(&lba_stats.writeCalls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&lba_stats.blocksWritten, lbaCount, __ATOMIC_RELAXED);
+    
+    if (volume_mem != NULL) {
+        memcpy(volume_mem + lbaPosition * block_size, buffer, lbaCount * block_size);
+        return lbaCount;
     }
     
-    ssize_t bytes_written = write(volume_fd, buffer, lbaCount * block_size);
+    off_t offset = lbaPosition * block_size;
+    ssize_t bytes_written = pwrite(volume_fd, buffer, lbaCount * block_size, offset);
     if (bytes_written == -1) {
         printf("Failed to write data\n");
         return 0;
@@ -104,7 +138,7 @@ uint64_t LBAwrite(void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
 }
 
 uint64_t LBAread(void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
-    if (volume_fd == -1) {
+    if (volume_fd == -1 && volume_mem == NULL) {
         printf("Volume not opened\n");
         return 0;
     }
@@ -114,13 +148,16 @@ uint64_t LBAread(void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
         return 0;
     }
     
-    off_t offset = lbaPosition * block_size;
-    if (lseek(volume_fd, offset, SEEK_SET) == -1) {
-        printf("Failed to seek to position %llu\n", (unsigned long long)offset);
-        return 0;
+    __atomic_fetch_add(&lba_stats.readCalls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&lba_stats.blocksRead, lbaCount, __ATOMIC_RELAXED);
+    
+    if (volume_mem != NULL) {
+        memcpy(buffer, volume_mem + lbaPosition * block_size, lbaCount * block_size);
+        return lbaCount;
     }
     
-    ssize_t bytes_read = read(volume_fd, buffer, lbaCount * block_size);
+    off_t offset = lbaPosition * block_size;
+    ssize_t bytes_read = pread(volume_fd, buffer, lbaCount * block_size, offset);
     if (bytes_read == -1) {
         printf("Failed to read data\n");
         return 0;
@@ -129,6 +166,65 @@ uint64_t LBAread(void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
     return bytes_read / block_size;
 }
 
+uint64_t LBAdiscard(uint64_t lbaCount, uint64_t lbaPosition) {
+    if (volume_fd == -1 && volume_mem == NULL) {
+        printf("Volume not opened\n");
+        return 0;
+    }
+    
+    if (lbaPosition + lbaCount > volume_size) {
+        printf("Discard beyond volume size\n");
+        return 0;
+    }
+    
+    if (lbaCount == 0)
+        return 0;
+    
+    if (volume_mem != NULL) {
+        memset(volume_mem + lbaPosition * block_size, 0, lbaCount * block_size);
+    } else {
+#ifdef FALLOC_FL_PUNCH_HOLE
+        if (__atomic_load_n(&discard_unsupported, __ATOMIC_RELAXED))
+            return 0;
+        off_t offset = lbaPosition * block_size;
+        if (fallocate(volume_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      offset, lbaCount * block_size) == -1) {
+            if (errno == EOPNOTSUPP || errno == ENOSYS)
+                __atomic_store_n(&discard_unsupported, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+#else
+        return 0;
+#endif
+    }
+    
+    __atomic_fetch_add(&lba_stats.discardCalls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&lba_stats.blocksDiscarded, lbaCount, __ATOMIC_RELAXED);
+    return lbaCount;
+}
+
+// the counters move under other threads (and the discard worker), so
+// each one is read and cleared atomically
+void LBAgetStats(LBAstats *stats) {
+    if (stats == NULL)
+        return;
+    stats->readCalls = __atomic_load_n(&lba_stats.readCalls, __ATOMIC_RELAXED);
+    stats->writeCalls = __atomic_load_n(&lba_stats.writeCalls, __ATOMIC_RELAXED);
+    stats->blocksRead = __atomic_load_n(&lba_stats.blocksRead, __ATOMIC_RELAXED);
+    stats->blocksWritten = __atomic_load_n(&lba_stats.blocksWritten, __ATOMIC_RELAXED);
+    stats->discardCalls = __atomic_load_n(&lba_stats.discardCalls, __ATOMIC_RELAXED);
+    stats->blocksDiscarded = __atomic_load_n(&lba_stats.blocksDiscarded, __ATOMIC_RELAXED);
+}
+
+void LBAresetStats(void) {
+    __atomic_store_n(&lba_stats.readCalls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&lba_stats.writeCalls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&lba_stats.blocksRead, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&lba_stats.blocksWritten, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&lba_stats.discardCalls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&lba_stats.blocksDiscarded, 0, __ATOMIC_RELAXED);
+}
+
 void runFSLowTest(void) {
     printf("Running fsLow test\n");
     // simplified test implementation
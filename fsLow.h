@@ -43,6 +43,9 @@
 //		return value -2 = insufficient space for the volume		
 //		volSize will be filled with the volume size
 //		blockSize will be filled with the block size
+#ifndef _FSLOW_H
+#define _FSLOW_H
+
 #ifndef uint64_t
 typedef u_int64_t uint64_t;
 #endif
@@ -55,6 +58,11 @@ typedef unsigned long long ull_t;
 
 int startPartitionSystem (char * filename, uint64_t * volSize, uint64_t * blockSize);
 
+// Passing this name to startPartitionSystem keeps the whole volume in memory
+// instead of a file (nothing persists after closePartitionSystem).  Used by the
+// benchmarks to separate file system cost from host file I/O cost.
+#define LBA_RAM_VOLUME	":memory:"
+
 int closePartitionSystem ();
 
 int initFileSystem (uint64_t numberOfBlocks, uint64_t blockSize);
@@ -64,6 +72,28 @@ uint64_t LBAwrite (void * buffer, uint64_t lbaCount, uint64_t lbaPosition);
 
 uint64_t LBAread (void * buffer, uint64_t lbaCount, uint64_t lbaPosition);
 
+// Tells the backing store the blocks hold nothing any more: a file volume
+// punches a hole so the host gets the space back, a RAM volume zeroes
+// them.  Discarded blocks read as zeros.  Returns lbaCount, or 0 when the
+// store cannot discard (the blocks then keep their data).
+uint64_t LBAdiscard (uint64_t lbaCount, uint64_t lbaPosition);
+
+// Running totals of the LBA calls made since the partition was started
+// (or since the last LBAresetStats), used for I/O accounting by the shell
+// and the benchmark drivers.
+typedef struct
+	{
+	uint64_t readCalls;
+	uint64_t writeCalls;
+	uint64_t blocksRead;
+	uint64_t blocksWritten;
+	uint64_t discardCalls;
+	uint64_t blocksDiscarded;
+	} LBAstats;
+
+void LBAgetStats (LBAstats * stats);
+void LBAresetStats ();
+
 void runFSLowTest();  //Do not use this, for testing only
 
 #define MINBLOCKSIZE 512
@@ -77,5 +107,4 @@ void runFSLowTest();  //Do not use this, for testing only
 #define	PART_NOERROR 		0
 #define PART_ERR_INVALID	-4
 
-
-
+#endif
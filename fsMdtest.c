@@ -0,0 +1,335 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: fsMdtest.c
+ *
+ * Description:: Metadata-heavy workload driver (mdtest style).
+ *	Builds a directory tree with the given depth and fan-out,
+ *	spreads N files over its leaf directories and times the
+ *	create, stat, open, rename and delete phases, reporting
+ *	ops/sec and latency percentiles for each phase.
+ *
+ *	Usage: fsmdtest [-n files] [-d depth] [-w fanout] [-t threads]
+ *	                [-B file|ram] [-v volume] [-s volumeBytes]
+ *	                [-f json|csv] [-o outfile]
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "basicfs.h"
+#include "fsStruct.h"
+#include "fsBenchUtil.h"
+
+#define MDTEST_MAX_THREADS 64
+#define MDTEST_ROOT "/mdtest"
+
+typedef enum
+{
+    PHASE_MKDIR,
+    PHASE_CREATE,
+    PHASE_STAT,
+    PHASE_OPEN,
+    PHASE_RENAME,
+    PHASE_DELETE,
+    PHASE_RMDIR,
+    PHASE_COUNT
+} mdPhase;
+
+static const char *phaseNames[PHASE_COUNT] = {
+    "mkdir", "create", "stat", "open", "rename", "delete", "rmdir"};
+
+typedef struct
+{
+    int files;
+    int depth;
+    int fanout;
+    int threads;
+    char **dirs;   // every directory of the tree, parents before children
+    int dirCount;
+    char **leaves; // directories that receive files
+    int leafCount;
+} mdConfig;
+
+typedef struct
+{
+    const mdConfig *cfg;
+    mdPhase phase;
+    int id;
+    benchLatency lat;
+    int failures;
+} mdWorker;
+
+static char *md_strdup(const char *s)
+{
+    char *d = malloc(strlen(s) + 1);
+    if (d)
+        strcpy(d, s);
+    return d;
+}
+
+// breadth first list of the tree so each parent exists before its children
+static int md_buildTree(mdConfig *cfg)
+{
+    int total = 1, level = 1;
+    for (int d = 0; d < cfg->depth; d++)
+    {
+        level *= cfg->fanout;
+        total += level;
+    }
+    cfg->dirs = calloc((size_t)total, sizeof(char *));
+    if (cfg->dirs == NULL)
+        return -1;
+    cfg->dirs[0] = md_strdup(MDTEST_ROOT);
+    cfg->dirCount = 1;
+    int levelStart = 0, levelEnd = 1;
+    for (int d = 0; d < cfg->depth; d++)
+    {
+        for (int p = levelStart; p < levelEnd; p++)
+        {
+            for (int f = 0; f < cfg->fanout; f++)
+            {
+                char path[MAX_PATH_LEN];
+                snprintf(path, sizeof(path), "%s/d%d", cfg->dirs[p], f);
+                cfg->dirs[cfg->dirCount++] = md_strdup(path);
+            }
+        }
+        levelStart = levelEnd;
+        levelEnd = cfg->dirCount;
+    }
+    cfg->leaves = &cfg->dirs[levelStart];
+    cfg->leafCount = levelEnd - levelStart;
+    return 0;
+}
+
+static void md_freeTree(mdConfig *cfg)
+{
+    for (int i = 0; i < cfg->dirCount; i++)
+        free(cfg->dirs[i]);
+    free(cfg->dirs);
+}
+
+static void md_filePath(const mdConfig *cfg, int i, int renamed, char *out, size_t size)
+{
+    snprintf(out, size, "%s/f%07d%s", cfg->leaves[i % cfg->leafCount], i, renamed ? ".r" : "");
+}
+
+// runs one file operation of the given phase
+static int md_fileOp(const mdConfig *cfg, mdPhase phase, int i)
+{
+    char path[MAX_PATH_LEN];
+    char dest[MAX_PATH_LEN];
+    struct fs_stat st;
+
+    md_filePath(cfg, i, phase == PHASE_DELETE, path, sizeof(path));
+    switch (phase)
+    {
+    case PHASE_CREATE:
+        return fs_createFile(path, FT_FILE);
+    case PHASE_STAT:
+        return fs_stat(path, &st);
+    case PHASE_OPEN:
+    {
+        b_io_fd fd = b_open(path, O_RDONLY);
+        if (fd < 0)
+            return -1;
+        return b_close(fd);
+    }
+    case PHASE_RENAME:
+        md_filePath(cfg, i, 1, dest, sizeof(dest));
+        return fs_rename(path, dest);
+    case PHASE_DELETE:
+        // fs_delete only adds console chatter on top of fs_deleteFile
+        return fs_deleteFile(path);
+    default:
+        return -1;
+    }
+}
+
+static void *md_workerMain(void *arg)
+{
+    mdWorker *w = arg;
+    const mdConfig *cfg = w->cfg;
+    for (int i = w->id; i < cfg->files; i += cfg->threads)
+    {
+        uint64_t t0 = bench_nowNs();
+        int rc = md_fileOp(cfg, w->phase, i);
+        bench_latencyAdd(&w->lat, bench_nowNs() - t0);
+        if (rc != 0)
+            w->failures++;
+    }
+    return NULL;
+}
+
+// directory phases are ordered (parents first / children first), one thread
+static int md_dirPhase(const mdConfig *cfg, mdPhase phase, benchLatency *lat)
+{
+    int failures = 0;
+    for (int k = 0; k < cfg->dirCount; k++)
+    {
+        int i = (phase == PHASE_MKDIR) ? k : cfg->dirCount - 1 - k;
+        uint64_t t0 = bench_nowNs();
+        int rc = (phase == PHASE_MKDIR) ? fs_createFile(cfg->dirs[i], FT_DIR)
+                                        : fs_deleteFile(cfg->dirs[i]);
+        bench_latencyAdd(lat, bench_nowNs() - t0);
+        if (rc != 0)
+            failures++;
+    }
+    return failures;
+}
+
+static int md_filePhase(const mdConfig *cfg, mdPhase phase, benchLatency *lat)
+{
+    mdWorker workers[MDTEST_MAX_THREADS];
+    pthread_t tids[MDTEST_MAX_THREADS];
+    int failures = 0;
+
+    for (int t = 0; t < cfg->threads; t++)
+    {
+        workers[t].cfg = cfg;
+        workers[t].phase = phase;
+        workers[t].id = t;
+        workers[t].failures = 0;
+        bench_latencyInit(&workers[t].lat, (size_t)(cfg->files / cfg->threads + 1));
+    }
+    if (cfg->threads == 1)
+    {
+        md_workerMain(&workers[0]);
+    }
+    else
+    {
+        for (int t = 0; t < cfg->threads; t++)
+            pthread_create(&tids[t], NULL, md_workerMain, &workers[t]);
+        for (int t = 0; t < cfg->threads; t++)
+            pthread_join(tids[t], NULL);
+    }
+    for (int t = 0; t < cfg->threads; t++)
+    {
+        for (size_t s = 0; s < workers[t].lat.count; s++)
+            bench_latencyAdd(lat, workers[t].lat.samples[s]);
+        failures += workers[t].failures;
+        bench_latencyFree(&workers[t].lat);
+    }
+    return failures;
+}
+
+static void md_usage(void)
+{
+    printf("Usage: fsmdtest [-n files] [-d depth] [-w fanout] [-t threads]\n"
+           "                [-B file|ram] [-v volume] [-s volumeBytes]\n"
+           "                [-f json|csv] [-o outfile]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    mdConfig cfg;
+    const char *volume = "BenchVolume";
+    const char *backend = "file";
+    const char *outPath = "bench_output.txt";
+    uint64_t volumeBytes = 10000000;
+    int format = BENCH_FMT_JSON;
+    int c;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.files = 1000;
+    cfg.depth = 2;
+    cfg.fanout = 4;
+    cfg.threads = 1;
+
+    while ((c = getopt(argc, argv, "n:d:w:t:B:v:s:f:o:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            cfg.files = atoi(optarg);
+            break;
+        case 'd':
+            cfg.depth = atoi(optarg);
+            break;
+        case 'w':
+            cfg.fanout = atoi(optarg);
+            break;
+        case 't':
+            cfg.threads = atoi(optarg);
+            break;
+        case 'B':
+            backend = optarg;
+            break;
+        case 'v':
+            volume = optarg;
+            break;
+        case 's':
+            volumeBytes = strtoull(optarg, NULL, 10);
+            break;
+        case 'f':
+            format = bench_parseFormat(optarg);
+            break;
+        case 'o':
+            outPath = optarg;
+            break;
+        default:
+            md_usage();
+            return -1;
+        }
+    }
+    if (strcmp(backend, "ram") == 0)
+        volume = LBA_RAM_VOLUME;
+    else if (strcmp(backend, "file") != 0)
+        format = -1;
+    if (format < 0 || cfg.files <= 0 || cfg.depth < 0 || cfg.fanout <= 0 || cfg.threads <= 0)
+    {
+        md_usage();
+        return -1;
+    }
+    if (cfg.threads > MDTEST_MAX_THREADS)
+    {
+        printf("Running with at most %d threads\n", MDTEST_MAX_THREADS);
+        cfg.threads = MDTEST_MAX_THREADS;
+    }
+    if (md_buildTree(&cfg) != 0)
+        return -1;
+
+    benchReport rep;
+    benchLatency lat;
+    if (bench_reportOpen(&rep, outPath, format) != 0)
+        return -1;
+    bench_latencyInit(&lat, (size_t)cfg.files);
+    if (bench_mountVolume(volume, volumeBytes, BLOCK_SIZE) != 0)
+        return -1;
+
+    char param[64];
+    snprintf(param, sizeof(param), "files=%d,depth=%d,fanout=%d,threads=%d,%s",
+             cfg.files, cfg.depth, cfg.fanout, cfg.threads, backend);
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        int failures;
+        uint64_t start = bench_nowNs();
+        if (p == PHASE_MKDIR || p == PHASE_RMDIR)
+            failures = md_dirPhase(&cfg, (mdPhase)p, &lat);
+        else
+            failures = md_filePhase(&cfg, (mdPhase)p, &lat);
+        double seconds = (double)(bench_nowNs() - start) / 1e9;
+        if (failures)
+            printf("Phase %s: %d operations failed\n", phaseNames[p], failures);
+
+        benchResult result;
+        bench_summarize(&lat, seconds, 0, phaseNames[p], param, &result);
+        bench_reportAdd(&rep, &result);
+        bench_latencyReset(&lat);
+    }
+
+    bench_unmountVolume();
+    bench_latencyFree(&lat);
+    bench_reportClose(&rep);
+    md_freeTree(&cfg);
+    return 0;
+}
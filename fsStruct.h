@@ -17,12 +17,13 @@
 
 #include <stdint.h>
 #include <time.h>
+#include "b_io.h"
+#include "mfs.h"
 
 #define BLOCK_SIZE 512
 #define MAX_FILENAME_LEN 255
 #define MAX_PATH_LEN 4096
 #define MAX_OPEN_FILES 20
-#define MAX_DIR_ENTRIES 6 // maximum 6 directory entries per directory block
 // file data layout constants (fit header into 512 bytes)
 #define MAX_FILE_BLOCKS 120 // (512 - 4 - 4 - 8 - 4) / 4 = 123, leave some padding
 // FAT helpers
@@ -40,7 +41,8 @@
 
 // file system magic numbers
 #define FS_MAGIC 0x12345678
-#define FS_VERSION 1
+#define FS_VERSION 6 // 4: tombstoned directory slots, doubly linked chains; 5: unwritten blocks; 6: holes
+#define BLOOM_MAGIC 0x424C4F4D // "BLOM"
 
 // superblock structure
 typedef struct
@@ -59,10 +61,11 @@ typedef struct
     time_t lastMountTime; // last mount time
 } SuperBlock;
 
-// directory entry structure
+// directory entry structure (in-memory form, on disk it is a packed
+// record inside a DirBlock - see fsDirBlock.c)
 typedef struct
 {
-    char filename[64];   // filename (simplified)
+    char filename[MAX_FILENAME_LEN + 1]; // filename
     uint32_t fileType;   // file type (FT_FILE, FT_DIR)
     uint32_t startBlock; // start block (for FT_DIR: DirBlock; for FT_FILE: FileHeader block)
     uint32_t fileSize;   // file size
@@ -73,12 +76,40 @@ typedef struct
 // directory block structure
 typedef struct
 {
-    uint32_t entryCount;               // directory entry count
-    uint32_t nextDirBlock;             // next directory block (0 means none)
-    DirEntry entries[MAX_DIR_ENTRIES]; // directory entry array
-    char padding[BLOCK_SIZE - sizeof(uint32_t) * 2 - sizeof(DirEntry) * MAX_DIR_ENTRIES];
+    uint32_t nextDirBlock;                // next directory block (0 means none)
+    uint32_t prevDirBlock;                // previous directory block (0 for the head)
+    uint16_t entryCount;                  // slots in use, tombstones included
+    uint16_t usedBytes;                   // bytes of data holding records
+    uint16_t deadCount;                   // tombstoned slots (type FT_UNUSED)
+    uint16_t reserved;
+    uint32_t bloomBlock;                  // head block only: name filter (0 means none)
+    uint32_t tailBlock;                   // head block only: last block of the chain
+    uint32_t holeBlock;                   // head block only: overflow block with tombstones
+    uint8_t data[BLOCK_SIZE - 28];        // packed variable-length records
 } DirBlock;
 
+// Bloom filter over the names of one directory, created once the
+// directory spans more than one block.  A block takes a bounded number
+// of names; bigger directories chain more filter blocks behind the head
+typedef struct
+{
+    uint32_t magic;                       // BLOOM_MAGIC
+    uint32_t itemCount;                   // names added to this block
+    uint32_t nextBloomBlock;              // next filter block (0 means none)
+    uint32_t removedCount;                // head only: names removed since the last rebuild
+    uint8_t bits[BLOCK_SIZE - 16];
+} DirBloom;
+
+// a file data block reserved (b_fallocate) but never written; it reads
+// as zeros without touching the device.  The flag sits in the block's
+// entry of FileHeader.dataBlocks
+#define BLOCK_UNWRITTEN 0x80000000u
+#define BLOCK_NUMBER(entry) ((entry) & ~BLOCK_UNWRITTEN)
+// an entry of a block the file skipped over (sparse file), no disk block
+// behind it; block 0 is the superblock, never file data
+#define BLOCK_HOLE 0
+#define BLOCK_HAS_DATA(entry) ((entry) != BLOCK_HOLE && !((entry) & BLOCK_UNWRITTEN))
+
 // file header block (for FT_FILE)
 typedef struct
 {
@@ -94,7 +125,8 @@ typedef struct
 typedef struct
 {
     int inUse;                           // whether in use
-    char filename[MAX_FILENAME_LEN + 1]; // filename
+    char filename[MAX_FILENAME_LEN + 1]; // name of the entry in dirBlock
+    uint32_t dirBlock;                   // directory holding the entry
     uint64_t currentPos;                 // current position
     uint64_t fileSize;                   // file size
     uint64_t startBlock;                 // start block
@@ -110,10 +142,40 @@ typedef struct
     uint64_t freeBlocks[BLOCK_SIZE / sizeof(uint64_t) - 2]; // free block list
 } FreeBlockList;
 
+// directory stream behind the fdDir of mfs.h
+struct fdDir
+{
+    unsigned short d_reclen;          // length of this record
+    unsigned short dirEntryPosition;  // index within current DirBlock
+    uint32_t headDirBlock;            // LBA of the directory's head, names its lock
+    uint32_t currentDirBlock;         // LBA of current DirBlock
+    DirBlock cachedDir;               // cached current DirBlock
+    DirEntry currentEntry;            // entry decoded from cachedDir
+    struct fs_diriteminfo *di;        // result buffer returned by readdir
+    struct fs_diriteminfoplus *dip;   // result buffer returned by readdirplus
+};
+
+// directory handle behind the fdDirHandle of mfs.h
+struct fdDirHandle
+{
+    uint32_t dirBlock; // resolved directory block
+};
+
+// an entry as fs_walk hands it to a callback: the public part first, so
+// the library can get back from the fs_walkentry to the rest
+typedef struct
+{
+    fs_walkentry we;
+    const DirEntry *entry; // its directory entry
+    uint32_t parentBlock;  // directory holding it, 0 for the volume root
+} fs_walkitem;
+#define FS_WALKITEM(we) ((const fs_walkitem *)(we))
+
 // global variable declarations
 extern SuperBlock g_superBlock;
 extern FileControlBlock g_fcbArray[MAX_OPEN_FILES];
 extern char g_currentPath[MAX_PATH_LEN];
+extern uint32_t g_cwdBlock;
 extern const uint32_t FILEHEADER_MAGIC;
 extern uint32_t g_lastDirForStat;
 
@@ -122,7 +184,13 @@ int fs_format(uint64_t totalBlocks, uint64_t blockSize);
 int fs_mount(void);
 int fs_unmount(void);
 uint64_t fs_allocateBlock(void);
+uint64_t fs_allocateBlockNear(uint64_t goal);
+uint32_t fs_allocateExtent(uint64_t goal, uint32_t count, uint32_t *blocks);
+uint64_t fs_freeBlockCount(void);
 int fs_freeBlock(uint64_t blockNumber);
+int fs_freeBlocks(const uint32_t *blocks, uint32_t n);
+int fs_freeFileBlocks(uint32_t headerBlock);
+uint64_t fs_fileBlocksUsed(uint32_t headerBlock);
 int fs_findFile(const char *path, DirEntry *entry);
 int fs_createFile(const char *path, uint32_t fileType);
 int fs_deleteFile(const char *path);
@@ -130,11 +198,80 @@ int fs_readFile(const char *path, void *buffer, uint64_t offset, uint64_t count)
 int fs_writeFile(const char *path, const void *buffer, uint64_t offset, uint64_t count);
 int fs_getFileSize(const char *path, uint64_t *size);
 int fs_setFileSize(const char *path, uint64_t size);
+int fs_truncateInDir(uint32_t dirBlock, const char *name, uint64_t size);
 // helpers
 int fs_resolvePath(const char *path, uint32_t *outDirBlock, char *outName, size_t outNameSize);
 int fs_loadDir(uint32_t dirBlock, DirBlock *dir);
 int fs_storeDir(uint32_t dirBlock, const DirBlock *dir);
 int fs_findInDir(uint32_t dirBlock, const char *name, DirEntry *entry, uint32_t *indexInDir);
-int fs_rename(const char *srcPath, const char *dstPath);
+int fs_compactDir(uint32_t dirBlock);
+
+// directory block records (fsDirBlock.c), index counts records in the block
+uint32_t fs_nameHash(const char *name, size_t len);
+void fs_dirBlockInit(DirBlock *dir);
+int fs_dirBlockGet(const DirBlock *dir, uint32_t index, DirEntry *entry);
+int fs_dirBlockFind(const DirBlock *dir, const char *name, DirEntry *entry, uint32_t *index);
+int fs_dirBlockAdd(DirBlock *dir, const DirEntry *entry);
+int fs_dirBlockRemove(DirBlock *dir, uint32_t index);
+int fs_dirBlockUpdate(DirBlock *dir, uint32_t index, const DirEntry *entry);
+int fs_dirBlockRename(DirBlock *dir, uint32_t index, const char *newName);
+void fs_dirBlockPack(DirBlock *dir);
+
+// per-directory name filters (fsBloom.c)
+uint32_t fs_bloomCreate(const DirBlock *head);
+int fs_bloomAdd(uint32_t bloomBlock, const char *name);
+int fs_bloomMayContain(uint32_t bloomBlock, const char *name);
+int fs_bloomRemoved(uint32_t bloomBlock, const DirBlock *head);
+int fs_bloomRebuild(uint32_t bloomBlock, const DirBlock *head);
+void fs_bloomFree(uint32_t bloomBlock);
+void fs_bloomReset(void);
+
+// concurrency (fsLock.c): the tree lock orders namespace changes against
+// path walks, node locks guard one directory chain or one file's blocks
+void fs_treeLockShared(void);
+void fs_treeLockExclusive(void);
+void fs_treeUnlock(void);
+void fs_nodeReadLock(uint32_t block);
+void fs_nodeWriteLock(uint32_t block);
+void fs_nodeUnlock(uint32_t block);
+void fs_nodeWriteLock2(uint32_t a, uint32_t b);
+void fs_nodeUnlock2(uint32_t a, uint32_t b);
+uint32_t fs_treeSeqBegin(void);
+int fs_treeSeqRetry(uint32_t seq);
+
+// directory cache (fsDcache.c): lookups take no lock; the add, remove and
+// forget hooks mirror on-disk changes under the directory's write lock
+int fs_dcacheLookup(uint32_t dirBlock, const char *name, DirEntry *entry);
+int fs_dcacheFill(uint32_t dirBlock);
+void fs_dcacheAdd(uint32_t dirBlock, const DirEntry *entry);
+void fs_dcacheRemove(uint32_t dirBlock, const char *name);
+void fs_dcacheForget(uint32_t dirBlock);
+void fs_dcacheReset(void);
+
+// discard of freed blocks (fsDiscard.c): frees are queued and handed to
+// LBAdiscard in batches by a worker; allocating a block cancels its discard
+void fs_discardQueue(const uint32_t *blocks, uint32_t n);
+void fs_discardCancel(uint32_t start, uint32_t count);
+void fs_discardFlush(void);
+void fs_discardReset(void);
+
+// variants resolving relative paths from a directory block (0 = default)
+int fs_resolvePathAt(uint32_t startBlock, const char *path, uint32_t *outDirBlock, char *outName, size_t outNameSize);
+int fs_findFileAt(uint32_t atBlock, const char *path, DirEntry *entry);
+int fs_createFileAt(uint32_t atBlock, const char *path, uint32_t fileType);
+int fs_deleteFileAt(uint32_t atBlock, const char *path);
+int fs_renameAt(uint32_t srcAt, const char *srcPath, uint32_t dstAt, const char *dstPath);
+b_io_fd b_openAt(uint32_t atBlock, char *filename, int flags);
+// directories open as fdDirHandles or fdDir streams are pinned: while
+// pinned, or while the cwd, a directory is not removed nor replaced by a
+// rename.  While streamed (its lock held), no block of its chain is freed
+int fs_dirBusy(uint32_t dirBlock);
+int fs_dirStreaming(uint32_t dirBlock);
+// the file of headerBlock was cut to size (fs_resizeLocked, under its node
+// lock); open descriptors drop data they hold back past it
+void b_truncated(uint32_t headerBlock, uint64_t size);
+// the entry name of dirBlock is dropped (under dirBlock's write lock);
+// 1 when open descriptors keep the file and the last close frees it
+int b_unlinked(uint32_t dirBlock, const char *name, uint32_t headerBlock);
 
 #endif
@@ -0,0 +1,409 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: fsWalk.c
+ *
+ * Description:: Recursive directory tree walker (fs_walk).  The unit
+ *	of work is one directory block.  A worker that reads a block first
+ *	queues the next block of the same chain, then the head blocks of
+ *	the subdirectories it finds, so other workers read ahead while it
+ *	runs the callbacks for the entries.  Every worker owns a deque:
+ *	it pushes and pops at the back (depth first, cache warm) and idle
+ *	workers steal from the front of the others (the oldest, usually
+ *	biggest, pieces of the tree).
+ *
+ *	Each directory node counts its outstanding block tasks and child
+ *	directories; the worker that drops the count to zero runs the
+ *	post callback and passes the completion up to the parent.
+ *
+ *	Block reads hold the directory's lock shared, like any lookup, so
+ *	they overlap with each other and with the callbacks.  Callbacks
+ *	run one at a time, which spares them locking their own data; they
+ *	may change the tree (the shell's rm -r does).
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "fsStruct.h"
+#include "mfs.h"
+
+#define WALK_DEFAULT_THREADS 8
+#define WALK_MAX_THREADS 64
+#define WALK_IDLE_WAIT_NS 1000000 // idle workers recheck for work every 1 ms
+
+typedef struct walkNode
+{
+    struct walkNode *parent;
+    char *path;
+    DirEntry entry;       // the directory's own entry
+    uint32_t parentBlock; // block of the directory holding it
+    int depth;
+    void *data;           // the caller's slot for this directory
+    uint32_t pending;     // block tasks and child directories outstanding
+} walkNode;
+
+typedef struct
+{
+    walkNode *node;
+    uint32_t block;
+} walkTask;
+
+// owner pushes and pops at tail, thieves take from head
+typedef struct
+{
+    pthread_mutex_t lock;
+    walkTask *tasks;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t cap;
+} walkDeque;
+
+typedef struct
+{
+    const fs_walkops *ops;
+    walkDeque *deques;
+    int threads;
+    uint32_t outstanding; // tasks queued or running
+    int failed;
+    pthread_mutex_t callLock; // callbacks run one at a time
+    pthread_mutex_t idleLock;
+    pthread_cond_t idleCond;
+} walker;
+
+typedef struct
+{
+    walker *w;
+    int id;
+} walkWorker;
+
+static int walk_isDotName(const char *name)
+{
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+static void walk_joinPath(char *out, const char *dir, const char *name)
+{
+    size_t len = strlen(dir);
+    memcpy(out, dir, len);
+    if (len == 0 || dir[len - 1] != '/')
+        out[len++] = '/';
+    strcpy(out + len, name);
+}
+
+static int walk_push(walker *w, int id, walkNode *node, uint32_t block)
+{
+    walkDeque *dq = &w->deques[id];
+    __atomic_add_fetch(&w->outstanding, 1, __ATOMIC_ACQ_REL);
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->cap)
+    {
+        if (dq->head > 0)
+        {
+            // slide the live range down before growing
+            memmove(dq->tasks, dq->tasks + dq->head, (dq->tail - dq->head) * sizeof(walkTask));
+            dq->tail -= dq->head;
+            dq->head = 0;
+        }
+        if (dq->tail == dq->cap)
+        {
+            uint32_t cap = dq->cap ? dq->cap * 2 : 64;
+            walkTask *grown = realloc(dq->tasks, cap * sizeof(walkTask));
+            if (grown == NULL)
+            {
+                pthread_mutex_unlock(&dq->lock);
+                __atomic_sub_fetch(&w->outstanding, 1, __ATOMIC_ACQ_REL);
+                return -1;
+            }
+            dq->tasks = grown;
+            dq->cap = cap;
+        }
+    }
+    dq->tasks[dq->tail].node = node;
+    dq->tasks[dq->tail].block = block;
+    dq->tail++;
+    pthread_mutex_unlock(&dq->lock);
+    pthread_cond_signal(&w->idleCond);
+    return 0;
+}
+
+static int walk_pop(walker *w, int id, walkTask *t)
+{
+    walkDeque *dq = &w->deques[id];
+    int found = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail > dq->head)
+    {
+        *t = dq->tasks[--dq->tail];
+        found = 1;
+    }
+    if (dq->tail == dq->head)
+        dq->head = dq->tail = 0;
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static int walk_steal(walker *w, int id, walkTask *t)
+{
+    for (int i = 1; i < w->threads; i++)
+    {
+        walkDeque *dq = &w->deques[(id + i) % w->threads];
+        int found = 0;
+        pthread_mutex_lock(&dq->lock);
+        if (dq->tail > dq->head)
+        {
+            *t = dq->tasks[dq->head++];
+            found = 1;
+        }
+        pthread_mutex_unlock(&dq->lock);
+        if (found)
+            return 1;
+    }
+    return 0;
+}
+
+// runs fn, one callback at a time; < 0 stops the whole walk.  A file's
+// st_blocks are the blocks its header holds, not its size rounded up
+static int walk_call(walker *w, fs_walkfn fn, const char *path, const DirEntry *e,
+                     uint32_t parentBlock, int depth, void **data, void *parentData)
+{
+    if (fn == NULL)
+        return 0;
+    fs_walkitem it = {{path, e->filename, (e->fileType == FT_DIR) ? FT_DIRECTORY : FT_REGFILE,
+                       (e->fileType == FT_FILE) ? (off_t)e->fileSize : 0,
+                       (e->fileType == FT_FILE) ? (blkcnt_t)fs_fileBlocksUsed(e->startBlock) : 0,
+                       depth, data, parentData},
+                      e, parentBlock};
+    pthread_mutex_lock(&w->callLock);
+    int rc = fn(&it.we, w->ops->arg);
+    pthread_mutex_unlock(&w->callLock);
+    if (rc < 0)
+        __atomic_store_n(&w->failed, 1, __ATOMIC_RELEASE);
+    return rc;
+}
+
+// one outstanding piece of n is done; finished directories run post and
+// complete their parent in turn
+static void walk_finish(walker *w, walkNode *n)
+{
+    while (n != NULL && __atomic_sub_fetch(&n->pending, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        walkNode *parent = n->parent;
+        walk_call(w, w->ops->post, n->path, &n->entry, n->parentBlock, n->depth,
+                  &n->data, parent ? parent->data : NULL);
+        free(n->path);
+        free(n);
+        n = parent;
+    }
+}
+
+// pre for a directory, then queue its head block
+static int walk_enterDir(walker *w, int id, walkNode *parent, const char *path,
+                         const DirEntry *e, uint32_t parentBlock, int depth)
+{
+    walkNode *n = calloc(1, sizeof(*n));
+    if (n == NULL || (n->path = strdup(path)) == NULL)
+    {
+        free(n);
+        __atomic_store_n(&w->failed, 1, __ATOMIC_RELEASE);
+        return -1;
+    }
+    n->parent = parent;
+    n->entry = *e;
+    n->parentBlock = parentBlock;
+    n->depth = depth;
+    n->pending = 1;
+    int rc = walk_call(w, w->ops->pre, path, e, parentBlock, depth, &n->data,
+                       parent ? parent->data : NULL);
+    if (rc != 0)
+    {
+        // skipped (> 0) or stopped (< 0): no entries, no post
+        free(n->path);
+        free(n);
+        return rc < 0 ? -1 : 0;
+    }
+    if (parent)
+        __atomic_add_fetch(&parent->pending, 1, __ATOMIC_ACQ_REL);
+    if (walk_push(w, id, n, e->startBlock) != 0)
+    {
+        __atomic_store_n(&w->failed, 1, __ATOMIC_RELEASE);
+        walk_finish(w, n);
+        return -1;
+    }
+    return 0;
+}
+
+static void walk_runTask(walker *w, int id, const walkTask *t)
+{
+    walkNode *n = t->node;
+    DirBlock blk;
+    if (!__atomic_load_n(&w->failed, __ATOMIC_ACQUIRE))
+    {
+        fs_treeLockShared();
+        fs_nodeReadLock(n->entry.startBlock);
+        int rc = fs_loadDir(t->block, &blk);
+        fs_nodeUnlock(n->entry.startBlock);
+        fs_treeUnlock();
+        char *path = malloc(strlen(n->path) + MAX_FILENAME_LEN + 2);
+        if (rc != 0 || path == NULL)
+        {
+            __atomic_store_n(&w->failed, 1, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            // the rest of the chain goes to the pool before the entries
+            if (blk.nextDirBlock != 0)
+            {
+                __atomic_add_fetch(&n->pending, 1, __ATOMIC_ACQ_REL);
+                if (walk_push(w, id, n, blk.nextDirBlock) != 0)
+                {
+                    __atomic_store_n(&w->failed, 1, __ATOMIC_RELEASE);
+                    __atomic_sub_fetch(&n->pending, 1, __ATOMIC_ACQ_REL);
+                }
+            }
+            DirEntry e;
+            for (uint32_t i = 0; fs_dirBlockGet(&blk, i, &e) == 0; i++)
+            {
+                if (__atomic_load_n(&w->failed, __ATOMIC_ACQUIRE))
+                    break;
+                if (e.fileType == FT_UNUSED || walk_isDotName(e.filename))
+                    continue;
+                walk_joinPath(path, n->path, e.filename);
+                if (e.fileType == FT_DIR)
+                    walk_enterDir(w, id, n, path, &e, n->entry.startBlock, n->depth + 1);
+                else
+                    walk_call(w, w->ops->visit, path, &e, n->entry.startBlock, n->depth + 1,
+                              NULL, n->data);
+            }
+        }
+        free(path);
+    }
+    walk_finish(w, n);
+}
+
+static void *walk_workerMain(void *arg)
+{
+    walkWorker *me = arg;
+    walker *w = me->w;
+    walkTask t;
+    while (1)
+    {
+        if (walk_pop(w, me->id, &t) || walk_steal(w, me->id, &t))
+        {
+            walk_runTask(w, me->id, &t);
+            if (__atomic_sub_fetch(&w->outstanding, 1, __ATOMIC_ACQ_REL) == 0)
+                pthread_cond_broadcast(&w->idleCond);
+            continue;
+        }
+        if (__atomic_load_n(&w->outstanding, __ATOMIC_ACQUIRE) == 0)
+            break;
+        // tasks are running elsewhere and may queue more
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += WALK_IDLE_WAIT_NS;
+        if (ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&w->idleLock);
+        if (__atomic_load_n(&w->outstanding, __ATOMIC_ACQUIRE) != 0)
+            pthread_cond_timedwait(&w->idleCond, &w->idleLock, &ts);
+        pthread_mutex_unlock(&w->idleLock);
+    }
+    return NULL;
+}
+
+int fs_walk(const char *pathname, const fs_walkops *ops)
+{
+    if (pathname == NULL || ops == NULL)
+        return -1;
+    uint32_t dirBlock = 0;
+    char name[MAX_FILENAME_LEN + 1];
+    DirEntry e;
+    int rc = -1;
+    fs_treeLockShared();
+    if (fs_resolvePath(pathname, &dirBlock, name, sizeof(name)) == 0)
+    {
+        // the volume root has no entry of its own but its "."
+        rc = fs_findInDir(dirBlock, name[0] == '\0' ? "." : name, &e, NULL);
+    }
+    fs_treeUnlock();
+    if (rc != 0)
+        return -1;
+    uint32_t parentBlock = dirBlock;
+    if (name[0] == '\0')
+    {
+        strcpy(e.filename, "/");
+        parentBlock = 0;
+    }
+
+    walker w;
+    memset(&w, 0, sizeof(w));
+    w.ops = ops;
+    if (e.fileType != FT_DIR)
+    {
+        pthread_mutex_init(&w.callLock, NULL);
+        rc = walk_call(&w, ops->visit, pathname, &e, parentBlock, 0, NULL, NULL);
+        pthread_mutex_destroy(&w.callLock);
+        return rc < 0 ? -1 : 0;
+    }
+
+    w.threads = ops->threads > 0 ? ops->threads : WALK_DEFAULT_THREADS;
+    if (w.threads > WALK_MAX_THREADS)
+        w.threads = WALK_MAX_THREADS;
+    w.deques = calloc(w.threads, sizeof(walkDeque));
+    if (w.deques == NULL)
+        return -1;
+    for (int i = 0; i < w.threads; i++)
+        pthread_mutex_init(&w.deques[i].lock, NULL);
+    pthread_mutex_init(&w.callLock, NULL);
+    pthread_mutex_init(&w.idleLock, NULL);
+    pthread_cond_init(&w.idleCond, NULL);
+
+    // the caller's thread is worker 0 and seeds the walk
+    walkWorker workers[WALK_MAX_THREADS];
+    pthread_t tids[WALK_MAX_THREADS];
+    int started = 1;
+    walk_enterDir(&w, 0, NULL, pathname, &e, parentBlock, 0);
+    for (int i = 0; i < w.threads; i++)
+    {
+        workers[i].w = &w;
+        workers[i].id = i;
+    }
+    for (int i = 1; i < w.threads; i++)
+    {
+        if (pthread_create(&tids[i], NULL, walk_workerMain, &workers[i]) != 0)
+            break;
+        started++;
+    }
+    walk_workerMain(&workers[0]);
+    for (int i = 1; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    for (int i = 0; i < w.threads; i++)
+    {
+        pthread_mutex_destroy(&w.deques[i].lock);
+        free(w.deques[i].tasks);
+    }
+    free(w.deques);
+    pthread_mutex_destroy(&w.callLock);
+    pthread_mutex_destroy(&w.idleLock);
+    pthread_cond_destroy(&w.idleCond);
+    return w.failed ? -1 : 0;
+}
+
+int fs_walkunlink(const fs_walkentry *we)
+{
+    if (we == NULL || FS_WALKITEM(we)->parentBlock == 0)
+        return -1;
+    return fs_deleteFileAt(FS_WALKITEM(we)->parentBlock, we->name);
+}
@@ -13,6 +13,12 @@
 * Make sure to set the #defined on the CMDxxxx_ON from 0 to 1 
 * when you are ready to test that feature
 *
+* Usage: fsshell volumeFileName volumeSize blockSize [lowtest]
+*                [-b scriptFile|-] [-t]
+*   -b  batch mode, run the commands in scriptFile (or stdin for -)
+*       through the same dispatch table instead of prompting
+*   -t  report the wall time and LBA I/O counts of every command
+*
 **************************************************************/
 
 
@@ -24,9 +30,10 @@
 #include <readline/history.h>
 #include <getopt.h>
 #include <string.h>
+#include <time.h>
+#include <fnmatch.h>
 
-#include "fsLow.h"
-#include "mfs.h"
+#include "basicfs.h"
 
 #define PERMISSIONS (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
 
@@ -47,6 +54,10 @@
 #define CMDPWD_ON	1
 #define CMDTOUCH_ON	1
 #define CMDCAT_ON	1
+#define CMDCOMPACT_ON	1
+#define CMDFIND_ON	1
+#define CMDDU_ON	1
+#define CMDDEFRAG_ON	1
 
 
 typedef struct dispatch_t
@@ -62,6 +73,10 @@ int cmd_cp (int argcnt, char *argvec[]);
 int cmd_mv (int argcnt, char *argvec[]);
 int cmd_md (int argcnt, char *argvec[]);
 int cmd_rm (int argcnt, char *argvec[]);
+int cmd_compact (int argcnt, char *argvec[]);
+int cmd_defrag (int argcnt, char *argvec[]);
+int cmd_find (int argcnt, char *argvec[]);
+int cmd_du (int argcnt, char *argvec[]);
 int cmd_touch (int argcnt, char *argvec[]);
 int cmd_cat (int argcnt, char *argvec[]);
 int cmd_cp2l (int argcnt, char *argvec[]);
@@ -76,7 +91,11 @@ dispatch_t dispatchTable[] = {
 	{"cp", cmd_cp, "Copies a file - source [dest]"},
 	{"mv", cmd_mv, "Moves a file - source dest"},
 	{"md", cmd_md, "Make a new directory"},
-	{"rm", cmd_rm, "Removes a file or directory"},
+	{"rm", cmd_rm, "Removes a file or directory, -r for a whole tree"},
+	{"find", cmd_find, "Lists a tree - [path] [-name pattern] [-type f|d]"},
+	{"du", cmd_du, "Disk usage of a tree in 512 byte blocks - [-s] [path]"},
+	{"compact", cmd_compact, "Packs a directory and frees its empty blocks"},
+	{"defrag", cmd_defrag, "Moves fragmented files and directories into one extent - [-n] [-e extents] [path]"},
         {"touch",cmd_touch, "Touches/Creates a file"},
         {"cat", cmd_cat, "Limited version of cat that displace the file to the console"},
 	{"cp2l", cmd_cp2l, "Copies a file from the test file system to the linux file system"},
@@ -96,10 +115,11 @@ int displayFiles (fdDir * dirp, int flall, int fllong)
 	if (dirp == NULL)	//get out if error
 		return (-1);
 	
-	struct fs_diriteminfo * di;
-	struct fs_stat statbuf;
+	struct fs_diriteminfoplus * di;
 	
-	di = fs_readdir (dirp);
+	// readdirplus returns type and size with each name, so the long
+	// format needs no extra lookup per entry
+	di = fs_readdirplus (dirp);
 	printf("\n");
 	while (di != NULL) 
 		{
@@ -107,15 +127,14 @@ int displayFiles (fdDir * dirp, int flall, int fllong)
 			{
 			if (fllong)
 				{
-				fs_stat (di->d_name, &statbuf);
-                printf ("%s    %9lld   %s\n", fs_isDir(di->d_name)?"D":"-", (long long)statbuf.st_size, di->d_name);
+                printf ("%s    %9lld   %s\n", (di->fileType == FT_DIRECTORY)?"D":"-", (long long)di->st_size, di->d_name);
 				}
 			else
 				{
 				printf ("%s\n", di->d_name);
 				}
 			}
-		di = fs_readdir (dirp);
+		di = fs_readdirplus (dirp);
 		}
 	fs_closedir (dirp);
 #endif
@@ -402,16 +421,42 @@ int cmd_md (int argcnt, char *argvec[])
 /****************************************************
 *  Remove directory or file commmand
 ****************************************************/
+// rm -r: files as they are found, each directory once it is empty
+static int rm_visit (const fs_walkentry * we, void * arg)
+	{
+	(void) arg;
+	if (fs_walkunlink (we) != 0)
+		{
+		printf ("Cannot remove %s\n", we->path);
+		return -1;
+		}
+	return 0;
+	}
+
+static int rm_post (const fs_walkentry * we, void * arg)
+	{
+	if (strcmp (we->name, "/") == 0)	// the volume root stays
+		return 0;
+	return rm_visit (we, arg);
+	}
+
 int cmd_rm (int argcnt, char *argvec[])
 	{
 #if (CMDRM_ON == 1)
-	if (argcnt != 2)
+	int recursive = (argcnt == 3 && strcmp (argvec[1], "-r") == 0);
+	if (argcnt != 2 && !recursive)
 		{
-		printf ("Usage: rm path\n");
+		printf ("Usage: rm [-r] path\n");
 		return -1;
 		}
 		
-	char * path = argvec[1];	
+	char * path = argvec[argcnt - 1];	
+	
+	if (recursive)
+		{
+		fs_walkops ops = {NULL, rm_visit, rm_post, NULL, 0};
+		return (fs_walk (path, &ops));
+		}
 	
 	//must determine if file or directory
 	if (fs_isDir (path))
@@ -428,6 +473,179 @@ int cmd_rm (int argcnt, char *argvec[])
 	return -1;
 	}
 	
+/****************************************************
+*  Find commmand
+****************************************************/
+typedef struct
+	{
+	const char * pattern;	// -name, NULL for any
+	int type;		// -type as FT_REGFILE/FT_DIRECTORY, 0 for any
+	} findArgs;
+
+static int find_print (const fs_walkentry * we, void * arg)
+	{
+	findArgs * fa = arg;
+	if (fa->type != 0 && (int)we->fileType != fa->type)
+		return 0;
+	if (fa->pattern != NULL && fnmatch (fa->pattern, we->name, 0) != 0)
+		return 0;
+	printf ("%s\n", we->path);
+	return 0;
+	}
+
+int cmd_find (int argcnt, char *argvec[])
+	{
+#if (CMDFIND_ON == 1)
+	findArgs fa = {NULL, 0};
+	char * path = ".";
+	for (int k = 1; k < argcnt; k++)
+		{
+		if (strcmp (argvec[k], "-name") == 0 && k + 1 < argcnt)
+			fa.pattern = argvec[++k];
+		else if (strcmp (argvec[k], "-type") == 0 && k + 1 < argcnt && 
+				(strcmp (argvec[k + 1], "f") == 0 || strcmp (argvec[k + 1], "d") == 0))
+			fa.type = (argvec[++k][0] == 'f') ? FT_REGFILE : FT_DIRECTORY;
+		else if (argvec[k][0] != '-' && k == 1)
+			path = argvec[k];
+		else
+			{
+			printf ("Usage: find [path] [-name pattern] [-type f|d]\n");
+			return -1;
+			}
+		}
+	fs_walkops ops = {find_print, find_print, NULL, &fa, 0};
+	if (fs_walk (path, &ops) != 0)
+		{
+		printf ("%s is not found\n", path);
+		return -1;
+		}
+	return 0;
+#endif
+	return -1;
+	}
+	
+/****************************************************
+*  Disk usage commmand
+****************************************************/
+static int du_pre (const fs_walkentry * we, void * arg)
+	{
+	(void) arg;
+	*we->data = calloc (1, sizeof (uint64_t));
+	return (*we->data == NULL) ? -1 : 0;
+	}
+
+static int du_visit (const fs_walkentry * we, void * arg)
+	{
+	(void) arg;
+	if (we->parentData != NULL)
+		*(uint64_t *)we->parentData += we->st_blocks;
+	else	// du of a single file
+		printf ("%llu\t%s\n", (unsigned long long)we->st_blocks, we->path);
+	return 0;
+	}
+
+// a directory's total is final once all of it was walked
+static int du_post (const fs_walkentry * we, void * arg)
+	{
+	int summary = *(int *)arg;
+	uint64_t total = *(uint64_t *)*we->data;
+	if (we->parentData != NULL)
+		*(uint64_t *)we->parentData += total;
+	if (!summary || we->depth == 0)
+		printf ("%llu\t%s\n", (unsigned long long)total, we->path);
+	free (*we->data);
+	return 0;
+	}
+
+int cmd_du (int argcnt, char *argvec[])
+	{
+#if (CMDDU_ON == 1)
+	int summary = 0;
+	char * path = ".";
+	for (int k = 1; k < argcnt; k++)
+		{
+		if (strcmp (argvec[k], "-s") == 0)
+			summary = 1;
+		else if (argvec[k][0] != '-')
+			path = argvec[k];
+		else
+			{
+			printf ("Usage: du [-s] [path]\n");
+			return -1;
+			}
+		}
+	fs_walkops ops = {du_pre, du_visit, du_post, &summary, 0};
+	if (fs_walk (path, &ops) != 0)
+		{
+		printf ("%s is not found\n", path);
+		return -1;
+		}
+	return 0;
+#endif
+	return -1;
+	}
+	
+/****************************************************
+*  Compact directory commmand
+****************************************************/
+int cmd_compact (int argcnt, char *argvec[])
+	{
+#if (CMDCOMPACT_ON == 1)
+	if (argcnt > 2)
+		{
+		printf ("Usage: compact [path]\n");
+		return -1;
+		}
+	return (fs_compactdir (argcnt == 2 ? argvec[1] : "."));
+#endif
+	return -1;
+	}
+
+/****************************************************
+*  Defragment commmand
+****************************************************/
+static void defrag_report (const char * path, uint32_t before, uint32_t after,
+		uint32_t blocks, void * arg)
+	{
+	(void) arg;
+	printf ("%4u -> %-4u extents  %4u blocks  %s\n", before, after, blocks, path);
+	}
+
+int cmd_defrag (int argcnt, char *argvec[])
+	{
+#if (CMDDEFRAG_ON == 1)
+	fs_defragopts opts = {0, 0, defrag_report, NULL};
+	fs_defragstats stats;
+	char * path = ".";
+	for (int k = 1; k < argcnt; k++)
+		{
+		if (strcmp (argvec[k], "-n") == 0)
+			opts.dryRun = 1;
+		else if (strcmp (argvec[k], "-e") == 0 && k + 1 < argcnt)
+			opts.maxExtents = (unsigned) atoi (argvec[++k]);
+		else if (argvec[k][0] != '-')
+			path = argvec[k];
+		else
+			{
+			printf ("Usage: defrag [-n] [-e extents] [path]\n");
+			return -1;
+			}
+		}
+	if (fs_defrag (path, &opts, &stats) != 0)
+		{
+		printf ("%s is not found\n", path);
+		return -1;
+		}
+	printf ("%llu files, %llu directories: %llu fragmented, %llu moved (%llu blocks), extents %llu -> %llu\n",
+		(unsigned long long)stats.files, (unsigned long long)stats.dirs,
+		(unsigned long long)stats.fragmented, (unsigned long long)stats.moved,
+		(unsigned long long)stats.blocksMoved, (unsigned long long)stats.extentsBefore,
+		(unsigned long long)stats.extentsAfter);
+	return 0;
+#endif
+	return -1;
+	}
+
 /****************************************************
 *  Copy file from test file system to Linux commmand
 ****************************************************/
@@ -503,8 +721,13 @@ int cmd_cp2fs (int argcnt, char *argvec[])
 		}
 	
 	
-	testfs_fd = b_open (dest, O_WRONLY | O_CREAT | O_TRUNC);
 	linux_fd = open (src, O_RDONLY);
+	if (linux_fd < 0)
+		{
+		printf ("Failed to open Linux file: %s\n", src);
+		return (-1);
+		}
+	testfs_fd = b_open (dest, O_WRONLY | O_CREAT | O_TRUNC);
 	do 
 		{
 		readcnt = read (linux_fd, buf, BUFFERLEN);
@@ -715,6 +938,83 @@ void processcommand (char * cmd)
 
 
 
+// Runs one command, optionally reporting its wall time and LBA I/O
+void timedcommand (char * cmd, int fltiming)
+	{
+	struct timespec start, end;
+	LBAstats before, after;
+	char * echo = NULL;
+	
+	if (!fltiming)
+		{
+		processcommand (cmd);
+		return;
+		}
+		
+	echo = strdup (cmd);	//processcommand tokenizes cmd in place
+	LBAgetStats (&before);
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	processcommand (cmd);
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	LBAgetStats (&after);
+	
+	double ms = (end.tv_sec - start.tv_sec) * 1000.0 +
+		(end.tv_nsec - start.tv_nsec) / 1000000.0;
+	printf ("[time] %-30s %10.3f ms  reads %llu (%llu blk)  writes %llu (%llu blk)\n",
+		echo ? echo : "", ms,
+		(ull_t)(after.readCalls - before.readCalls),
+		(ull_t)(after.blocksRead - before.blocksRead),
+		(ull_t)(after.writeCalls - before.writeCalls),
+		(ull_t)(after.blocksWritten - before.blocksWritten));
+	free (echo);
+	}
+
+// Batch mode - executes every line of the script through processcommand.
+// Blank lines and lines starting with # are skipped, "exit" stops early.
+int runbatch (FILE * script, int fltiming)
+	{
+	char * line = NULL;
+	size_t linecap = 0;
+	ssize_t len;
+	int count = 0;
+	struct timespec start, end;
+	LBAstats before, after;
+	
+	LBAgetStats (&before);
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	while ((len = getline (&line, &linecap, script)) != -1)
+		{
+		while ((len > 0) && ((line[len-1] == '\n') || (line[len-1] == '\r')))
+			{
+			line[--len] = 0;
+			}
+		if ((len == 0) || (line[0] == '#'))
+			continue;
+		if (strcmp (line, "exit") == 0)
+			break;
+			
+		printf ("Prompt > %s\n", line);
+		timedcommand (line, fltiming);
+		++count;
+		}
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	LBAgetStats (&after);
+	free (line);
+	
+	if (fltiming)
+		{
+		double ms = (end.tv_sec - start.tv_sec) * 1000.0 +
+			(end.tv_nsec - start.tv_nsec) / 1000000.0;
+		printf ("[time] total %d commands %10.3f ms  reads %llu (%llu blk)  writes %llu (%llu blk)\n",
+			count, ms,
+			(ull_t)(after.readCalls - before.readCalls),
+			(ull_t)(after.blocksRead - before.blocksRead),
+			(ull_t)(after.writeCalls - before.writeCalls),
+			(ull_t)(after.blocksWritten - before.blocksWritten));
+		}
+	return 0;
+	}
+
 int main (int argc, char * argv[])
 	{
 	char * cmdin;
@@ -724,6 +1024,9 @@ int main (int argc, char * argv[])
 	uint64_t volumeSize;
 	uint64_t blockSize;
     int retVal;
+	int fllowtest = 0;
+	int fltiming = 0;
+	char * batchname = NULL;
     
 	if (argc > 3)
 		{
@@ -733,10 +1036,25 @@ int main (int argc, char * argv[])
 		}
 	else
 		{
-		printf ("Usage: fsLowDriver volumeFileName volumeSize blockSize\n");
+		printf ("Usage: fsLowDriver volumeFileName volumeSize blockSize [lowtest] [-b script|-] [-t]\n");
 		return -1;
 		}
 		
+	for (int k = 4; k < argc; k++)
+		{
+		if (strcmp ("lowtest", argv[k]) == 0)
+			fllowtest = 1;
+		else if (strcmp ("-t", argv[k]) == 0)
+			fltiming = 1;
+		else if ((strcmp ("-b", argv[k]) == 0) && (k + 1 < argc))
+			batchname = argv[++k];
+		else
+			{
+			printf ("Unknown option %s\n", argv[k]);
+			return -1;
+			}
+		}
+		
 	retVal = startPartitionSystem (filename, &volumeSize, &blockSize);	
 	printf("Opened %s, Volume Size: %llu;  BlockSize: %llu; Return %d\n", filename, (ull_t)volumeSize, (ull_t)blockSize, retVal);
 
@@ -755,9 +1073,8 @@ int main (int argc, char * argv[])
 		return (retVal);
 		}
 
-	if (argc > 4)
-		if(strcmp("lowtest", argv[4]) == 0)
-			runFSLowTest();
+	if (fllowtest)
+		runFSLowTest();
 
 
 	using_history();
@@ -809,6 +1126,26 @@ int main (int argc, char * argv[])
 #else
         printf ("| mv                   |    OFF   |\n");  
 #endif
+#if (CMDCOMPACT_ON == 1)
+        printf ("| compact              |    ON    |\n");  
+#else
+        printf ("| compact              |    OFF   |\n");  
+#endif
+#if (CMDDEFRAG_ON == 1)
+        printf ("| defrag               |    ON    |\n");  
+#else
+        printf ("| defrag               |    OFF   |\n");  
+#endif
+#if (CMDFIND_ON == 1)
+        printf ("| find                 |    ON    |\n");  
+#else
+        printf ("| find                 |    OFF   |\n");  
+#endif
+#if (CMDDU_ON == 1)
+        printf ("| du                   |    ON    |\n");  
+#else
+        printf ("| du                   |    OFF   |\n");  
+#endif
 #if (CMDCP2FS_ON == 1)
         printf ("| cp2fs                |    ON    |\n");  
 #else
@@ -821,6 +1158,26 @@ int main (int argc, char * argv[])
 #endif
         printf ("|---------------------------------|\n");
 
+	if (batchname != NULL)
+		{
+		FILE * script = stdin;
+		if (strcmp (batchname, "-") != 0)
+			script = fopen (batchname, "r");
+		if (script == NULL)
+			{
+			printf ("Could not open script %s\n", batchname);
+			retVal = -1;
+			}
+		else
+			{
+			retVal = runbatch (script, fltiming);
+			if (script != stdin)
+				fclose (script);
+			}
+		exitFileSystem();
+		closePartitionSystem();
+		return (retVal);
+		}
 	
 	while (1)
 		{
@@ -828,6 +1185,12 @@ int main (int argc, char * argv[])
 #ifdef COMMAND_DEBUG
 		printf ("%s\n", cmdin);
 #endif
+		if (cmdin == NULL)	//end of input behaves like exit
+			{
+			exitFileSystem();
+			closePartitionSystem();
+			break;
+			}
 		
 		cmd = malloc (strlen(cmdin) + 30);
 		strcpy (cmd, cmdin);
@@ -851,7 +1214,7 @@ int main (int argc, char * argv[])
 				{
 				add_history(cmd);
 				}
-			processcommand (cmd);
+			timedcommand (cmd, fltiming);
 			}
 				
 		free (cmd);
@@ -22,8 +22,8 @@
 #include <unistd.h>
 #include <time.h>
 
+#include <stdint.h>
 #include "b_io.h"
-#include "fsStruct.h"
 
 #include <dirent.h>
 #define FT_REGFILE	DT_REG
@@ -46,27 +46,36 @@ struct fs_diriteminfo
     char d_name[256]; 			/* filename max filename is 255 characters */
 	};
 
+// Returned by fs_readdirplus - the same item as fs_readdir plus the attributes
+// kept in the directory entry itself, so a long listing needs no fs_stat or
+// fs_isDir call (and no path lookup) per entry
+struct fs_diriteminfoplus
+	{
+	unsigned short d_reclen;    /* length of this record */
+	unsigned char fileType;
+	char d_name[256]; 			/* filename max filename is 255 characters */
+	off_t     st_size;    		/* total size, in bytes */
+	blkcnt_t  st_blocks;  		/* number of 512B blocks allocated */
+	time_t    st_modtime;   	/* time of last modification */
+	time_t    st_createtime;   	/* time of creation */
+	};
+
 // This is a private structure used only by fs_opendir, fs_readdir, and fs_closedir
 // Think of this like a file descriptor but for a directory - one can only read
-// from a directory.  This structure helps you (the file system) keep track of
-// which directory entry you are currently processing so that everytime the caller
-// calls the function readdir, you give the next entry in the directory
-typedef struct
-	{
-	unsigned short  d_reclen;		/* length of this record */
-	unsigned short	dirEntryPosition;	/* index within current DirBlock */
-	uint32_t	currentDirBlock;	/* LBA of current DirBlock */
-	DirBlock	cachedDir;		/* cached current DirBlock */
-	struct fs_diriteminfo * di;		/* result buffer returned by readdir */
-	} fdDir;
+// from a directory.  The library keeps track in it of which directory entry it
+// is currently processing, so that everytime the caller calls the function
+// readdir, it gives the next entry in the directory
+typedef struct fdDir fdDir;
 
 // Key directory functions
 int fs_mkdir(const char *pathname, mode_t mode);
 int fs_rmdir(const char *pathname);
+int fs_compactdir(const char *pathname);	// pack a directory, free its spare blocks
 
 // Directory iteration functions
 fdDir * fs_opendir(const char *pathname);
 struct fs_diriteminfo *fs_readdir(fdDir *dirp);
+struct fs_diriteminfoplus *fs_readdirplus(fdDir *dirp);
 int fs_closedir(fdDir *dirp);
 
 // Misc directory functions
@@ -75,6 +84,7 @@ int fs_setcwd(char *pathname);   //linux chdir
 int fs_isFile(char * filename);	//return 1 if file, 0 otherwise
 int fs_isDir(char * pathname);		//return 1 if directory, 0 otherwise
 int fs_delete(char* filename);	//removes a file
+int fs_rename(const char *srcPath, const char *dstPath);	//linux rename
 
 
 // This is the strucutre that is filled in from a call to fs_stat
@@ -92,5 +102,94 @@ struct fs_stat
 
 int fs_stat(const char *path, struct fs_stat *buf);
 
+// Directory handles for the *at calls.  A handle holds the resolved block
+// of its directory, so relative paths given with it never walk the
+// directory's ancestors again.  A NULL handle resolves like the plain
+// calls; absolute paths ignore the handle.
+typedef struct fdDirHandle fdDirHandle;
+
+fdDirHandle * fs_opendirh(fdDirHandle *dh, const char *pathname);
+int fs_closedirh(fdDirHandle *dh);
+fdDir * fs_fdopendir(fdDirHandle *dh);
+b_io_fd fs_openat(fdDirHandle *dh, const char *pathname, int flags);
+int fs_statat(fdDirHandle *dh, const char *pathname, struct fs_stat *buf);
+int fs_mkdirat(fdDirHandle *dh, const char *pathname, mode_t mode);
+int fs_unlinkat(fdDirHandle *dh, const char *pathname);
+int fs_renameat(fdDirHandle *olddh, const char *oldpath, fdDirHandle *newdh, const char *newpath);
+
+// Recursive walk of the tree below pathname (fs_walk).  Directory blocks
+// are read by a pool of worker threads; the callbacks run one at a time,
+// so they need no locks of their own, and may call into the file system.
+// pre sees a directory before its entries, post after all of them
+// (subtrees included), visit every other entry; a walk started at a
+// file only visits it.  A callback returns 0 to go on, < 0 to stop the
+// walk; pre may return > 0 to skip the directory (no entries, no post).
+// Returns 0, or -1 if stopped.
+typedef struct
+	{
+	const char *	path;		/* full path of the entry */
+	const char *	name;		/* its name, "/" for the volume root */
+	unsigned char	fileType;	/* FT_REGFILE or FT_DIRECTORY */
+	off_t		st_size;	/* total size, in bytes */
+	blkcnt_t	st_blocks;	/* number of 512B blocks allocated */
+	int		depth;		/* 0 for the entry the walk started at */
+	void **		data;		/* pre/post: the caller's slot for this directory */
+	void *		parentData;	/* the slot of the directory holding the entry */
+	} fs_walkentry;
+
+typedef int (*fs_walkfn)(const fs_walkentry *we, void *arg);
+
+typedef struct
+	{
+	fs_walkfn	pre;		/* directory, before its entries */
+	fs_walkfn	visit;		/* every entry that is not a directory */
+	fs_walkfn	post;		/* directory, after its entries */
+	void *		arg;		/* passed to every callback */
+	int		threads;	/* worker threads, 0 for the default */
+	} fs_walkops;
+
+int fs_walk(const char *pathname, const fs_walkops *ops);
+
+// Removes the entry a walk callback was given, without looking its path
+// up again: a file from visit, a directory from post once its entries
+// are gone.  The volume root is never removed
+int fs_walkunlink(const fs_walkentry *we);
+
+// Online defragmentation of the tree below pathname (fs_defrag).  A file
+// is fragmented when its blocks lie in more than one extent (run of
+// consecutive blocks) and in maxExtents or more for a file of the largest
+// size (120 blocks), proportionally fewer for a smaller one: a file of 30
+// blocks at maxExtents / 4.  A directory is fragmented when its chain of
+// blocks lies in more than one extent.
+// Fragmented files and chains are moved into one new extent each, unless
+// dryRun asks for the measurement only.  report, if given, is called with
+// every fragmented one.  Returns 0, or -1 if the walk failed
+typedef struct
+	{
+	unsigned	maxExtents;	/* file threshold, 0 for the default (8) */
+	int		dryRun;		/* measure, move nothing */
+	void		(*report)(const char *path, uint32_t before, uint32_t after,
+				  uint32_t blocks, void *arg);
+	void *		arg;		/* passed to report */
+	} fs_defragopts;
+
+typedef struct
+	{
+	uint64_t	files;		/* files looked at */
+	uint64_t	dirs;		/* directories looked at */
+	uint64_t	fragmented;	/* of them over the threshold */
+	uint64_t	moved;		/* of those moved into one extent */
+	uint64_t	blocksMoved;
+	uint64_t	extentsBefore;	/* extents of everything looked at */
+	uint64_t	extentsAfter;
+	} fs_defragstats;
+
+int fs_defrag(const char *pathname, const fs_defragopts *opts, fs_defragstats *stats);
+
+// Stats n paths in one call, sharing path resolution between them and
+// reading each directory block once in LBA order.  status[i] (if given)
+// is 0 or -1 per path; returns the number of paths found, -1 on bad args
+int fs_statv(const char *paths[], int n, struct fs_stat out[], int status[]);
+
 #endif
 
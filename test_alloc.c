@@ -0,0 +1,331 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: test_alloc.c
+ *
+ * Description:: Test program for block allocation on a fragmented
+ *	volume.  An fallocate must find a run of free blocks big enough
+ *	for all of it, wherever on the volume it is and across FAT
+ *	blocks, before taking the short runs near the file.  Threads
+ *	allocating at once never get the same block, and the free count
+ *	kept per allocation group agrees with the FAT, also while other
+ *	threads free blocks in batches.  Freed blocks are discarded, but
+ *	never once they have been allocated again.
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "basicfs.h"
+#include "fsStruct.h"
+
+#define TEST_VOLUME_SIZE 2000000
+#define TEST_BLOCK_SIZE 512
+#define FILL_PAIRS 64
+#define FILE_BLOCKS 120
+#define ALLOC_BLOCKS 100
+#define ALLOC_THREADS 8
+#define ALLOC_PER_THREAD 200
+#define FREE_BATCH 25
+#define DISCARD_FILE_BLOCKS 40
+#define DISCARD_ROUNDS 20
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+static uint64_t extentsOf(const char *path)
+{
+    fs_defragopts opts;
+    fs_defragstats stats;
+    memset(&opts, 0, sizeof(opts));
+    opts.dryRun = 1;
+    if (fs_defrag(path, &opts, &stats) != 0)
+        return 0;
+    return stats.extentsBefore;
+}
+
+// the free count the FAT itself gives, counted again by a remount
+static uint64_t remountFreeCount(void)
+{
+    exitFileSystem();
+    if (fs_mount() != 0)
+        return 0;
+    return fs_freeBlockCount();
+}
+
+// blocks one thread took: runs of 8 going on from its last block, and
+// single blocks near one goal all threads share, so they meet in its group
+typedef struct
+{
+    uint32_t blocks[ALLOC_PER_THREAD];
+    uint32_t n;
+    uint64_t sharedGoal;
+} allocWork;
+
+static pthread_barrier_t allocStart;
+
+static void *allocWorker(void *arg)
+{
+    allocWork *w = arg;
+    pthread_barrier_wait(&allocStart);
+    while (w->n < ALLOC_PER_THREAD)
+    {
+        uint32_t want = (w->n % 3 == 0) ? 8 : 1;
+        if (want > ALLOC_PER_THREAD - w->n)
+            want = ALLOC_PER_THREAD - w->n;
+        uint64_t goal = (want == 1) ? w->sharedGoal : (w->n ? w->blocks[w->n - 1] : 0);
+        uint32_t got = fs_allocateExtent(goal, want, w->blocks + w->n);
+        if (got == 0)
+            break;
+        w->n += got;
+    }
+    return NULL;
+}
+
+// threads allocating at once through the groups never get the same
+// block, and the groups' counts stay what the FAT says
+static void testParallelAllocate(uint64_t blocks)
+{
+    static allocWork work[ALLOC_THREADS];
+    pthread_t threads[ALLOC_THREADS];
+    uint64_t freeBefore = fs_freeBlockCount();
+    pthread_barrier_init(&allocStart, NULL, ALLOC_THREADS);
+    for (int t = 0; t < ALLOC_THREADS; t++)
+    {
+        work[t].sharedGoal = blocks / 2;
+        pthread_create(&threads[t], NULL, allocWorker, &work[t]);
+    }
+    uint32_t taken = 0;
+    for (int t = 0; t < ALLOC_THREADS; t++)
+    {
+        pthread_join(threads[t], NULL);
+        taken += work[t].n;
+    }
+    pthread_barrier_destroy(&allocStart);
+    check(taken == ALLOC_THREADS * ALLOC_PER_THREAD, "every thread gets its blocks");
+
+    uint8_t *seen = calloc(blocks, 1);
+    int twice = 0;
+    for (int t = 0; t < ALLOC_THREADS; t++)
+        for (uint32_t i = 0; i < work[t].n; i++)
+            twice += seen[work[t].blocks[i]]++ != 0;
+    free(seen);
+    check(twice == 0, "no block is given out twice");
+    check(fs_freeBlockCount() == freeBefore - taken, "the free count drops by the blocks taken");
+    check(remountFreeCount() == freeBefore - taken, "the FAT agrees with the free count");
+
+    for (int t = 0; t < ALLOC_THREADS; t++)
+        fs_freeBlocks(work[t].blocks, work[t].n);
+    check(fs_freeBlockCount() == freeBefore, "freeing them restores the free count");
+}
+
+// frees what a thread holds in batches from the end, each batch naming
+// one block twice
+static void *freeWorker(void *arg)
+{
+    allocWork *w = arg;
+    uint32_t batch[FREE_BATCH + 1];
+    pthread_barrier_wait(&allocStart);
+    while (w->n > 0)
+    {
+        uint32_t k = 0;
+        while (k < FREE_BATCH && w->n > 0)
+            batch[k++] = w->blocks[--w->n];
+        batch[k] = batch[0];
+        fs_freeBlocks(batch, k + 1);
+    }
+    return NULL;
+}
+
+// half the threads free their blocks in batches while the other half
+// allocate: the count stays what the FAT says.  A batch in one FAT
+// block writes it once
+static void testParallelFree(uint64_t blocks)
+{
+    static allocWork work[ALLOC_THREADS];
+    pthread_t threads[ALLOC_THREADS];
+    uint64_t freeBefore = fs_freeBlockCount();
+    memset(work, 0, sizeof(work));
+    for (int t = 0; t < ALLOC_THREADS / 2; t++)
+        work[t].n = fs_allocateExtent(0, ALLOC_PER_THREAD, work[t].blocks);
+    pthread_barrier_init(&allocStart, NULL, ALLOC_THREADS);
+    for (int t = 0; t < ALLOC_THREADS; t++)
+    {
+        work[t].sharedGoal = work[0].blocks[0];
+        pthread_create(&threads[t], NULL, (t < ALLOC_THREADS / 2) ? freeWorker : allocWorker, &work[t]);
+    }
+    uint32_t held = 0;
+    for (int t = 0; t < ALLOC_THREADS; t++)
+    {
+        pthread_join(threads[t], NULL);
+        held += work[t].n;
+    }
+    pthread_barrier_destroy(&allocStart);
+    check(held == ALLOC_THREADS / 2 * ALLOC_PER_THREAD, "the allocating threads get their blocks");
+    check(fs_freeBlockCount() == freeBefore - held, "the free count is right after freeing and allocating at once");
+    check(remountFreeCount() == freeBefore - held, "the FAT agrees with it");
+
+    LBAstats before, after;
+    uint32_t run[FREE_BATCH];
+    // at the start of a FAT block near the end, which nothing took
+    uint64_t goal = (blocks / FAT_ENTRIES_PER_BLOCK - 2) * FAT_ENTRIES_PER_BLOCK;
+    uint32_t got = fs_allocateExtent(goal, FREE_BATCH, run);
+    LBAgetStats(&before);
+    fs_freeBlocks(run, got);
+    LBAgetStats(&after);
+    check(got == FREE_BATCH && run[0] / FAT_ENTRIES_PER_BLOCK == run[got - 1] / FAT_ENTRIES_PER_BLOCK &&
+          after.blocksWritten - before.blocksWritten == 1,
+          "freeing a batch in one FAT block writes it once");
+    for (int t = 0; t < ALLOC_THREADS; t++)
+        fs_freeBlocks(work[t].blocks, work[t].n);
+    check(fs_freeBlockCount() == freeBefore, "freeing the rest restores the free count");
+}
+
+// a deleted file's blocks are discarded.  Blocks freed and taken again
+// at once, before or while their discard runs, keep what is written to
+// them: the discard of a RAM volume would zero them
+static void testDiscard(uint64_t blocks)
+{
+    char block[TEST_BLOCK_SIZE];
+    LBAstats before, after;
+    uint64_t freeBefore = fs_freeBlockCount();
+    memset(block, 'd', sizeof(block));
+    b_io_fd fd = b_open("/discarded", O_RDWR | O_CREAT);
+    for (int i = 0; i < DISCARD_FILE_BLOCKS; i++)
+        b_write(fd, block, sizeof(block));
+    b_close(fd);
+    fs_discardFlush();
+    LBAgetStats(&before);
+    fs_delete("/discarded");
+    fs_discardFlush();
+    LBAgetStats(&after);
+    check(fs_freeBlockCount() == freeBefore, "the deleted file's blocks are free");
+    check(after.blocksDiscarded - before.blocksDiscarded >= DISCARD_FILE_BLOCKS,
+          "the deleted file's blocks are discarded");
+
+    uint32_t run[FREE_BATCH], again[FREE_BATCH];
+    char got[TEST_BLOCK_SIZE];
+    uint64_t goal = (blocks / FAT_ENTRIES_PER_BLOCK - 2) * FAT_ENTRIES_PER_BLOCK;
+    int same = 1, kept = 1;
+    for (int r = 0; r < DISCARD_ROUNDS; r++)
+    {
+        uint32_t n = fs_allocateExtent(goal, FREE_BATCH, run);
+        fs_freeBlocks(run, n);
+        uint32_t m = fs_allocateExtent(goal, FREE_BATCH, again);
+        same = same && n == FREE_BATCH && m == n && memcmp(run, again, n * sizeof(uint32_t)) == 0;
+        memset(block, 'a' + r, sizeof(block));
+        for (uint32_t i = 0; i < m; i++)
+            LBAwrite(block, 1, again[i]);
+        fs_discardFlush();
+        for (uint32_t i = 0; i < m; i++)
+        {
+            LBAread(got, 1, again[i]);
+            kept = kept && memcmp(got, block, sizeof(got)) == 0;
+        }
+        fs_freeBlocks(again, m);
+    }
+    check(same, "blocks freed are taken again at once");
+    check(kept, "a reallocated block is never discarded");
+    fs_discardFlush();
+    check(fs_freeBlockCount() == freeBefore, "the free count is back");
+}
+
+// fills the volume with pairs of files written a block at a time each,
+// so their blocks alternate, then removes one file of every pair: the
+// free space left is single blocks, but for the one pair removed whole
+static int fragmentVolume(void)
+{
+    char block[TEST_BLOCK_SIZE];
+    char name[32];
+    int pairs = 0;
+    memset(block, 'f', sizeof(block));
+    for (int full = 0; !full && pairs < FILL_PAIRS; pairs++)
+    {
+        snprintf(name, sizeof(name), "/a%d", pairs);
+        b_io_fd a = b_open(name, O_RDWR | O_CREAT);
+        snprintf(name, sizeof(name), "/b%d", pairs);
+        b_io_fd b = b_open(name, O_RDWR | O_CREAT);
+        if (a < 0 || b < 0)
+            return -1;
+        for (int i = 0; i < FILE_BLOCKS && !full; i++)
+        {
+            full = b_write(a, block, sizeof(block)) != sizeof(block) || b_fsync(a) != 0 ||
+                   b_write(b, block, sizeof(block)) != sizeof(block) || b_fsync(b) != 0;
+        }
+        b_close(a);
+        b_close(b);
+    }
+    for (int p = 0; p < pairs; p++)
+    {
+        snprintf(name, sizeof(name), "/b%d", p);
+        fs_delete(name);
+    }
+    snprintf(name, sizeof(name), "/a%d", pairs / 2);
+    fs_delete(name);
+    return pairs;
+}
+
+// fallocate takes the one run that holds all the blocks
+static void testFallocateOneExtent(void)
+{
+    int pairs = fragmentVolume();
+    check(pairs > 2, "volume fragmented");
+    check(extentsOf("/a0") > 1, "the files left are fragmented");
+
+    b_io_fd fd = b_open("/big", O_RDWR | O_CREAT);
+    check(b_fallocate(fd, 0, ALLOC_BLOCKS * TEST_BLOCK_SIZE, 0) == 0, "fallocate on a fragmented volume");
+    b_close(fd);
+    check(extentsOf("/big") == 1, "fallocate takes one extent");
+}
+
+int main()
+{
+    uint64_t volSize = TEST_VOLUME_SIZE;
+    uint64_t blkSize = TEST_BLOCK_SIZE;
+    printf("Allocation Test Program\n");
+    printf("=======================\n\n");
+
+    if (startPartitionSystem(LBA_RAM_VOLUME, &volSize, &blkSize) != PART_NOERROR ||
+        initFileSystem(volSize / blkSize, blkSize) != 0)
+    {
+        printf("Could not start a RAM volume\n");
+        return 1;
+    }
+    testFallocateOneExtent();
+    // the threads start from a freshly formatted volume
+    exitFileSystem();
+    if (initFileSystem(volSize / blkSize, blkSize) != 0)
+    {
+        printf("Could not format the RAM volume again\n");
+        return 1;
+    }
+    testParallelAllocate(volSize / blkSize);
+    testParallelFree(volSize / blkSize);
+    testDiscard(volSize / blkSize);
+    exitFileSystem();
+    closePartitionSystem();
+
+    if (failures == 0)
+    {
+        printf("Test program completed successfully!\n");
+    }
+    else
+    {
+        printf("Test program failed! (%d checks)\n", failures);
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,307 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: test_dir.c
+ *
+ * Description:: Test program for directory operations against what
+ *	else holds the directory: a directory open as a handle must not
+ *	be removed.  A directory must not move into its own subtree.  A
+ *	directory read by fs_readdir must keep the blocks the stream goes
+ *	on into, while the entries in them are removed.  fs_statv must
+ *	resolve relative paths from the current directory itself, even
+ *	once it was renamed, and fs_getcwd report its new path.  A name
+ *	missing from a directory of many blocks is ruled out by the
+ *	directory's filter, before and after the filter is rebuilt.
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include "basicfs.h"
+#include "fsStruct.h"
+
+#define TEST_VOLUME_SIZE 10000000
+#define TEST_BLOCK_SIZE 512
+#define READDIR_FILES 200
+#define BLOOM_FILES 100
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+// a directory open as a handle stays until the handle is closed
+static void testHandlePinsDir(void)
+{
+    fs_mkdir("/held", 0777);
+    fdDirHandle *dh = fs_opendirh(NULL, "/held");
+    fdDirHandle *dh2 = fs_opendirh(NULL, "/held");
+    check(dh != NULL && dh2 != NULL, "open two handles on a directory");
+    check(fs_rmdir("/held") != 0, "rmdir of a directory open as a handle fails");
+    fs_mkdir("/other", 0777);
+    check(fs_rename("/other", "/held") != 0, "rename over a directory open as a handle fails");
+    fs_closedirh(dh);
+    check(fs_rmdir("/held") != 0, "rmdir fails while one handle is left");
+
+    b_io_fd fd = fs_openat(dh2, "f", O_RDWR | O_CREAT);
+    check(fd >= 0, "the handle still resolves");
+    b_close(fd);
+    fs_unlinkat(dh2, "f");
+    fs_closedirh(dh2);
+    check(fs_rmdir("/held") == 0, "rmdir once the handles are closed");
+    check(fs_rmdir("/other") == 0, "rmdir of a directory never held");
+}
+
+// a directory moved below itself would cut its subtree off the tree
+static void testRenameIntoSubtree(void)
+{
+    fs_mkdir("/top", 0777);
+    fs_mkdir("/top/mid", 0777);
+    fs_mkdir("/top/mid/low", 0777);
+    check(fs_rename("/top", "/top/x") != 0, "rename a directory into itself fails");
+    check(fs_rename("/top", "/top/mid/low/x") != 0, "rename a directory into its subtree fails");
+    check(fs_rename("/top/mid", "/top/mid/low/x") != 0, "rename a subdirectory below itself fails");
+    check(fs_isDir("/top/mid/low") == 1, "the tree is left as it was");
+    check(fs_rename("/top/mid/low", "/low") == 0, "rename a directory up the tree");
+    check(fs_rename("/low", "/top/mid/low") == 0, "rename a directory into a sibling's subtree");
+    check(fs_isDir("/top/mid/low") == 1, "the directory is back in place");
+}
+
+// removing every entry of the blocks a stream has yet to read, then
+// a file replaced by a rename stays whole for a descriptor holding it
+// open, and closing that descriptor writes nowhere else
+static void testRenameOverOpen(void)
+{
+    char buf[16];
+    b_io_fd old = b_open("/live", O_RDWR | O_CREAT);
+    b_write(old, "AAAA", 4);
+    b_io_fd t = b_open("/live.tmp", O_RDWR | O_CREAT);
+    b_write(t, "NNNN", 4);
+    b_close(t);
+    check(fs_rename("/live.tmp", "/live") == 0, "rename over a file held open");
+    b_io_fd v = b_open("/victim", O_RDWR | O_CREAT);
+    b_write(v, "VVVVVVVV", 8);
+    b_close(v);
+    b_seek(old, 0, SEEK_SET);
+    memset(buf, 0, sizeof(buf));
+    check(b_read(old, buf, 4) == 4 && memcmp(buf, "AAAA", 4) == 0, "the old file reads on through its descriptor");
+    b_write(old, "BBBB", 4);
+    b_close(old);
+
+    memset(buf, 0, sizeof(buf));
+    v = b_open("/victim", O_RDONLY);
+    check(b_read(v, buf, sizeof(buf)) == 8 && memcmp(buf, "VVVVVVVV", 8) == 0, "closing it leaves another file alone");
+    b_close(v);
+    memset(buf, 0, sizeof(buf));
+    v = b_open("/live", O_RDONLY);
+    check(b_read(v, buf, sizeof(buf)) == 4 && memcmp(buf, "NNNN", 4) == 0, "the new file is what the name holds");
+    b_close(v);
+    fs_delete("/victim");
+    fs_delete("/live");
+}
+
+// reusing the space, leaves the entries after them readable
+static void testReaddirAcrossRemovedBlocks(void)
+{
+    char name[32], data[TEST_BLOCK_SIZE];
+    int seen[READDIR_FILES];
+    memset(seen, 0, sizeof(seen));
+    memset(data, 'z', sizeof(data));
+    fs_mkdir("/many", 0777);
+    for (int i = 0; i < READDIR_FILES; i++)
+    {
+        snprintf(name, sizeof(name), "/many/f%03d", i);
+        b_close(b_open(name, O_RDWR | O_CREAT));
+    }
+    fdDir *dirp = fs_opendir("/many");
+    check(dirp != NULL, "open a stream on a directory of many blocks");
+    struct fs_diriteminfo *di = NULL;
+    for (int k = 0; k < 5; k++)
+        di = fs_readdir(dirp);
+    check(di != NULL, "read the first entries");
+    for (int i = READDIR_FILES / 20; i < READDIR_FILES * 3 / 4; i++)
+    {
+        snprintf(name, sizeof(name), "/many/f%03d", i);
+        fs_delete(name);
+    }
+    check(fs_compactdir("/many") != 0, "compact fails while a stream reads the directory");
+    check(fs_rmdir("/many") != 0, "rmdir fails while a stream reads the directory");
+    // new files next to the directory take the space the entries took
+    for (int i = 0; i < READDIR_FILES / 2; i++)
+    {
+        snprintf(name, sizeof(name), "/many/g%03d", i);
+        b_io_fd fd = b_open(name, O_RDWR | O_CREAT);
+        b_write(fd, data, sizeof(data));
+        b_close(fd);
+    }
+    int bad = 0;
+    while ((di = fs_readdir(dirp)) != NULL)
+    {
+        int i;
+        if (sscanf(di->d_name, "f%d", &i) == 1 && i >= 0 && i < READDIR_FILES)
+            seen[i] = 1;
+        else if (di->d_name[0] != 'g' && strcmp(di->d_name, ".") != 0 && strcmp(di->d_name, "..") != 0)
+            bad++;
+    }
+    fs_closedir(dirp);
+    int missing = 0;
+    for (int i = READDIR_FILES * 3 / 4; i < READDIR_FILES; i++)
+        missing += !seen[i];
+    check(bad == 0, "the stream returns no names that were never there");
+    check(missing == 0, "the stream returns the entries after the removed ones");
+
+    for (int i = 0; i < READDIR_FILES; i++)
+    {
+        snprintf(name, sizeof(name), "/many/f%03d", i);
+        fs_delete(name);
+        snprintf(name, sizeof(name), "/many/g%03d", i);
+        fs_delete(name);
+    }
+    check(fs_rmdir("/many") == 0, "rmdir once the stream is closed and the entries gone");
+}
+
+// relative paths in fs_statv resolve from the cwd, not from its path
+static void testStatvRelative(void)
+{
+    fs_mkdir("/cwd1", 0777);
+    fs_mkdir("/cwd1/sub", 0777);
+    fs_setcwd("/cwd1");
+    b_io_fd fd = b_open("x", O_RDWR | O_CREAT);
+    b_write(fd, "hello", 5);
+    b_close(fd);
+    fd = b_open("sub/y", O_RDWR | O_CREAT);
+    b_write(fd, "hi", 2);
+    b_close(fd);
+    // the cwd moves, its path follows
+    check(fs_rename("/cwd1", "/cwd2") == 0, "rename the current directory");
+    char cwd[256];
+    check(fs_getcwd(cwd, sizeof(cwd)) != NULL && strcmp(cwd, "/cwd2") == 0, "fs_getcwd reports the new name");
+
+    const char *paths[] = {"x", "sub/y", "/cwd2/x", "../cwd2/sub/y", "nope", "./x"};
+    off_t sizes[] = {5, 2, 5, 2, -1, 5};
+    int n = sizeof(paths) / sizeof(paths[0]);
+    struct fs_stat out[6];
+    int status[6];
+    int found = fs_statv(paths, n, out, status);
+    check(found == n - 1, "fs_statv finds every path that exists");
+    int same = 1;
+    for (int i = 0; i < n; i++)
+    {
+        struct fs_stat st;
+        int rc = fs_stat(paths[i], &st);
+        if (rc != status[i] || (rc == 0 && (out[i].st_size != sizes[i] || st.st_size != sizes[i])))
+            same = 0;
+    }
+    check(same, "fs_statv agrees with fs_stat on relative paths");
+
+    // so does a directory above it, and cd goes on from there
+    check(fs_setcwd("sub") == 0, "cd into a subdirectory");
+    fs_rename("/cwd2", "/cwd3");
+    check(fs_getcwd(cwd, sizeof(cwd)) != NULL && strcmp(cwd, "/cwd3/sub") == 0, "fs_getcwd follows a renamed parent");
+    check(fs_setcwd("..") == 0 && fs_getcwd(cwd, sizeof(cwd)) != NULL && strcmp(cwd, "/cwd3") == 0,
+          "a relative cd starts from the current path");
+    fs_setcwd("/");
+}
+
+// blocks read by a lookup of name in dirBlock that skips the name cache
+static uint64_t lookupReads(uint32_t dirBlock, const char *name, int *found)
+{
+    LBAstats before, after;
+    DirEntry e;
+    uint32_t index;
+    LBAgetStats(&before);
+    *found = (fs_findInDir(dirBlock, name, &e, &index) == 0);
+    LBAgetStats(&after);
+    return after.blocksRead - before.blocksRead;
+}
+
+// a name missing from a directory of many blocks costs its head block,
+// the filter answers for the rest of the chain; also once half of the
+// names were removed and the filter was rebuilt without them
+static void testBloomNegativeLookup(void)
+{
+    char name[32];
+    DirEntry dir;
+    int found;
+    fs_mkdir("/bloom", 0777);
+    for (int i = 0; i < BLOOM_FILES; i++)
+    {
+        snprintf(name, sizeof(name), "/bloom/f%03d", i);
+        fs_createFile(name, FT_FILE);
+    }
+    check(fs_findFile("/bloom", &dir) == 0, "find the directory");
+    uint64_t chain = lookupReads(dir.startBlock, "f099", &found);
+    check(found && chain > 2, "the last name lies blocks down the chain");
+    uint64_t miss = lookupReads(dir.startBlock, "nothere", &found);
+    check(!found && miss == 1, "a missing name reads the head block only");
+
+    for (int i = 0; i < BLOOM_FILES * 3 / 4; i++)
+    {
+        snprintf(name, sizeof(name), "/bloom/f%03d", i);
+        fs_delete(name);
+    }
+    uint64_t reads = 0;
+    int wrong = 0;
+    for (int i = 0; i < BLOOM_FILES / 2; i++)
+    {
+        snprintf(name, sizeof(name), "f%03d", i);
+        reads += lookupReads(dir.startBlock, name, &found);
+        wrong += found;
+    }
+    check(wrong == 0, "removed names are not found");
+    check(reads <= BLOOM_FILES / 2 + 2, "after the rebuild removed names read the head block only");
+    for (int i = BLOOM_FILES * 3 / 4; i < BLOOM_FILES; i++)
+    {
+        snprintf(name, sizeof(name), "f%03d", i);
+        lookupReads(dir.startBlock, name, &found);
+        wrong += !found;
+        snprintf(name, sizeof(name), "/bloom/f%03d", i);
+        fs_delete(name);
+    }
+    check(wrong == 0, "the rebuilt filter keeps the names left");
+    check(fs_rmdir("/bloom") == 0, "rmdir of the emptied directory");
+}
+
+int main()
+{
+    uint64_t volSize = TEST_VOLUME_SIZE;
+    uint64_t blkSize = TEST_BLOCK_SIZE;
+    printf("Directory Test Program\n");
+    printf("======================\n\n");
+
+    if (startPartitionSystem(LBA_RAM_VOLUME, &volSize, &blkSize) != PART_NOERROR ||
+        initFileSystem(volSize / blkSize, blkSize) != 0)
+    {
+        printf("Could not start a RAM volume\n");
+        return 1;
+    }
+    testHandlePinsDir();
+    testRenameIntoSubtree();
+    testRenameOverOpen();
+    testReaddirAcrossRemovedBlocks();
+    testStatvRelative();
+    testBloomNegativeLookup();
+    exitFileSystem();
+    closePartitionSystem();
+
+    if (failures == 0)
+    {
+        printf("Test program completed successfully!\n");
+    }
+    else
+    {
+        printf("Test program failed! (%d checks)\n", failures);
+    }
+    return failures == 0 ? 0 : 1;
+}
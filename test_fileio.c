@@ -0,0 +1,299 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: test_fileio.c
+ *
+ * Description:: Test program for buffered file I/O with several
+ *	descriptors open on one file.  Writes held back by delayed
+ *	allocation must merge with what the other descriptors wrote, and
+ *	a truncate by one descriptor must drop what another still holds
+ *	back from before it.  Closing a descriptor must never put an
+ *	older size back into the directory entry.  A file deleted while
+ *	open stays readable through its descriptors and its blocks are freed
+ *	by the last close, never written over another file's.  A file's
+ *	st_blocks count the blocks it has, holes left out.  Holes read as
+ *	zeros, SEEK_DATA and SEEK_HOLE find them, and a punched block is
+ *	free again.
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include "basicfs.h"
+#include "fsStruct.h"
+
+#define TEST_VOLUME_SIZE 10000000
+#define TEST_BLOCK_SIZE 512
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+// reads count bytes at offset of path into buf, returns the bytes read
+static int readAt(const char *path, off_t offset, char *buf, int count)
+{
+    b_io_fd fd = b_open((char *)path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    b_seek(fd, offset, SEEK_SET);
+    int n = b_read(fd, buf, count);
+    b_close(fd);
+    return n;
+}
+
+static off_t sizeOf(const char *path)
+{
+    struct fs_stat st;
+    return (fs_stat(path, &st) == 0) ? st.st_size : -1;
+}
+
+static int blocksVisit(const fs_walkentry *we, void *arg)
+{
+    *(blkcnt_t *)arg = we->st_blocks;
+    return 0;
+}
+
+// st_blocks of a file as fs_walk (and so du) reports it
+static blkcnt_t blocksOf(const char *path)
+{
+    blkcnt_t blocks = -1;
+    fs_walkops ops = {NULL, blocksVisit, NULL, &blocks, 1};
+    return (fs_walk(path, &ops) == 0) ? blocks : -1;
+}
+
+// two descriptors write different bytes of one pending block
+static void testMergePending(void)
+{
+    char buf[TEST_BLOCK_SIZE];
+    b_io_fd a = b_open("/merge", O_RDWR | O_CREAT);
+    b_io_fd b = b_open("/merge", O_RDWR);
+    b_seek(a, 100, SEEK_SET);
+    b_write(a, "AAAAAAAAAA", 10);
+    b_write(b, "BBBBBBBBBB", 10);
+    b_close(b);
+    b_close(a);
+    memset(buf, 0, sizeof(buf));
+    int n = readAt("/merge", 0, buf, sizeof(buf));
+    check(n == 110, "merged file is 110 bytes");
+    check(memcmp(buf, "BBBBBBBBBB", 10) == 0, "first descriptor's bytes survive");
+    check(memcmp(buf + 100, "AAAAAAAAAA", 10) == 0, "second descriptor's bytes survive");
+    check(buf[50] == 0, "bytes neither wrote read as zeros");
+
+    // the same across blocks, closed in the other order
+    a = b_open("/merge2", O_RDWR | O_CREAT);
+    b = b_open("/merge2", O_RDWR);
+    b_seek(a, 3 * TEST_BLOCK_SIZE - 5, SEEK_SET);
+    b_write(a, "0123456789", 10);
+    b_seek(b, 3 * TEST_BLOCK_SIZE - 10, SEEK_SET);
+    b_write(b, "abcde", 5);
+    b_close(a);
+    b_close(b);
+    n = readAt("/merge2", 3 * TEST_BLOCK_SIZE - 10, buf, 15);
+    check(n == 15 && memcmp(buf, "abcde0123456789", 15) == 0, "merge across a block boundary");
+}
+
+// a truncate by one descriptor drops what another holds back
+static void testTruncatePending(void)
+{
+    char buf[3000];
+    memset(buf, 'x', sizeof(buf));
+    b_io_fd a = b_open("/trunc", O_RDWR | O_CREAT);
+    b_write(a, buf, sizeof(buf));
+    b_io_fd b = b_open("/trunc", O_RDWR | O_TRUNC);
+    b_close(b);
+    b_close(a);
+    check(sizeOf("/trunc") == 0, "O_TRUNC by another descriptor empties the file");
+
+    // writes after the truncate stay, at the writer's position
+    a = b_open("/trunc", O_RDWR);
+    b_write(a, buf, 1000);
+    b = b_open("/trunc", O_RDWR | O_TRUNC);
+    b_close(b);
+    b_write(a, "tail", 4);
+    b_close(a);
+    check(sizeOf("/trunc") == 1004, "a write after the truncate extends from the writer's position");
+    memset(buf, 1, sizeof(buf));
+    int n = readAt("/trunc", 0, buf, 1004);
+    check(n == 1004 && buf[0] == 0 && buf[999] == 0 && memcmp(buf + 1000, "tail", 4) == 0,
+          "the cut bytes read as zeros");
+}
+
+// closing a descriptor leaves the size the others made
+static void testCloseKeepsSize(void)
+{
+    char buf[1000];
+    memset(buf, 'y', sizeof(buf));
+    b_io_fd w = b_open("/size", O_RDWR | O_CREAT);
+    b_io_fd r = b_open("/size", O_RDONLY);
+    b_write(w, buf, sizeof(buf));
+    b_close(w);
+    b_close(r);
+    check(sizeOf("/size") == 1000, "a reader closing last keeps the writer's size");
+
+    w = b_open("/size", O_RDWR);
+    b_seek(w, 0, SEEK_END);
+    b_write(w, buf, 100);
+    b_fsync(w);
+    r = b_open("/size", O_RDONLY);
+    check(fs_setFileSize("/size", 10) == 0, "truncate with descriptors open");
+    b_close(r);
+    check(sizeOf("/size") == 10, "a reader closing keeps the truncated size");
+    b_close(w);
+    check(sizeOf("/size") == 10, "a writer closing keeps the truncated size");
+
+    // stat sees what was flushed without any close
+    w = b_open("/size", O_RDWR);
+    b_seek(w, 0, SEEK_END);
+    b_write(w, buf, 500);
+    b_fsync(w);
+    check(sizeOf("/size") == 510, "stat sees the size after b_fsync");
+    b_close(w);
+}
+
+// a file deleted while open lives on until its last descriptor closes
+static void testDeleteOpen(void)
+{
+    char buf[16];
+    uint64_t freeBefore = fs_freeBlockCount();
+    b_io_fd a = b_open("/gone", O_RDWR | O_CREAT);
+    b_write(a, "AAAA", 4);
+    check(fs_delete("/gone") == 0, "delete a file with a descriptor open");
+    b_io_fd v = b_open("/victim", O_RDWR | O_CREAT);
+    b_write(v, "VVVVVVVV", 8);
+    b_close(v);
+    b_seek(a, 0, SEEK_SET);
+    memset(buf, 0, sizeof(buf));
+    check(b_read(a, buf, 4) == 4 && memcmp(buf, "AAAA", 4) == 0, "the open descriptor still reads its data");
+    b_write(a, "BBBB", 4);
+    b_close(a);
+    memset(buf, 0, sizeof(buf));
+    int n = readAt("/victim", 0, buf, sizeof(buf));
+    check(n == 8 && memcmp(buf, "VVVVVVVV", 8) == 0, "closing it leaves another file alone");
+    fs_delete("/victim");
+    check(fs_freeBlockCount() == freeBefore, "the last close frees the deleted file");
+
+    // one that never wrote does not take over a new file of that name
+    a = b_open("/gone", O_RDWR | O_CREAT);
+    fs_delete("/gone");
+    v = b_open("/gone", O_RDWR | O_CREAT);
+    b_write(v, "VVVVVVVV", 8);
+    b_close(v);
+    b_write(a, "AAAA", 4);
+    b_close(a);
+    n = readAt("/gone", 0, buf, sizeof(buf));
+    check(n == 8 && memcmp(buf, "VVVVVVVV", 8) == 0, "a deleted file's writes stay out of its successor");
+    fs_delete("/gone");
+    check(fs_freeBlockCount() == freeBefore, "its own header is freed on close");
+}
+
+// du counts the blocks a file has, not its size
+static void testAllocatedBlocks(void)
+{
+    b_io_fd fd = b_open("/holes", O_RDWR | O_CREAT);
+    b_write(fd, "x", 1);
+    b_seek(fd, 50 * TEST_BLOCK_SIZE, SEEK_SET);
+    b_write(fd, "y", 1);
+    b_close(fd);
+    check(blocksOf("/holes") == 3, "a file with a hole counts its header and two data blocks");
+
+    fd = b_open("/prealloc", O_RDWR | O_CREAT);
+    b_fallocate(fd, 0, 10 * TEST_BLOCK_SIZE, B_FALLOC_KEEP_SIZE);
+    b_close(fd);
+    check(sizeOf("/prealloc") == 0 && blocksOf("/prealloc") == 11, "blocks preallocated past the size count");
+    fs_delete("/holes");
+    fs_delete("/prealloc");
+}
+
+// a file with a hole: zeros in it, SEEK_DATA and SEEK_HOLE around it,
+// and a punched block back with the allocator
+static void testSparse(void)
+{
+    char buf[TEST_BLOCK_SIZE];
+    char zeros[TEST_BLOCK_SIZE];
+    memset(zeros, 0, sizeof(zeros));
+    memset(buf, 'a', sizeof(buf));
+    b_io_fd fd = b_open("/sparse", O_RDWR | O_CREAT);
+    b_write(fd, buf, TEST_BLOCK_SIZE);
+    b_seek(fd, 10 * TEST_BLOCK_SIZE, SEEK_SET);
+    memset(buf, 'b', sizeof(buf));
+    b_write(fd, buf, TEST_BLOCK_SIZE);
+    b_fsync(fd);
+    off_t size = 11 * TEST_BLOCK_SIZE;
+    check(sizeOf("/sparse") == size, "writing past a hole sets the size");
+
+    memset(buf, 1, sizeof(buf));
+    check(readAt("/sparse", 3 * TEST_BLOCK_SIZE + 7, buf, TEST_BLOCK_SIZE) == TEST_BLOCK_SIZE &&
+          memcmp(buf, zeros, TEST_BLOCK_SIZE) == 0, "a hole reads as zeros");
+
+    check(b_seek(fd, 0, SEEK_DATA) == 0, "SEEK_DATA in data stays put");
+    check(b_seek(fd, 0, SEEK_HOLE) == TEST_BLOCK_SIZE, "SEEK_HOLE finds the hole after the data");
+    check(b_seek(fd, 600, SEEK_DATA) == 10 * TEST_BLOCK_SIZE, "SEEK_DATA skips the hole");
+    check(b_seek(fd, 600, SEEK_HOLE) == 600, "SEEK_HOLE in a hole stays put");
+    check(b_seek(fd, 10 * TEST_BLOCK_SIZE, SEEK_HOLE) == size, "SEEK_HOLE finds the end of the file");
+    check(b_seek(fd, size, SEEK_DATA) == -1 && b_seek(fd, size, SEEK_HOLE) == -1,
+          "SEEK_DATA and SEEK_HOLE at the end of the file fail");
+    check(b_seek(fd, size + 1000, SEEK_DATA) == -1 && b_seek(fd, size + 1000, SEEK_HOLE) == -1,
+          "SEEK_DATA and SEEK_HOLE past the end of the file fail");
+
+    uint64_t freeBefore = fs_freeBlockCount();
+    check(b_fallocate(fd, 10 * TEST_BLOCK_SIZE, TEST_BLOCK_SIZE, B_FALLOC_PUNCH_HOLE | B_FALLOC_KEEP_SIZE) == 0,
+          "punch the last block");
+    check(fs_freeBlockCount() == freeBefore + 1, "the punched block is free again");
+    check(b_seek(fd, 600, SEEK_DATA) == -1, "no data is left past the first block");
+    b_fallocate(fd, 100, 200, B_FALLOC_PUNCH_HOLE | B_FALLOC_KEEP_SIZE);
+    check(fs_freeBlockCount() == freeBefore + 1, "punching part of a block frees nothing");
+    b_close(fd);
+    check(sizeOf("/sparse") == size, "punching keeps the size");
+    memset(buf, 1, sizeof(buf));
+    check(readAt("/sparse", 0, buf, TEST_BLOCK_SIZE) == TEST_BLOCK_SIZE && buf[99] == 'a' &&
+          memcmp(buf + 100, zeros, 200) == 0 && buf[300] == 'a', "a partly punched block reads zeros in the range");
+    memset(buf, 1, sizeof(buf));
+    check(readAt("/sparse", 10 * TEST_BLOCK_SIZE, buf, TEST_BLOCK_SIZE) == TEST_BLOCK_SIZE &&
+          memcmp(buf, zeros, TEST_BLOCK_SIZE) == 0, "the punched block reads as zeros");
+    fs_delete("/sparse");
+}
+
+int main()
+{
+    uint64_t volSize = TEST_VOLUME_SIZE;
+    uint64_t blkSize = TEST_BLOCK_SIZE;
+    printf("File I/O Test Program\n");
+    printf("=====================\n\n");
+
+    if (startPartitionSystem(LBA_RAM_VOLUME, &volSize, &blkSize) != PART_NOERROR ||
+        initFileSystem(volSize / blkSize, blkSize) != 0)
+    {
+        printf("Could not start a RAM volume\n");
+        return 1;
+    }
+    testMergePending();
+    testTruncatePending();
+    testCloseKeepsSize();
+    testDeleteOpen();
+    testAllocatedBlocks();
+    testSparse();
+    exitFileSystem();
+    closePartitionSystem();
+
+    if (failures == 0)
+    {
+        printf("Test program completed successfully!\n");
+    }
+    else
+    {
+        printf("Test program failed! (%d checks)\n", failures);
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,221 @@
+/**************************************************************
+ * Class::  CSC-415-01 Fall 2025
+ * Name:: Ian Wang
+ * Student IDs:: 924005755
+ * GitHub-Name:: IannnWENG
+ * Group-Name:: BobaTea
+ * Project:: Basic File System
+ *
+ * File:: test_walk.c
+ *
+ * Description:: Test program for the parallel tree walk, driven the
+ *	way the shell's find, du and rm -r drive it, on a nested tree
+ *	with a directory of several blocks.  Every entry must be seen
+ *	once, a directory's pre before its entries and its post after
+ *	them, so per-directory totals add up; and removing as the walk
+ *	goes must leave nothing behind.
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include "basicfs.h"
+#include "fsStruct.h"
+
+#define TEST_VOLUME_SIZE 10000000
+#define TEST_BLOCK_SIZE 512
+#define WIDE_FILES 60
+#define MAX_SEEN 128
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+// paths of the entries a walk gave, in order
+typedef struct
+{
+    char paths[MAX_SEEN][64];
+    int count;
+    int outOfOrder; // an entry came before its directory's pre
+} seenList;
+
+static int seenIndex(const seenList *s, const char *path)
+{
+    for (int i = 0; i < s->count; i++)
+        if (strcmp(s->paths[i], path) == 0)
+            return i;
+    return -1;
+}
+
+static void makeFile(const char *path, int blocks)
+{
+    char buf[TEST_BLOCK_SIZE];
+    memset(buf, 'w', sizeof(buf));
+    b_io_fd fd = b_open((char *)path, O_RDWR | O_CREAT);
+    for (int i = 0; i < blocks; i++)
+        b_write(fd, buf, sizeof(buf));
+    b_close(fd);
+}
+
+// /w/a holds 5 files of 1 block, /w/a/b 3 of 2 blocks, /w/c nothing
+// and /w/wide WIDE_FILES empty files over several directory blocks
+static void makeTree(void)
+{
+    char path[64];
+    fs_mkdir("/w", 0777);
+    fs_mkdir("/w/a", 0777);
+    fs_mkdir("/w/a/b", 0777);
+    fs_mkdir("/w/c", 0777);
+    fs_mkdir("/w/wide", 0777);
+    for (int i = 0; i < 5; i++)
+    {
+        snprintf(path, sizeof(path), "/w/a/f%d", i);
+        makeFile(path, 1);
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        snprintf(path, sizeof(path), "/w/a/b/g%d", i);
+        makeFile(path, 2);
+    }
+    for (int i = 0; i < WIDE_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "/w/wide/e%02d", i);
+        fs_createFile(path, FT_FILE);
+    }
+}
+
+// find: pre and visit record the path
+static int findRecord(const fs_walkentry *we, void *arg)
+{
+    seenList *s = arg;
+    char parent[64];
+    snprintf(parent, sizeof(parent), "%s", we->path);
+    char *slash = strrchr(parent, '/');
+    if (we->depth > 0 && slash != NULL)
+    {
+        *slash = '\0';
+        if (seenIndex(s, parent) < 0)
+            s->outOfOrder++;
+    }
+    if (s->count < MAX_SEEN)
+        snprintf(s->paths[s->count++], sizeof(s->paths[0]), "%s", we->path);
+    return 0;
+}
+
+static void testFind(void)
+{
+    seenList *s = calloc(1, sizeof(*s));
+    fs_walkops ops = {findRecord, findRecord, NULL, s, 4};
+    check(fs_walk("/w", &ops) == 0, "find walks the tree");
+    check(s->count == 5 + 5 + 3 + WIDE_FILES, "find sees every entry");
+    int dup = 0;
+    for (int i = 0; i < s->count; i++)
+        dup += (seenIndex(s, s->paths[i]) != i);
+    check(dup == 0, "find sees each entry once");
+    check(seenIndex(s, "/w/a/b/g2") >= 0 && seenIndex(s, "/w/wide/e59") >= 0 && seenIndex(s, "/w/c") >= 0,
+          "find reaches the deepest file, the last of a long chain and an empty directory");
+    check(s->outOfOrder == 0, "a directory comes before its entries");
+    free(s);
+}
+
+// du: each directory sums its files' blocks and its subdirectories' totals
+typedef struct
+{
+    uint64_t a, b, w;
+} duTotals;
+
+static int duPre(const fs_walkentry *we, void *arg)
+{
+    (void)arg;
+    *we->data = calloc(1, sizeof(uint64_t));
+    return (*we->data == NULL) ? -1 : 0;
+}
+
+static int duVisit(const fs_walkentry *we, void *arg)
+{
+    (void)arg;
+    *(uint64_t *)we->parentData += we->st_blocks;
+    return 0;
+}
+
+static int duPost(const fs_walkentry *we, void *arg)
+{
+    duTotals *t = arg;
+    uint64_t total = *(uint64_t *)*we->data;
+    if (we->parentData != NULL)
+        *(uint64_t *)we->parentData += total;
+    if (strcmp(we->path, "/w/a/b") == 0)
+        t->b = total;
+    else if (strcmp(we->path, "/w/a") == 0)
+        t->a = total;
+    else if (strcmp(we->path, "/w") == 0)
+        t->w = total;
+    free(*we->data);
+    return 0;
+}
+
+static void testDu(void)
+{
+    duTotals t = {0, 0, 0};
+    fs_walkops ops = {duPre, duVisit, duPost, &t, 4};
+    check(fs_walk("/w", &ops) == 0, "du walks the tree");
+    // a file of n blocks takes n + 1 with its header
+    check(t.b == 3 * 3, "du of the deepest directory");
+    check(t.a == 5 * 2 + t.b, "du of a directory adds its subdirectory");
+    // the empty files are just their headers
+    check(t.w == t.a + WIDE_FILES, "du of the top adds up the whole tree");
+}
+
+// rm -r: files as they are found, each directory once it is empty
+static int rmVisit(const fs_walkentry *we, void *arg)
+{
+    (void)arg;
+    return (fs_walkunlink(we) == 0) ? 0 : -1;
+}
+
+static void testRemove(uint64_t freeBefore)
+{
+    fs_walkops ops = {NULL, rmVisit, rmVisit, NULL, 4};
+    check(fs_walk("/w", &ops) == 0, "rm -r walks the tree");
+    check(!fs_isDir("/w") && !fs_isDir("/w/a"), "rm -r removes the tree");
+    check(fs_freeBlockCount() == freeBefore, "rm -r frees every block of the tree");
+}
+
+int main()
+{
+    uint64_t volSize = TEST_VOLUME_SIZE;
+    uint64_t blkSize = TEST_BLOCK_SIZE;
+    printf("Tree Walk Test Program\n");
+    printf("======================\n\n");
+
+    if (startPartitionSystem(LBA_RAM_VOLUME, &volSize, &blkSize) != PART_NOERROR ||
+        initFileSystem(volSize / blkSize, blkSize) != 0)
+    {
+        printf("Could not start a RAM volume\n");
+        return 1;
+    }
+    uint64_t freeBefore = fs_freeBlockCount();
+    makeTree();
+    testFind();
+    testDu();
+    testRemove(freeBefore);
+    exitFileSystem();
+    closePartitionSystem();
+
+    if (failures == 0)
+    {
+        printf("Test program completed successfully!\n");
+    }
+    else
+    {
+        printf("Test program failed! (%d checks)\n", failures);
+    }
+    return failures == 0 ? 0 : 1;
+}